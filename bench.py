@@ -0,0 +1,206 @@
+#!/usr/bin/python3
+import argparse
+import fcntl
+import json
+import os
+import platform
+import pty
+import random
+import select
+import struct
+import subprocess
+import sys
+import tempfile
+import termios
+import time
+
+#
+# Throughput benchmark for procprog
+# Example: make bench
+#          ./bench.py --size 64 --json new.json --compare old.json
+#
+# Each kind of output is generated into a file up front, then cat'd through procprog
+# in each mode, with a pseudo-terminal as procprog's terminal. Plain cat straight into
+# the same kind of pseudo-terminal is the baseline. The headless mode draws into
+# procprog's own virtual terminal, so it only measures procprog.
+#
+
+MODES = {
+    "quiet": [],
+    "verbose": ["-v"],
+    "explicit": ["-e"],
+    "headless": ["-v", "-H", "200x50"],  # Renderer cost alone, no terminal emulator
+}
+TERM_COLS = 200
+TERM_ROWS = 50
+RUN_TIMEOUT = 300
+REGRESSION_THRESHOLD = 0.9  # Slower than this fraction of the old result is a failure
+
+
+def short_lines(rng):
+    return f"cc -O2 -c src/module{rng.randint(0, 999)}.c -o obj/module.o\n".encode()
+
+
+def long_lines(rng):
+    return (" ".join(f"-Iinclude/dir{i}" for i in range(rng.randint(200, 2000))) +
+            "\n").encode()
+
+
+def sgr_lines(rng):
+    words = (f"\033[{rng.choice([0, 1, 31, 32, 33, 34, 35, 36, 90])}mword{i}"
+             for i in range(rng.randint(5, 20)))
+    return (" ".join(words) + "\033[0m\n").encode()
+
+
+def tab_lines(rng):
+    return ("\t".join(f"field{i}" for i in range(rng.randint(3, 12))) + "\n").encode()
+
+
+def progress_bars(rng):
+    bars = bytearray()
+    for percent in range(0, 101):
+        filled = percent // 5
+        bars += f"\r[{'#' * filled}{' ' * (20 - filled)}] {percent:3}%".encode()
+    return bytes(bars) + b"\n"
+
+
+def binary_garbage(rng):
+    return rng.randbytes(4096)
+
+
+KINDS = {
+    "short": short_lines,
+    "long": long_lines,
+    "sgr": sgr_lines,
+    "tabs": tab_lines,
+    "progress": progress_bars,
+    "binary": binary_garbage,
+}
+
+
+def generate(kind, size, path):
+    rng = random.Random(kind)
+    written = 0
+    lines = 0
+    with open(path, "wb") as out:
+        while written < size:
+            chunk = KINDS[kind](rng)
+            out.write(chunk)
+            written += len(chunk)
+            lines += chunk.count(b"\n")
+    return written, lines
+
+
+# Runs command with a pseudo-terminal as stdin, stdout and stderr, and drains it as
+# fast as it can. Returns the wall time, or None if it didn't finish, and how many
+# bytes it sent to the terminal.
+def run_in_pty(command):
+    master, slave = pty.openpty()
+    window_size = struct.pack("HHHH", TERM_ROWS, TERM_COLS, 0, 0)
+    fcntl.ioctl(slave, termios.TIOCSWINSZ, window_size)
+
+    start = time.perf_counter()
+    proc = subprocess.Popen(command, stdin=slave, stdout=slave, stderr=slave,
+                            start_new_session=True)
+    os.close(slave)
+    sent = 0
+
+    while True:
+        ready, _, _ = select.select([master], [], [], RUN_TIMEOUT)
+        if not ready:
+            proc.kill()
+            proc.wait()
+            os.close(master)
+            return None, sent
+        try:
+            chunk = os.read(master, 1 << 16)
+            if not chunk:
+                break
+            sent += len(chunk)
+        except OSError:  # EIO once every copy of the slave is closed
+            break
+
+    proc.wait()
+    elapsed = time.perf_counter() - start
+    os.close(master)
+    return elapsed, sent
+
+
+def compare(results, old_path):
+    with open(old_path) as old_file:
+        old = {(r["kind"], r["mode"]): r for r in json.load(old_file)["results"]}
+
+    regressions = 0
+    for result in results:
+        previous = old.get((result["kind"], result["mode"]))
+        if (result["mode"] == "cat" or not previous or not previous["bytes_per_sec"] or
+                not result["bytes_per_sec"]):
+            continue
+        ratio = result["bytes_per_sec"] / previous["bytes_per_sec"]
+        if ratio < REGRESSION_THRESHOLD:
+            print(f"\033[31mRegression\033[0m {result['kind']} {result['mode']}: "
+                  f"{ratio:.2f}x of {old_path}", file=sys.stderr)
+            regressions += 1
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Measure how fast procprog drains")
+    parser.add_argument("--procprog", default="./procprog", help="binary to benchmark")
+    parser.add_argument("--size", type=int, default=32, help="MB of output per kind")
+    parser.add_argument("--kinds", default=",".join(KINDS), help="comma separated")
+    parser.add_argument("--modes", default=",".join(MODES), help="comma separated")
+    parser.add_argument("--json", help="write the results to this file")
+    parser.add_argument("--compare", help="fail if slower than the results in this file")
+    args = parser.parse_args()
+
+    results = []
+    print(f"{'kind':<10}{'mode':<10}{'MB/s':>10}{'lines/s':>14}{'vs cat':>9}"
+          f"{'tty MB':>9}", file=sys.stderr)
+
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        for kind in args.kinds.split(","):
+            path = os.path.join(tmp_dir, kind)
+            size, lines = generate(kind, args.size * 1024 * 1024, path)
+            baseline, baseline_sent = run_in_pty(["cat", path])
+
+            for mode in ["cat"] + args.modes.split(","):
+                if mode == "cat":
+                    elapsed, sent = baseline, baseline_sent
+                else:
+                    elapsed, sent = run_in_pty([args.procprog] + MODES[mode] +
+                                               ["cat", path])
+
+                result = {
+                    "kind": kind,
+                    "mode": mode,
+                    "bytes": size,
+                    "lines": lines,
+                    "seconds": elapsed,
+                    "bytes_per_sec": size / elapsed if elapsed else None,
+                    "lines_per_sec": lines / elapsed if elapsed else None,
+                    "vs_cat": baseline / elapsed if (elapsed and baseline) else None,
+                    "tty_bytes": sent,  # Everything drawn, the stat line included
+                }
+                results.append(result)
+
+                if elapsed and baseline:
+                    print(f"{kind:<10}{mode:<10}{size / elapsed / 1e6:>10.1f}"
+                          f"{lines / elapsed:>14.0f}{result['vs_cat']:>8.2f}x"
+                          f"{sent / 1e6:>9.1f}", file=sys.stderr)
+                else:
+                    print(f"{kind:<10}{mode:<10}{'timed out':>10}", file=sys.stderr)
+
+    if args.json:
+        with open(args.json, "w") as json_file:
+            json.dump({"machine": platform.node(), "cpus": os.cpu_count(),
+                       "size_mb": args.size, "results": results}, json_file, indent=1)
+
+    if args.compare and compare(results, args.compare):
+        sys.exit(1)
+    if any(r["seconds"] is None for r in results):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
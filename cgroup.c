@@ -0,0 +1,354 @@
+#include "cgroup.h"
+#include "procfile.h"   // for procFileRead, parseUnsigned, nextLine, procFile_t
+#include <fcntl.h>      // for open, O_CLOEXEC, O_WRONLY
+#include <stdbool.h>    // for bool, false, true
+#include <stdio.h>      // for snprintf, fputs, stderr
+#include <string.h>     // for strncmp, strlen, strrchr, memcpy, memset, strcmp
+#include <sys/stat.h>   // for mkdir
+#include <unistd.h>     // for access, close, getpid, rmdir, write, W_OK
+
+
+// Each of these is only read if it exists, the memory and io files are missing when
+// those controllers aren't enabled for the cgroup we're under
+typedef enum
+{
+    CGROUP_CPU_STAT,
+    CGROUP_MEMORY_CURRENT,
+    CGROUP_MEMORY_PEAK,
+    CGROUP_IO_STAT,
+    CGROUP_MEMORY_EVENTS,
+    CGROUP_NUM_FILES,
+} cgroupFile_t;
+
+static const char* const fileNames[CGROUP_NUM_FILES] = {
+    "cpu.stat", "memory.current", "memory.peak", "io.stat", "memory.events",
+};
+static char filePaths[CGROUP_NUM_FILES][CGROUP_PATH_LENGTH + 32];
+static procFile_t files[CGROUP_NUM_FILES];
+static bool fileExists[CGROUP_NUM_FILES];
+static char leafPath[CGROUP_PATH_LENGTH];
+static char parentProcsPath[CGROUP_PATH_LENGTH + 32];
+static int procsFd = -1;
+
+
+
+// Copies the first whitespace terminated word of src into dest
+static bool copyWord(char* dest, size_t destSize, const char* src)
+{
+    size_t length = 0;
+
+    while ((unsigned char)src[length] > ' ')
+        length++;
+    if ((length == 0) || (length >= destSize))
+        return false;
+
+    memcpy(dest, src, length);
+    dest[length] = '\0';
+    return true;
+}
+
+
+// Output generated by show_mountinfo() in fs/proc_namespace.c, the filesystem type
+// comes after the " - " separator and the mount point is the 5th field
+static bool findMount(char* mountPath, size_t size)
+{
+    procFile_t mountInfo = PROC_FILE_INIT("/proc/self/mountinfo");
+    const char* mountPoint;
+    const char* fsType;
+    char* line;
+    bool found = false;
+
+    if (procFileRead(&mountInfo) <= 0)
+    {
+        procFileClose(&mountInfo);
+        return false;
+    }
+
+    for (line = mountInfo.buffer; line && !found; line = nextLine(line))
+    {
+        for (fsType = line; (*fsType != '\n') && (*fsType != '\0'); fsType++)
+        {
+            if (strncmp(fsType, " - ", 3) == 0)
+                break;
+        }
+        if (strncmp(fsType, " - cgroup2 ", 11) != 0)
+            continue;
+
+        mountPoint = skipFields(line, 4);
+        if (mountPoint)
+            found = copyWord(mountPath, size, skipSpaces(mountPoint));
+    }
+
+    procFileClose(&mountInfo);
+    return found;
+}
+
+
+// Output generated by proc_cgroup_show() in kernel/cgroup/cgroup.c, the v2 hierarchy
+// is always the "0::" line. ownPath is left empty for the root cgroup.
+static bool findOwnCgroup(char* ownPath, size_t size)
+{
+    procFile_t cgroupFile = PROC_FILE_INIT("/proc/self/cgroup");
+    char* line;
+    bool found = false;
+
+    if (procFileRead(&cgroupFile) <= 0)
+    {
+        procFileClose(&cgroupFile);
+        return false;
+    }
+
+    for (line = cgroupFile.buffer; line && !found; line = nextLine(line))
+    {
+        if (strncmp(line, "0::", 3) == 0)
+            found = copyWord(ownPath, size, line + 3);
+    }
+    procFileClose(&cgroupFile);
+
+    if (found && (strcmp(ownPath, "/") == 0))
+        ownPath[0] = '\0';
+    return found;
+}
+
+
+// Moving a process needs write access to cgroup.procs in the common ancestor of where
+// it is and where it's going, as well as in the destination
+static bool makeLeaf(const char* parentPath)
+{
+    char path[CGROUP_PATH_LENGTH + 32];
+
+    if ((size_t)snprintf(leafPath, sizeof(leafPath), "%s/procprog.%d", parentPath,
+                         getpid()) >= sizeof(leafPath))
+        return false;
+    if (mkdir(leafPath, 0755) != 0)
+        return false;
+
+    snprintf(parentProcsPath, sizeof(parentProcsPath), "%s/cgroup.procs", parentPath);
+    if (access(parentProcsPath, W_OK) == 0)
+    {
+        snprintf(path, sizeof(path), "%s/cgroup.procs", leafPath);
+        procsFd = open(path, O_WRONLY | O_CLOEXEC);
+        if (procsFd >= 0)
+            return true;
+    }
+
+    rmdir(leafPath);
+    return false;
+}
+
+
+// Tries next to our own cgroup first, its parent is more likely to have the memory and
+// io controllers enabled for its children, then inside it
+static bool makeLeafNearby(void)
+{
+    char mountPath[CGROUP_PATH_LENGTH];
+    char ownPath[CGROUP_PATH_LENGTH];
+    char parentPath[CGROUP_PATH_LENGTH * 2];
+    char* lastSlash;
+
+    if (!findMount(mountPath, sizeof(mountPath)) ||
+        !findOwnCgroup(ownPath, sizeof(ownPath)))
+        return false;
+
+    lastSlash = strrchr(ownPath, '/');
+    if (lastSlash)
+    {
+        snprintf(parentPath, sizeof(parentPath), "%s%.*s", mountPath,
+                 (int)(lastSlash - ownPath), ownPath);
+        if (makeLeaf(parentPath))
+            return true;
+    }
+
+    snprintf(parentPath, sizeof(parentPath), "%s%s", mountPath, ownPath);
+    return makeLeaf(parentPath);
+}
+
+
+// Creates an empty cgroup for the child under parentPath, or near our own cgroup if
+// that's NULL. Returns false if there's nowhere writable, or no cpu.stat to read.
+bool cgroupCreate(const char* parentPath)
+{
+    if (!(parentPath ? makeLeaf(parentPath) : makeLeafNearby()))
+        return false;
+
+    for (unsigned i = 0; i < CGROUP_NUM_FILES; i++)
+    {
+        snprintf(filePaths[i], sizeof(filePaths[i]), "%s/%s", leafPath, fileNames[i]);
+        files[i] = (procFile_t)PROC_FILE_INIT(filePaths[i]);
+        fileExists[i] = (procFileRead(&files[i]) >= 0);
+    }
+
+    if (!fileExists[CGROUP_CPU_STAT])
+    {
+        cgroupRemove();
+        return false;
+    }
+    return true;
+}
+
+
+// Called in the child between fork and exec, so that everything it goes on to start is
+// accounted for. Writing 0 moves the calling process.
+void cgroupJoin(void)
+{
+    if (procsFd < 0)
+        return;
+    if (write(procsFd, "0", 1) < 0)
+        fputs("procprog: couldn't join the cgroup, stats will be incomplete\n", stderr);
+    close(procsFd);
+}
+
+
+// Only succeeds once everything the child started has exited, anything left running
+// keeps the cgroup around
+void cgroupRemove(void)
+{
+    if (procsFd < 0)
+        return;
+
+    for (unsigned i = 0; i < CGROUP_NUM_FILES; i++)
+        procFileClose(&files[i]);
+    close(procsFd);
+    procsFd = -1;
+    rmdir(leafPath);
+}
+
+
+// Moves everything still in the cgroup back to the one it was made in, one pid per
+// write as cgroup.procs wants. Returns false if there was nothing left to move.
+static bool migrateLeftovers(void)
+{
+    char path[CGROUP_PATH_LENGTH + 32];
+    procFile_t leafProcs;
+    unsigned long long pid;
+    char pidText[24];
+    bool moved = false;
+    int parentFd;
+
+    snprintf(path, sizeof(path), "%s/cgroup.procs", leafPath);
+    leafProcs = (procFile_t)PROC_FILE_INIT(path);
+    parentFd = open(parentProcsPath, O_WRONLY | O_CLOEXEC);
+    if ((parentFd >= 0) && (procFileRead(&leafProcs) > 0))
+    {
+        for (const char* line = leafProcs.buffer; line; line = nextLine(line))
+        {
+            if (!parseUnsigned(line, &pid))
+                continue;
+            snprintf(pidText, sizeof(pidText), "%llu", pid);
+            if (write(parentFd, pidText, strlen(pidText)) > 0)
+                moved = true;
+        }
+    }
+
+    if (parentFd >= 0)
+        close(parentFd);
+    procFileClose(&leafProcs);
+    return moved;
+}
+
+
+// On the way out after a signal the child may not have been reaped yet, or may not
+// even have exited, so whatever is left is moved out first. Anything started while
+// that's going on gets another go. The files stay open, the sampler may still be
+// reading them.
+void cgroupAbandon(void)
+{
+    if (procsFd < 0)
+        return;
+
+    for (unsigned attempt = 0; attempt < CGROUP_MIGRATE_ATTEMPTS; attempt++)
+    {
+        if ((rmdir(leafPath) == 0) || !migrateLeftovers())
+            break;
+    }
+    rmdir(leafPath);
+}
+
+
+bool cgroupActive(void)
+{
+    return (procsFd >= 0);
+}
+
+
+// The child's cgroup directory, or NULL if there isn't one
+const char* cgroupPath(void)
+{
+    return (procsFd >= 0) ? leafPath : NULL;
+}
+
+
+// Finds "key value" in a flat keyed file like cpu.stat or memory.events
+static bool findKey(const char* buffer, const char* key, unsigned long long* value)
+{
+    size_t keyLength = strlen(key);
+
+    for (const char* line = buffer; line; line = nextLine(line))
+    {
+        if ((strncmp(line, key, keyLength) == 0) && (line[keyLength] == ' '))
+            return (parseUnsigned(line + keyLength, value) != NULL);
+    }
+    return false;
+}
+
+
+// Output generated by blkcg_print_stat() in block/blk-cgroup.c, one line per device
+// with "key=value" pairs after the device number
+static void sumIoStat(const char* buffer, struct cgroupReading* reading)
+{
+    unsigned long long value;
+    const char* field;
+
+    for (const char* line = buffer; line; line = nextLine(line))
+    {
+        field = skipFields(line, 1);
+        while (field && ((unsigned char)*(field = skipSpaces(field)) > ' '))
+        {
+            if ((strncmp(field, "rbytes=", 7) == 0) && parseUnsigned(field + 7, &value))
+                reading->ioRead += value;
+            else if ((strncmp(field, "wbytes=", 7) == 0) &&
+                     parseUnsigned(field + 7, &value))
+                reading->ioWrite += value;
+            field = skipFields(field, 1);
+        }
+    }
+}
+
+
+static const char* readFile(cgroupFile_t file)
+{
+    if (!fileExists[file] || (procFileRead(&files[file]) <= 0))
+        return NULL;
+    return files[file].buffer;
+}
+
+
+// One small read per file, however many processes have come and gone
+bool cgroupRead(struct cgroupReading* reading)
+{
+    const char* buffer;
+
+    memset(reading, 0, sizeof(*reading));
+    if (procsFd < 0)
+        return false;
+
+    buffer = readFile(CGROUP_CPU_STAT);
+    if (!buffer || !findKey(buffer, "usage_usec", &reading->usageUsec))
+        return false;
+
+    buffer = readFile(CGROUP_MEMORY_CURRENT);
+    reading->hasMemory = (buffer && parseUnsigned(buffer, &reading->memCurrent));
+
+    buffer = readFile(CGROUP_MEMORY_PEAK);
+    reading->hasPeak = (buffer && parseUnsigned(buffer, &reading->memPeak));
+
+    // An empty io.stat just means nothing has been read or written yet
+    reading->hasIo = fileExists[CGROUP_IO_STAT] &&
+                     (procFileRead(&files[CGROUP_IO_STAT]) >= 0);
+    if (reading->hasIo)
+        sumIoStat(files[CGROUP_IO_STAT].buffer, reading);
+
+    buffer = readFile(CGROUP_MEMORY_EVENTS);
+    reading->hasEvents = (buffer && findKey(buffer, "oom_kill", &reading->oomKills));
+    return true;
+}
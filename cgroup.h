@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>  // for bool
+
+#define CGROUP_PATH_LENGTH 512
+#define CGROUP_MIGRATE_ATTEMPTS 3  // Rounds of moving leftovers out before giving up
+
+// Totals for everything that has ever run in the cgroup, exited processes included
+struct cgroupReading
+{
+    unsigned long long usageUsec;
+    unsigned long long memCurrent;  // Bytes
+    unsigned long long memPeak;     // Bytes
+    unsigned long long ioRead;      // Bytes
+    unsigned long long ioWrite;     // Bytes
+    unsigned long long oomKills;
+    bool hasMemory;
+    bool hasPeak;
+    bool hasIo;
+    bool hasEvents;
+};
+
+
+bool cgroupCreate(const char* parentPath);
+void cgroupJoin(void);
+void cgroupRemove(void);
+void cgroupAbandon(void);
+bool cgroupActive(void);
+const char* cgroupPath(void);
+bool cgroupRead(struct cgroupReading* reading);
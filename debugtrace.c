@@ -0,0 +1,224 @@
+#include "debugtrace.h"
+#include "ring.h"       // for ring_t, ringCommit, ringConsume, ringInit, ringRea...
+#include "timer.h"      // for timespecsub, timespecadd
+#include <errno.h>      // for errno, EINTR
+#include <fcntl.h>      // for open, O_CLOEXEC, O_CREAT, O_TRUNC, O_WRONLY
+#include <pthread.h>    // for pthread_mutex_lock, pthread_mutex_unlock, pthread...
+#include <semaphore.h>  // for sem_post, sem_clockwait, sem_init, sem_destroy
+#include <stdbool.h>    // for bool, false, true
+#include <string.h>     // for memcpy, strncpy
+#include <time.h>       // for clock_gettime, timespec, CLOCK_MONOTONIC
+#include <unistd.h>     // for write, close
+
+// The reader and input threads both trace, so the ring's single producer is whoever
+// holds traceLock. The writer thread is the consumer, and the only thing that touches
+// the disk, unless there isn't one (-E), in which case the producer writes when the
+// ring gets full enough or DEBUG_TRACE_FLUSH_SECS have gone by, and the event loop
+// calls debugTraceFlush on its stats tick.
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+static ring_t traceRing;
+static int traceFd = -1;
+static const struct timespec* procStartTime;
+static bool hasWriter;
+static pthread_t writerThread;
+static sem_t writerWake;
+static bool writerWoken;
+static bool writerStopping;
+static time_t lastDrain;  // Only without a writer, CLOCK_MONOTONIC seconds
+
+
+
+// If the file can't be written to any more, the trace is dropped rather than blocking
+// the command
+static void drainRing(void)
+{
+    const unsigned char* data;
+    size_t length;
+    ssize_t numWritten;
+
+    while ((length = ringReadSpace(&traceRing, &data)) > 0)
+    {
+        numWritten = write(traceFd, data, length);
+        if ((numWritten < 0) && (errno == EINTR))
+            continue;
+        ringConsume(&traceRing, (numWritten > 0) ? (size_t)numWritten : length);
+    }
+}
+
+
+static void wakeWriter(void)
+{
+    if (!__atomic_exchange_n(&writerWoken, true, __ATOMIC_ACQ_REL))
+        sem_post(&writerWake);
+}
+
+
+static void* writeLoop(void* arg)
+{
+    struct timespec wakeTime;
+    const struct timespec flushInterval = {.tv_sec = DEBUG_TRACE_FLUSH_SECS};
+    (void)arg;
+
+    while (!__atomic_load_n(&writerStopping, __ATOMIC_ACQUIRE))
+    {
+        clock_gettime(CLOCK_MONOTONIC, &wakeTime);
+        timespecadd(&wakeTime, &flushInterval, &wakeTime);
+        sem_clockwait(&writerWake, CLOCK_MONOTONIC, &wakeTime);
+
+        __atomic_store_n(&writerWoken, false, __ATOMIC_RELEASE);
+        drainRing();
+    }
+    drainRing();
+    return NULL;
+}
+
+
+static void appendBytes(const void* bytes, size_t length)
+{
+    const unsigned char* source = (const unsigned char*)bytes;
+    unsigned char* data;
+    size_t space;
+
+    while (length > 0)
+    {
+        space = ringWriteSpace(&traceRing, &data);
+        if (space == 0)
+        {
+            if (hasWriter)
+            {
+                wakeWriter();
+                ringWaitForSpace(&traceRing);
+            }
+            else
+                drainRing();
+            continue;
+        }
+
+        if (space > length)
+            space = length;
+        memcpy(data, source, space);
+        ringCommit(&traceRing, space);
+        source += space;
+        length -= space;
+    }
+}
+
+
+bool debugTraceOpen(const char* path, const struct timespec* startTime,
+                    bool backgroundWriter)
+{
+    struct debugTraceHeader header = {.version = DEBUG_TRACE_VERSION};
+    struct timespec realTime;
+
+    if (!ringInit(&traceRing, DEBUG_TRACE_RING_SIZE))
+        return false;
+
+    traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (traceFd < 0)
+    {
+        ringDestroy(&traceRing);
+        return false;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &realTime);
+    strncpy(header.magic, DEBUG_TRACE_MAGIC, sizeof(header.magic));
+    header.startTime = ((uint64_t)realTime.tv_sec * 1000000000) + realTime.tv_nsec;
+    procStartTime = startTime;
+    appendBytes(&header, sizeof(header));
+    lastDrain = startTime->tv_sec;
+
+    hasWriter = backgroundWriter;
+    if (hasWriter)
+    {
+        if (sem_init(&writerWake, false, 0) != 0)
+            return false;
+        if (pthread_create(&writerThread, NULL, &writeLoop, NULL) != 0)
+            return false;
+    }
+    return true;
+}
+
+
+// One record per read, and one clock_gettime, however many bytes it was
+void debugTraceWrite(debugTraceKind_t kind, const unsigned char* data, size_t length)
+{
+    struct debugTraceRecord record = {.length = length, .kind = kind};
+    struct timespec currentTime, timeDiff;
+    size_t unwritten;
+
+    pthread_mutex_lock(&traceLock);
+    if (traceFd < 0)
+    {
+        pthread_mutex_unlock(&traceLock);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &currentTime);
+    timespecsub(&currentTime, procStartTime, &timeDiff);
+    record.time = ((uint64_t)timeDiff.tv_sec * 1000000000) + timeDiff.tv_nsec;
+
+    appendBytes(&record, sizeof(record));
+    appendBytes(data, length);
+
+    unwritten = traceRing.head - __atomic_load_n(&traceRing.tail, __ATOMIC_ACQUIRE);
+    if (hasWriter)
+    {
+        if (unwritten >= DEBUG_TRACE_WAKE_LEVEL)
+            wakeWriter();
+    }
+    else if ((unwritten >= DEBUG_TRACE_WAKE_LEVEL) ||
+             ((currentTime.tv_sec - lastDrain) >= DEBUG_TRACE_FLUSH_SECS))
+    {
+        drainRing();
+        lastDrain = currentTime.tv_sec;
+    }
+    pthread_mutex_unlock(&traceLock);
+}
+
+
+// Without a writer thread, so that a trace the command has gone quiet on still gets to
+// the disk. Does nothing when there is one, it flushes on its own.
+void debugTraceFlush(void)
+{
+    struct timespec currentTime;
+
+    pthread_mutex_lock(&traceLock);
+    if ((traceFd >= 0) && !hasWriter)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &currentTime);
+        drainRing();
+        lastDrain = currentTime.tv_sec;
+    }
+    pthread_mutex_unlock(&traceLock);
+}
+
+
+void debugTraceClose(void)
+{
+    int fd;
+
+    pthread_mutex_lock(&traceLock);
+    fd = traceFd;
+    if (fd < 0)
+    {
+        pthread_mutex_unlock(&traceLock);
+        return;
+    }
+
+    if (hasWriter)
+    {
+        __atomic_store_n(&writerStopping, true, __ATOMIC_RELEASE);
+        sem_post(&writerWake);
+        pthread_join(writerThread, NULL);
+        sem_destroy(&writerWake);
+    }
+    else
+    {
+        drainRing();
+    }
+
+    close(fd);
+    ringDestroy(&traceRing);
+    traceFd = -1;
+    pthread_mutex_unlock(&traceLock);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
+#include <stdint.h>   // for uint8_t, uint32_t, uint64_t
+#include <time.h>     // for timespec
+
+#define DEBUG_TRACE_RING_SIZE (8 * 1024 * 1024)  // Must be a power of two
+#define DEBUG_TRACE_WAKE_LEVEL (1024 * 1024)     // Unwritten bytes before a write
+#define DEBUG_TRACE_FLUSH_SECS 1                 // However little there is
+#define DEBUG_TRACE_MAGIC "PPTRACE"
+#define DEBUG_TRACE_VERSION 1
+
+// A debug trace (-d) is a struct debugTraceHeader, then one struct debugTraceRecord per
+// read from the command or the terminal, each followed by its length bytes, exactly as
+// they were read. All in the host's byte order. Times are nanoseconds of
+// CLOCK_MONOTONIC since the command started. replay_log.py decodes it.
+
+typedef enum
+{
+    DEBUG_TRACE_OUTPUT,        // From the command's stdout and stderr
+    DEBUG_TRACE_STDIN,         // From the terminal, passed on to the command
+    DEBUG_TRACE_STDIN_FAILED,  // From the terminal, the command didn't take it
+} debugTraceKind_t;
+
+struct debugTraceHeader
+{
+    char magic[8];  // DEBUG_TRACE_MAGIC, null padded
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t startTime;  // CLOCK_REALTIME in nanoseconds
+};
+
+struct debugTraceRecord
+{
+    uint64_t time;
+    uint32_t length;
+    uint8_t kind;  // debugTraceKind_t
+    uint8_t reserved[3];
+};
+
+
+bool debugTraceOpen(const char* path, const struct timespec* startTime,
+                    bool backgroundWriter);
+void debugTraceWrite(debugTraceKind_t kind, const unsigned char* data, size_t length);
+void debugTraceFlush(void);
+void debugTraceClose(void);
@@ -1,8 +1,11 @@
+#include "render.h"     // for renderPuts, renderPrintf, renderPutc, renderWrite
 #include "stats.h"      // for printStats
-#include <ctype.h>      // for isalpha
+#include "statline.h"   // for statLineInvalidate
+#include <ctype.h>      // for isalpha, isprint
 #include <stdbool.h>    // for bool, true, false
-#include <stdio.h>      // for fputs, stdout, printf, putchar, sscanf
-#include <string.h>     // for memset
+#include <stddef.h>     // for size_t
+#include <stdio.h>      // for sscanf
+#include <string.h>     // for memset, memcpy, memchr
 #include <sys/ioctl.h>  // for winsize
 
 #include "graphics.h"
@@ -11,6 +14,7 @@
 
 static char csiCommandBuf[16] = {0};
 static char* pBuf = csiCommandBuf;
+static bool escaped;
 static unsigned char currentTextFormat[8] = {
     0};  // This should be plenty of simultaneous styles
 
@@ -22,14 +26,14 @@ void setTextFormat(void)
     {
         if (currentTextFormat[i] != 0)
         {
-            printf("\e[%um", currentTextFormat[i]);
+            renderPrintf("\e[%um", currentTextFormat[i]);
         }
     }
 }
 
 void unsetTextFormat(void)
 {
-    fputs("\e[0m", stdout);
+    renderPuts("\e[0m");
 }
 
 
@@ -42,53 +46,55 @@ void returnToStartLine(bool clearText, window_t* window)
     {
         for (unsigned i = 1; i < numLines; i++)
         {
-            fputs("\e[2K\e[1A", stdout);
+            renderPuts("\e[2K\e[1A");
         }
-        fputs("\e[2K\e[1G", stdout);
+        renderPuts("\e[2K\e[1G");
     }
     else
     {
-        printf("\e[%uA\e[1G", numLines);
+        renderPrintf("\e[%uA\e[1G", numLines);
     }
 }
 
 void setScrollArea(unsigned numLines)
 {
-    fputs("\e[s", stdout);
-    printf("\e[0;%ur", numLines);
-    fputs("\e[u", stdout);
+    renderPuts("\e[s");
+    renderPrintf("\e[0;%ur", numLines);
+    renderPuts("\e[u");
 }
 
 
 void gotoStatLine(window_t* window)
 {
     // Clear screen below cursor, move to bottom of screen
-    printf("\e[0J\e[%u;1H", window->termSize.ws_row + 1U);
+    statLineInvalidate();
+    renderPrintf("\e[0J\e[%u;1H", window->termSize.ws_row + 1U);
 }
 
 
 void tidyStats(window_t* window)
 {
     unsetTextFormat();
-    fputs("\e[s", stdout);
+    renderPuts("\e[s");
     gotoStatLine(window);
-    fputs("\e[u", stdout);
+    renderPuts("\e[u");
     setTextFormat();
 }
 
 void clearScreen(window_t* window)
 {
+    statLineInvalidate();
     if (window->alternateBuffer)
     {
         // Erase screen + saved lines
-        fputs("\e[2J\e[3J\e[1;1H", stdout);
+        renderPuts("\e[2J\e[3J\e[1;1H");
     }
     else
     {
         returnToStartLine(false, window);
         // Clears screen from cursor to end, switches to Alternate Screen Buffer
         // Erases saved lines, sets cursor to top left
-        fputs("\e[0J\e[?1049h\e[3J\e[1;1H", stdout);
+        renderPuts("\e[0J\e[?1049h\e[3J\e[1;1H");
         window->alternateBuffer = true;
     }
 }
@@ -132,7 +138,7 @@ static void clearCsiBuffer(void)
 }
 
 
-static bool checkCsiCommand(const unsigned char inputChar, bool* escaped)
+static bool checkCsiCommand(const unsigned char inputChar)
 {
     bool validCommand = false;
     unsigned commandLen = (pBuf - csiCommandBuf);
@@ -141,12 +147,12 @@ static bool checkCsiCommand(const unsigned char inputChar, bool* escaped)
     {
         // No valid command should ever be this long, just drop it
         clearCsiBuffer();
-        *escaped = false;
+        escaped = false;
     }
     else if ((commandLen == 1) && (inputChar != '['))
     {
         clearCsiBuffer();
-        *escaped = false;
+        escaped = false;
     }
     else
     {
@@ -171,7 +177,7 @@ static bool checkCsiCommand(const unsigned char inputChar, bool* escaped)
                 clearCsiBuffer();
                 break;
             }
-            *escaped = false;
+            escaped = false;
         }
     }
 
@@ -184,10 +190,10 @@ static void checkStats(window_t* window, options_t* options)
     if (window->numCharacters > window->termSize.ws_col)
     {
         if ((window->numCharacters % window->termSize.ws_col) == 0)
-            printStats(true, true, window, options);
+            printStats(true, window, options);
     }
     else if (window->numCharacters == window->termSize.ws_col)
-        printStats(true, true, window, options);
+        printStats(true, window, options);
 }
 
 
@@ -201,7 +207,7 @@ void printChar(unsigned char character, unsigned char* inputBuffer, options_t* o
     }
     if (!options->useScrollingRegion)
         checkStats(window, options);
-    putchar(character);
+    renderPutc(character);
 
     if (isprint(character))
         window->numCharacters += 1;
@@ -214,7 +220,6 @@ void printChar(unsigned char character, unsigned char* inputBuffer, options_t* o
 void processChar(unsigned char character, unsigned char* inputBuffer, options_t* options,
                  window_t* window)
 {
-    static bool escaped;
     if (character == '\e')
     {
         escaped = true;
@@ -223,9 +228,9 @@ void processChar(unsigned char character, unsigned char* inputBuffer, options_t*
 
     if (escaped)
     {
-        if (checkCsiCommand(character, &escaped))
+        if (checkCsiCommand(character))
         {
-            fputs(csiCommandBuf, stdout);
+            renderPuts(csiCommandBuf);
             clearCsiBuffer();
         }
     }
@@ -236,6 +241,78 @@ void processChar(unsigned char character, unsigned char* inputBuffer, options_t*
 }
 
 
+// Equivalent to calling processChar on each of a run of printable characters, but
+// copies whole runs at a time between the points where the stats need redrawing
+void printSpan(const unsigned char* span, size_t length, unsigned char* inputBuffer,
+               options_t* options, window_t* window)
+{
+    size_t run;
+
+    // Anything that's part of an escape sequence has to go through the CSI parser
+    while ((length > 0) && escaped)
+    {
+        processChar(*span++, inputBuffer, options, window);
+        length--;
+    }
+
+    while (length > 0)
+    {
+        run = length;
+        if ((!options->useScrollingRegion) && (window->termSize.ws_col > 0))
+        {
+            // checkStats only fires when we land on a multiple of the terminal width
+            checkStats(window, options);
+            if (run > window->termSize.ws_col -
+                          (window->numCharacters % window->termSize.ws_col))
+                run = window->termSize.ws_col -
+                      (window->numCharacters % window->termSize.ws_col);
+        }
+
+        if ((!options->verbose) && (inputBuffer) && (window->numCharacters < 2048))
+        {
+            memcpy(inputBuffer + window->numCharacters, span,
+                   (window->numCharacters + run > 2048) ? 2048 - window->numCharacters
+                                                        : run);
+        }
+
+        renderWrite(span, run);
+        window->numCharacters += run;
+        span += run;
+        length -= run;
+    }
+}
+
+
+// Follows any escape sequences in output that is never going to be displayed, so the
+// text format stays in step with the child process
+void skipChars(const unsigned char* chars, size_t length)
+{
+    const unsigned char* end = chars + length;
+
+    while (chars < end)
+    {
+        if (!escaped)
+        {
+            chars = memchr(chars, '\e', end - chars);
+            if (!chars)
+                break;
+        }
+
+        if (isprint(*chars) || (*chars == '\e') || (*chars == '\b'))
+        {
+            if (*chars == '\e')
+            {
+                escaped = true;
+                clearCsiBuffer();
+            }
+            if (checkCsiCommand(*chars))
+                clearCsiBuffer();
+        }
+        chars++;
+    }
+}
+
+
 void tabToSpaces(unsigned char* inputBuffer, options_t* options, window_t* window)
 {
     printChar(' ', inputBuffer, options, window);
@@ -2,6 +2,7 @@
 
 #include "main.h"     // for window_t, options_t
 #include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
 
 
 // clang-format off
@@ -71,4 +72,7 @@ void processChar(unsigned char character, unsigned char* inputBuffer, options_t*
                  window_t* window);
 void printChar(unsigned char character, unsigned char* inputBuffer, options_t* options,
                window_t* window);
+void printSpan(const unsigned char* span, size_t length, unsigned char* inputBuffer,
+               options_t* options, window_t* window);
+void skipChars(const unsigned char* chars, size_t length);
 void tabToSpaces(unsigned char* inputBuffer, options_t* options, window_t* window);
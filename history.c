@@ -0,0 +1,171 @@
+#include "history.h"
+#include <stdbool.h>  // for bool, false, true
+
+
+// Struct of arrays, so a summary only walks the one metric it's looking at. Everything
+// is allocated up front, nothing is allocated however long the build runs for.
+static float samples[HISTORY_NUM_METRICS][HISTORY_LENGTH];
+static float scratch[HISTORY_LENGTH];
+static unsigned head;  // Where the next sample goes
+static unsigned numRecorded;
+
+// Since the start of the run, however long ago that was
+static double runSums[HISTORY_NUM_METRICS];
+static float runMaxes[HISTORY_NUM_METRICS];
+static unsigned runCounts[HISTORY_NUM_METRICS];
+
+
+
+// Missing values should be __FLT_MAX__, they're left out of the summaries
+void historyRecord(const float values[HISTORY_NUM_METRICS])
+{
+    for (unsigned metric = 0; metric < HISTORY_NUM_METRICS; metric++)
+    {
+        samples[metric][head] = values[metric];
+        if (values[metric] == __FLT_MAX__)
+            continue;
+
+        runSums[metric] += values[metric];
+        if ((runCounts[metric] == 0) || (values[metric] > runMaxes[metric]))
+            runMaxes[metric] = values[metric];
+        runCounts[metric]++;
+    }
+
+    head = (head + 1) % HISTORY_LENGTH;
+    if (numRecorded < HISTORY_LENGTH)
+        numRecorded++;
+}
+
+
+// Covers the whole run, not just what's still in the ring. Returns false if the metric
+// never had a value.
+bool historyRunTotals(historyMetric_t metric, float* mean, float* max)
+{
+    if (runCounts[metric] == 0)
+        return false;
+
+    *mean = runSums[metric] / runCounts[metric];
+    *max = runMaxes[metric];
+    return true;
+}
+
+
+static void swapFloats(float* a, float* b)
+{
+    float temp = *a;
+    *a = *b;
+    *b = temp;
+}
+
+
+// Quickselect, leaves the kth smallest of values at values[k] and shuffles the rest
+static float selectKth(float* values, unsigned numValues, unsigned k)
+{
+    unsigned left = 0, right = numValues - 1;
+    unsigned store;
+    float pivot;
+
+    while (left < right)
+    {
+        swapFloats(&values[(left + right) / 2], &values[right]);
+        pivot = values[right];
+        store = left;
+        for (unsigned i = left; i < right; i++)
+        {
+            if (values[i] < pivot)
+                swapFloats(&values[i], &values[store++]);
+        }
+        swapFloats(&values[store], &values[right]);
+
+        if (store == k)
+            break;
+        else if (store < k)
+            left = store + 1;
+        else
+            right = store - 1;
+    }
+    return values[k];
+}
+
+
+// Nearest rank, so it's always a value that was actually sampled
+static float percentile(float* values, unsigned numValues, unsigned percent)
+{
+    unsigned rank = ((numValues * percent) + 99) / 100;
+    return selectKth(values, numValues, (rank) ? (rank - 1) : 0);
+}
+
+
+static unsigned char sparkLevel(float value, float scale)
+{
+    unsigned level;
+
+    if (value == __FLT_MAX__)
+        return HISTORY_SPARK_EMPTY;
+    if ((value <= 0) || (scale <= 0))
+        return 0;
+
+    level = (unsigned)(((value / scale) * HISTORY_SPARK_LEVELS) + 0.5f);
+    return (level > HISTORY_SPARK_LEVELS) ? HISTORY_SPARK_LEVELS : level;
+}
+
+
+// Summarises the last window samples of metric, the sparkline is relative to scale or
+// to the highest sample if that's 0. Returns false if there's nothing to summarise.
+// Only the thread that records can call this, it shares the scratch buffer.
+bool historySummarise(historyMetric_t metric, unsigned window, float scale,
+                      struct historySummary* summary)
+{
+    const float* values = samples[metric];
+    unsigned first, numCells, numValues = 0;
+    unsigned cellStart, cellEnd;
+    float value, cellMax;
+
+    if (window > numRecorded)
+        window = numRecorded;
+    if (window == 0)
+        return false;
+    first = (head + HISTORY_LENGTH - window) % HISTORY_LENGTH;
+
+    summary->max = 0;
+    for (unsigned i = 0; i < window; i++)
+    {
+        value = values[(first + i) % HISTORY_LENGTH];
+        if (value == __FLT_MAX__)
+            continue;
+        scratch[numValues++] = value;
+        if (value > summary->max)
+            summary->max = value;
+    }
+
+    summary->numSamples = numValues;
+    if (numValues == 0)
+        return false;
+    if (scale <= 0)
+        scale = summary->max;
+
+    // A short history fills the sparkline in from the right
+    numCells = (window < HISTORY_SPARK_CELLS) ? window : HISTORY_SPARK_CELLS;
+    for (unsigned cell = 0; cell < HISTORY_SPARK_CELLS - numCells; cell++)
+        summary->spark[cell] = HISTORY_SPARK_EMPTY;
+
+    for (unsigned cell = 0; cell < numCells; cell++)
+    {
+        cellStart = (cell * window) / numCells;
+        cellEnd = ((cell + 1) * window) / numCells;
+        cellMax = __FLT_MAX__;
+        for (unsigned i = cellStart; i < cellEnd; i++)
+        {
+            value = values[(first + i) % HISTORY_LENGTH];
+            if ((value != __FLT_MAX__) && ((cellMax == __FLT_MAX__) || (value > cellMax)))
+                cellMax = value;
+        }
+        summary->spark[HISTORY_SPARK_CELLS - numCells + cell] =
+            sparkLevel(cellMax, scale);
+    }
+
+    // The percentiles go last, selecting shuffles the scratch copy
+    summary->p95 = percentile(scratch, numValues, 95);
+    summary->p50 = percentile(scratch, numValues, 50);
+    return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>  // for bool
+
+#define HISTORY_LENGTH (30 * 60)  // 30 minutes at one sample a second
+#define HISTORY_WINDOW (5 * 60)   // What the sparklines and percentiles cover
+#define HISTORY_SPARK_CELLS 8
+#define HISTORY_SPARK_LEVELS 7  // One above zero for each of the block characters
+#define HISTORY_SPARK_EMPTY 0xFF
+
+typedef enum
+{
+    HISTORY_CPU,
+    HISTORY_MEM,
+    HISTORY_DISK,
+    HISTORY_DOWNLOAD,
+    HISTORY_UPLOAD,
+    HISTORY_TREE_CPU,
+    HISTORY_TREE_MEM,
+    HISTORY_NUM_METRICS,
+} historyMetric_t;
+
+// Over the last window samples. Each spark cell is the highest sample in its slice of
+// the window, from 0 to HISTORY_SPARK_LEVELS, or HISTORY_SPARK_EMPTY for no samples.
+struct historySummary
+{
+    float p50;
+    float p95;
+    float max;
+    unsigned numSamples;
+    unsigned char spark[HISTORY_SPARK_CELLS];
+};
+
+
+void historyRecord(const float values[HISTORY_NUM_METRICS]);
+bool historyRunTotals(historyMetric_t metric, float* mean, float* max);
+bool historySummarise(historyMetric_t metric, unsigned window, float scale,
+                      struct historySummary* summary);
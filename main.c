@@ -1,46 +1,109 @@
+#include "cgroup.h"       // for cgroupCreate, cgroupJoin, cgroupRemove, cgroupAba...
+#include "debugtrace.h"   // for debugTraceWrite, debugTraceOpen, debugTraceClose, de...
 #include "graphics.h"     // for setScrollArea, gotoStatLine, clea...
-#include "stats.h"        // for printStats, advanceSpinner
-#include "timer.h"        // for tick_create, MSEC_TO_NSEC
+#include "outputlog.h"    // for outputLogWrite, outputLogOpen, outputLogClose
+#include "profile.h"      // for profileRead, profileRendered, profileFlushed
+#include "psi.h"          // for psiInit, psiWaitForTrigger, psiTriggerFds, psiStopW...
+#include "render.h"       // for renderPuts, renderFlush, renderPrintf
+#include "replay.h"       // for replayOpen, replayRun
+#include "ring.h"         // for ring_t, ringWriteSpace, ringCommit
+#include "scan.h"         // for scanPlainText, scanLineBreak, scanInit
+#include "stats.h"        // for printStats, advanceSpinner, watchProcessTree
+#include "statsfile.h"    // for statsFileOpen, statsFileClose
+#include "summary.h"      // for summaryPrint, summaryWriteJson
+#include "tail.h"         // for tailInit, tailWrite, tailPrint
+#include "timer.h"        // for tick_create, tick_delete, MSEC_TO_NSEC, timespecadd
 #include "util.h"         // for showError, proc_runtime, printChar
+#include "vterm.h"        // for vtermDump, vtermCursor
 #include <ctype.h>        // for isprint
-#include <pthread.h>      // for pthread_create, pthread_join, pth...
-#include <semaphore.h>    // for sem_post, sem_wait, sem_destroy
-#include <signal.h>       // for sigaction, sigemptyset, sa_handler
+#include <errno.h>        // for errno, ETIMEDOUT
+#include <fcntl.h>        // for O_RDWR, O_NOCTTY, O_CLOEXEC, open
+#include <pthread.h>      // for pthread_create, pthread_join, pthread_mutex_lock
+#include <sched.h>        // for sched_yield
+#include <semaphore.h>    // for sem_post, sem_wait, sem_clockwait
+#include <signal.h>       // for sigaction, sigemptyset, sa_handler, kill
 #include <stdbool.h>      // for false, true, bool
-#include <stdio.h>        // for fflush, NULL, printf, fclose, fputs
-#include <stdlib.h>       // for EXIT_FAILURE, calloc, exit, WEXIT...
+#include <stdio.h>        // for NULL, fprintf, fclose, fwrite, fputs
+#include <stdlib.h>       // for EXIT_FAILURE, calloc, exit, posix_openpt
 #include <stdnoreturn.h>  // for noreturn
 #include <string.h>       // for memset, strsignal
-#include <sys/ioctl.h>    // for winsize, ioctl, TIOCGWINSZ
+#include <stdint.h>       // for uint32_t, uint64_t
+#include <sys/epoll.h>    // for epoll_event, epoll_ctl, epoll_wait
+#include <sys/ioctl.h>    // for winsize, ioctl, TIOCGWINSZ, TIOCSCTTY
+#include <sys/resource.h>  // for rusage
+#include <sys/signalfd.h>  // for signalfd, signalfd_siginfo
 #include <sys/time.h>     // for CLOCK_MONOTONIC, CLOCK_REALTIME
-#include <sys/wait.h>     // for wait
+#include <sys/timerfd.h>  // for timerfd_create, timerfd_settime
+#include <sys/wait.h>     // for wait4
 #include <termios.h>      // for tcsetattr, tcgetattr
 #include <time.h>         // for clock_gettime, timespec
-#include <unistd.h>       // for close, STDIN_FILENO, dup2, read
+#include <unistd.h>       // for close, STDIN_FILENO, dup2, read, setsid
 
 #include "main.h"
 
 #define DEBUG_FILE "debug.log"
+#define READ_CHUNK_SIZE (64 * 1024)
+#define HELD_LINE_SIZE 2048  // The same as inputBuffer, no more of a line is ever shown
+#define OUTPUT_RING_SIZE (4 * 1024 * 1024)
+#define INPUT_RING_SIZE (4 * 1024)
 
 static window_t procWindow;
 static options_t invocOptions;
 
-static sem_t outputMutex;
-static sem_t redrawMutex;
+static ring_t outputRing;
+static ring_t inputRing;
+static sem_t renderWake;
+static sem_t samplerWake;
+static bool outputFinished;
+static bool statsPending;
+static bool redrawPending;
+static bool samplerStopping;
+static bool ticksStopping;
+static unsigned ticksRunning;  // Tick callbacks that might be about to post samplerWake
+static bool suspendPending;
+static int exitSignal;
+static bool redrawing;
+static struct timespec redrawTime;
+static bool pendingNewLine;
+static sigset_t childSignalMask;
 static const char* childProcessName;
 static unsigned char* inputBuffer;
+static unsigned char heldLine[HELD_LINE_SIZE];  // Quiet mode's newest line, not yet drawn
+static size_t heldLength;
 static FILE* outputFile;
-static FILE* debugFile;
+static pthread_mutex_t outputFileLock = PTHREAD_MUTEX_INITIALIZER;
 static struct termios termRestore;
+static int childPty = -1;  // The -P master, -1 when the command has pipes
+static pid_t ptyChildPid;
 
+static void wakeRenderer(bool* flag)
+{
+    if (flag)
+        __atomic_store_n(flag, true, __ATOMIC_RELEASE);
+    sem_post(&renderWake);
+}
+
+
+// Each tick is a new thread, and one can still start after its timer is deleted
 static void tickCallback(sigval_t sv)
 {
     (void)sv;
-    sem_wait(&outputMutex);
-    unsetTextFormat();
-    printStats(false, false, &procWindow, &invocOptions);
-    setTextFormat();
-    sem_post(&outputMutex);
+    __atomic_add_fetch(&ticksRunning, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&ticksStopping, __ATOMIC_SEQ_CST))
+        sem_post(&samplerWake);
+    __atomic_sub_fetch(&ticksRunning, 1, __ATOMIC_SEQ_CST);
+}
+
+
+// Once this returns no tick will touch samplerWake again
+static void stopTicks(timer_t* timers, unsigned numTimers)
+{
+    for (unsigned i = 0; i < numTimers; i++)
+        tick_delete(timers[i]);
+
+    __atomic_store_n(&ticksStopping, true, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&ticksRunning, __ATOMIC_SEQ_CST) != 0)
+        sched_yield();
 }
 
 
@@ -55,92 +118,327 @@ static void initConsole(void)
             showError(EXIT_FAILURE, false, "Input buffer calloc failed\n");
     }
 
-    sem_wait(&outputMutex);
-
     tcgetattr(STDIN_FILENO, &term);
     tcgetattr(STDIN_FILENO, &termRestore);
     term.c_lflag &= ~(ICANON | ECHO);
     tcsetattr(STDIN_FILENO, TCSANOW, &term);
 
-    fputs("\n\e[1A", stdout);  // Set the cursor to our starting position
+    renderPuts("\n\e[1A");  // Set the cursor to our starting position
     if (invocOptions.useScrollingRegion)
         setScrollArea(procWindow.termSize.ws_row - 1);
-    sem_post(&outputMutex);
+    renderFlush(true);
 }
 
 
-static void* readLoop(void* arg)
+// In quiet mode the previous line gets cleared away once the next one starts
+static void startNextLine(bool* newLine)
 {
-    unsigned char inputChar;
-    bool newLine = false;
-    int procPipe = *(int*)arg;
-
-    while (read(procPipe, &inputChar, 1) > 0)
+    if (*newLine)
     {
-        if (outputFile)
-            fwrite(&inputChar, sizeof(inputChar), 1, outputFile);
+        memset(inputBuffer, 0, 2048);
+        unsetTextFormat();
+        printStats(false, &procWindow, &invocOptions);
+        returnToStartLine(true, &procWindow);
+        setTextFormat();
+        procWindow.numCharacters = 0;
+        *newLine = false;
+    }
+}
 
-        sem_wait(&outputMutex);
 
-        if (invocOptions.verbose)
+static void processOutputChar(unsigned char inputChar, bool* newLine)
+{
+    if (invocOptions.verbose)
+    {
+        if (inputChar == '\t')
         {
-            if (inputChar == '\t')
-            {
-                tabToSpaces(inputBuffer, &invocOptions, &procWindow);
-            }
-            else if (inputChar == '\n')
+            tabToSpaces(inputBuffer, &invocOptions, &procWindow);
+        }
+        else if (inputChar == '\n')
+        {
+            unsetTextFormat();
+            advanceSpinner(&procWindow, &invocOptions);
+            if (invocOptions.useScrollingRegion)
+                renderPutc(inputChar);
+            else
+                printStats(true, &procWindow, &invocOptions);
+            procWindow.numCharacters = 0;
+            setTextFormat();
+        }
+        else if (isprint(inputChar) || (inputChar == '\e') || (inputChar == '\b'))
+        {
+            processChar(inputChar, inputBuffer, &invocOptions, &procWindow);
+        }
+    }
+    else
+    {
+        if ((inputChar >= '\n') && (inputChar <= '\r'))
+        {
+            if (!*newLine)
             {
-                unsetTextFormat();
                 advanceSpinner(&procWindow, &invocOptions);
-                if (invocOptions.useScrollingRegion)
-                    putchar(inputChar);
-                else
-                    printStats(true, true, &procWindow, &invocOptions);
-                procWindow.numCharacters = 0;
-                setTextFormat();
+                *newLine = true;
             }
+        }
+        else
+        {
+            startNextLine(newLine);
+
+            if (inputChar == '\t')
+                tabToSpaces(inputBuffer, &invocOptions, &procWindow);
             else if (isprint(inputChar) || (inputChar == '\e') || (inputChar == '\b'))
-            {
                 processChar(inputChar, inputBuffer, &invocOptions, &procWindow);
-            }
+        }
+    }
+}
+
+
+static void walkOutput(const unsigned char* buffer, size_t length, bool* newLine)
+{
+    size_t span;
+
+    while (length > 0)
+    {
+        span = scanPlainText(buffer, length);
+        if (span == 0)
+        {
+            processOutputChar(*buffer, newLine);
+            span = 1;
         }
         else
         {
-            if ((inputChar >= '\n') && (inputChar <= '\r'))
+            if (!invocOptions.verbose)
+                startNextLine(newLine);
+            printSpan(buffer, span, inputBuffer, &invocOptions, &procWindow);
+        }
+        buffer += span;
+        length -= span;
+    }
+}
+
+
+// Quiet mode only ever shows the latest line, so lines that start and finish within
+// the same chunk are skipped over rather than drawn and then immediately cleared.
+// Without drawSpinner the spinner still moves on, but waits for the next stat line.
+static void skipSupersededLines(const unsigned char* buffer, size_t length,
+                                bool* newLine, bool drawSpinner)
+{
+    unsigned lineBreaks = 0;
+    size_t run;
+
+    while (length > 0)
+    {
+        if ((*buffer >= '\n') && (*buffer <= '\r'))
+        {
+            if (!*newLine)
             {
-                if (!newLine)
-                {
-                    advanceSpinner(&procWindow, &invocOptions);
-                    newLine = true;
-                }
+                lineBreaks++;
+                *newLine = true;
             }
-            else
-            {
-                if (newLine)
-                {
-                    memset(inputBuffer, 0, 2048);
-                    unsetTextFormat();
-                    printStats(false, true, &procWindow, &invocOptions);
-                    returnToStartLine(true, &procWindow);
-                    setTextFormat();
-                    procWindow.numCharacters = 0;
-                    newLine = false;
-                }
+            run = 1;
+        }
+        else
+        {
+            run = scanLineBreak(buffer, length);
+            skipChars(buffer, run);
+            *newLine = false;
+        }
+        buffer += run;
+        length -= run;
+    }
 
-                if (inputChar == '\t')
-                    tabToSpaces(inputBuffer, &invocOptions, &procWindow);
-                else if (isprint(inputChar) || (inputChar == '\e') || (inputChar == '\b'))
-                    processChar(inputChar, inputBuffer, &invocOptions, &procWindow);
-            }
+    if ((lineBreaks > 0) && drawSpinner)
+    {
+        skipSpinner(lineBreaks - 1);
+        advanceSpinner(&procWindow, &invocOptions);
+    }
+    else
+    {
+        skipSpinner(lineBreaks);
+    }
+}
+
+
+static void processOutput(const unsigned char* buffer, size_t length, bool* newLine)
+{
+    size_t firstBreak, lastBreak, lastLine;
+
+    if (invocOptions.verbose)
+    {
+        walkOutput(buffer, length, newLine);
+        return;
+    }
+
+    firstBreak = scanLineBreak(buffer, length);
+    lastLine = length;
+    while ((lastLine > firstBreak) && (buffer[lastLine - 1] >= '\n') &&
+           (buffer[lastLine - 1] <= '\r'))
+        lastLine--;
+
+    if (lastLine <= firstBreak)
+    {
+        walkOutput(buffer, length, newLine);
+        return;
+    }
+
+    // Everything between the end of the line that's currently on screen, and the
+    // start of the last line in this chunk, is never going to be seen
+    lastBreak = scanLastLineBreak(buffer, lastLine);
+    walkOutput(buffer, firstBreak, newLine);
+    skipSupersededLines(buffer + firstBreak, lastBreak + 1 - firstBreak, newLine, true);
+    walkOutput(buffer + lastBreak + 1, length - lastBreak - 1, newLine);
+}
+
+
+// Quiet mode only shows the newest line, so while a frame is already waiting to go
+// out there's no point drawing lines that would be cleared before anyone sees them
+static bool deferOutput(void)
+{
+    struct timespec due, now;
+
+    if (invocOptions.verbose || !renderFrameDue(&due))
+        return false;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return timespeccmp(&now, &due, <);
+}
+
+
+// Draws the line holdOutput kept back, once the frame is due
+static void releaseHeldLine(void)
+{
+    if (heldLength == 0)
+        return;
+
+    processOutput(heldLine, heldLength, &pendingNewLine);
+    heldLength = 0;
+}
+
+
+// While output arrives faster than the frame rate, only the newest line is kept to be
+// drawn with the next frame. A held line that's been followed by another is skipped,
+// so the cost per frame stays the same however many lines went past.
+static void holdOutput(const unsigned char* buffer, size_t length)
+{
+    size_t lastLine = length, lastBreak;
+
+    while ((lastLine > 0) && (buffer[lastLine - 1] >= '\n') &&
+           (buffer[lastLine - 1] <= '\r'))
+        lastLine--;
+
+    lastBreak = scanLastLineBreak(buffer, lastLine);
+    if (lastBreak < lastLine)
+    {
+        skipSupersededLines(heldLine, heldLength, &pendingNewLine, false);
+        skipSupersededLines(buffer, lastBreak + 1, &pendingNewLine, false);
+        heldLength = 0;
+        buffer += lastBreak + 1;
+        length -= lastBreak + 1;
+    }
+
+    // A line too long to hold is drawn now, as it would have been anyway
+    if ((heldLength + length) > sizeof(heldLine))
+    {
+        releaseHeldLine();
+        processOutput(buffer, length, &pendingNewLine);
+        return;
+    }
+
+    memcpy(heldLine + heldLength, buffer, length);
+    heldLength += length;
+}
+
+
+static void showOutput(const unsigned char* buffer, size_t length)
+{
+    if (deferOutput())
+    {
+        holdOutput(buffer, length);
+    }
+    else
+    {
+        releaseHeldLine();
+        processOutput(buffer, length, &pendingNewLine);
+    }
+}
+
+
+// A signal can close the file while the reader or input thread is writing to it
+static void closeOutputFile(void)
+{
+    pthread_mutex_lock(&outputFileLock);
+    if (outputFile && invocOptions.indexedLog)
+        outputLogClose();
+    else if (outputFile)
+        fclose(outputFile);
+    outputFile = NULL;
+    pthread_mutex_unlock(&outputFileLock);
+}
+
+
+static void writeOutputFile(outputLogSource_t source, const unsigned char* data,
+                            size_t length)
+{
+    pthread_mutex_lock(&outputFileLock);
+    if (outputFile && invocOptions.indexedLog)
+        outputLogWrite(source, data, length);
+    else if (outputFile)
+        fwrite(data, sizeof(*data), length, outputFile);
+    pthread_mutex_unlock(&outputFileLock);
+}
+
+
+static void logOutput(const unsigned char* data, size_t length)
+{
+    writeOutputFile(OUTPUT_LOG_CHILD, data, length);
+
+    if (invocOptions.debug)
+        debugTraceWrite(DEBUG_TRACE_OUTPUT, data, length);
+    tailWrite(data, length);
+}
+
+
+static void passInput(unsigned char inputChar, int childStdIn)
+{
+    writeOutputFile(OUTPUT_LOG_STDIN, &inputChar, 1);
+
+    if ((write(childStdIn, &inputChar, 1) < 0) && (invocOptions.debug))
+        debugTraceWrite(DEBUG_TRACE_STDIN_FAILED, &inputChar, 1);
+    else if (invocOptions.debug)
+        debugTraceWrite(DEBUG_TRACE_STDIN, &inputChar, 1);
+}
+
+
+// The reader thread does nothing but move output from the pipe into outputRing, so
+// the child never has to wait on the terminal
+static void* readLoop(void* arg)
+{
+    unsigned char* data;
+    size_t space;
+    ssize_t numRead;
+    int procPipe = *(int*)arg;
+
+    while (1)
+    {
+        space = ringWriteSpace(&outputRing, &data);
+        if (space == 0)
+        {
+            ringWaitForSpace(&outputRing);
+            continue;
         }
 
-        if (invocOptions.debug)
-            fprintf(debugFile, "%.03f: %c (%u)\n", proc_runtime(&procWindow), inputChar,
-                    inputChar);
+        numRead = read(procPipe, data, space);
+        if (numRead <= 0)
+            break;
 
-        fflush(stdout);
-        sem_post(&outputMutex);
+        if (invocOptions.profile)
+            profileRead(numRead);
+        logOutput(data, numRead);
+        if (ringCommit(&outputRing, numRead))
+            wakeRenderer(NULL);
     }
+
+    wakeRenderer(&outputFinished);
     return NULL;
 }
 
@@ -149,151 +447,401 @@ static void* readLoop(void* arg)
 static void* inputLoop(void* arg)
 {
     unsigned char inputChar;
+    unsigned char* data;
     int childStdIn = *(int*)arg;
 
     while (read(STDIN_FILENO, &inputChar, 1) > 0)
     {
-        if (outputFile)
-            fwrite(&inputChar, sizeof(inputChar), 1, outputFile);
-
-        sem_wait(&outputMutex);
-
         if (isprint(inputChar))
         {
-            processChar(inputChar, inputBuffer, &invocOptions, &procWindow);
-            fflush(stdout);
+            while (ringWriteSpace(&inputRing, &data) == 0)
+                ringWaitForSpace(&inputRing);
+            *data = inputChar;
+            if (ringCommit(&inputRing, 1))
+                wakeRenderer(NULL);
         }
-        if ((write(childStdIn, &inputChar, 1) < 0) && (invocOptions.debug))
-            fprintf(debugFile, "stdin passthrough failed (fd %d): %.03f: %c (%u)\n",
-                    childStdIn, proc_runtime(&procWindow), inputChar, inputChar);
-        else if (invocOptions.debug)
-            fprintf(debugFile, "stdin: %.03f: %c (%u)\n", proc_runtime(&procWindow),
-                    inputChar, inputChar);
-
-        sem_post(&outputMutex);
+        passInput(inputChar, childStdIn);
     }
     return NULL;
 }
 
 
 
-static void* redrawThread(void* arg)
+// The sampler thread does all of the /proc reading, so a slow read never holds up the
+// render thread, which just prints whatever the latest snapshot is
+static void* sampleLoop(void* arg)
+{
+    (void)(arg);
+
+    while (1)
+    {
+        sem_wait(&samplerWake);
+        while (sem_trywait(&samplerWake) == 0)
+            ;  // Ticks that queued up behind a slow sample only need one more
+        if (__atomic_load_n(&samplerStopping, __ATOMIC_ACQUIRE))
+            break;
+
+        sampleStats();
+        wakeRenderer(&statsPending);
+    }
+    return NULL;
+}
+
+
+
+// Takes a sample as soon as a PSI trigger fires, rather than waiting for the next tick
+static void* stallLoop(void* arg)
+{
+    (void)(arg);
+
+    while (psiWaitForTrigger())
+        sem_post(&samplerWake);
+    return NULL;
+}
+
+
+
+// When the next thing we've scheduled (a frame going out, or the end of the redraw
+// debounce) is due, returns false if there's nothing scheduled
+static bool nextWakeTime(struct timespec* wakeTime)
+{
+    bool timed = renderFrameDue(wakeTime);
+
+    if (redrawing && (!timed || timespeccmp(&redrawTime, wakeTime, <)))
+    {
+        *wakeTime = redrawTime;
+        timed = true;
+    }
+    return timed;
+}
+
+
+// With -H the size is whatever was asked for, not the real terminal's
+static void getTermSize(int fd)
+{
+    if (invocOptions.headlessSize.ws_row > 0)
+        procWindow.termSize = invocOptions.headlessSize;
+    else
+        ioctl(fd, TIOCGWINSZ, &procWindow.termSize);
+}
+
+
+// The final state of the -H screen, once everything has been flushed into it, then
+// where the cursor was left (1-based, like CUP)
+static void dumpHeadless(void)
+{
+    unsigned row, column;
+
+    if (invocOptions.headlessSize.ws_row == 0)
+        return;
+
+    vtermDump(stdout);
+    vtermCursor(&row, &column);
+    printf("cursor %u,%u\n", row + 1, column + 1);
+}
+
+
+// The command's terminal is ours less the stat line, and it's told when that changes
+static void resizeChildPty(void)
+{
+    struct winsize size = procWindow.termSize;
+
+    if (childPty < 0)
+        return;
+    if (size.ws_row > 1)
+        size.ws_row--;
+    // The command's foreground process group gets SIGWINCH from the kernel
+    ioctl(childPty, TIOCSWINSZ, &size);
+}
+
+
+// With -P the command has its own session, so it no longer gets the signals our
+// terminal sends to procprog, they're passed on to its process group instead
+static void signalPtyChild(int sigNum)
+{
+    if ((childPty >= 0) && (ptyChildPid > 0))
+        kill(-ptyChildPid, sigNum);
+}
+
+
+// -P gives the command a pseudo-terminal so it line buffers like it would on ours. The
+// master stands in for the read end of the output pipe and the write end of the input
+// pipe, the slave for the other two, so everything after this is the same as pipes.
+static void openChildPty(int outputPipe[2], int inputPipe[2])
+{
+    struct termios term;
+    int master, slave;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if ((master < 0) || (grantpt(master) != 0) || (unlockpt(master) != 0))
+        showError(EXIT_FAILURE, false, "Couldn't create a pseudo-terminal\n");
+    slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    if (slave < 0)
+        showError(EXIT_FAILURE, false, "Couldn't open %s\n", ptsname(master));
+
+    // Input is already echoed by procprog, and output should arrive as it was written
+    if (tcgetattr(slave, &term) == 0)
+    {
+        term.c_lflag &= ~ECHO;
+        term.c_oflag &= ~ONLCR;
+        tcsetattr(slave, TCSANOW, &term);
+    }
+
+    outputPipe[0] = master;
+    outputPipe[1] = slave;
+    inputPipe[0] = dup(slave);
+    inputPipe[1] = dup(master);
+    childPty = master;
+    resizeChildPty();
+}
+
+
+static void startRedraw(void)
 {
     struct timespec currentTime;
-    struct timespec timeoutTime;
     struct timespec debounceTime = {
         .tv_sec = 0,
         .tv_nsec = MSEC_TO_NSEC(300),
     };
-    int retval;
-    (void)(arg);
 
-    while (1)
+    getTermSize(STDOUT_FILENO);
+    resizeChildPty();
+    if (!redrawing)
     {
-        sem_wait(&redrawMutex);
-        sem_wait(&outputMutex);
-
         if (invocOptions.verbose)
             tidyStats(&procWindow);
         else
             clearScreen(&procWindow);
-        fflush(stdout);
+        renderFlush(true);
+        redrawing = true;
+    }
 
-    debounce:
-        clock_gettime(CLOCK_REALTIME, &currentTime);
-        timespecadd(&currentTime, &debounceTime, &timeoutTime);
+    // Another sigwinch pushes the redraw back again
+    clock_gettime(CLOCK_MONOTONIC, &currentTime);
+    timespecadd(&currentTime, &debounceTime, &redrawTime);
+}
 
-        retval = sem_timedwait(&redrawMutex, &timeoutTime);
 
-        // If we got the sem succesfully, that means the sigwinch interrupt
-        // fired, so go and wait again.
-        if (retval == 0)
-            goto debounce;
+// Returns true while we're still waiting for the terminal to settle
+static bool finishRedraw(void)
+{
+    struct timespec currentTime;
 
-        printStats(false, true, &procWindow, &invocOptions);
-        if ((!invocOptions.verbose) && (inputBuffer))
-        {
-            fputs((const char*)inputBuffer, stdout);
-            fflush(stdout);
-        }
-        sem_post(&outputMutex);
-    }
-    return NULL;
-}
+    if (!redrawing)
+        return false;
+
+    clock_gettime(CLOCK_MONOTONIC, &currentTime);
+    if (timespeccmp(&currentTime, &redrawTime, <))
+        return true;
 
+    printStats(false, &procWindow, &invocOptions);
+    if ((!invocOptions.verbose) && (inputBuffer))
+        renderPuts((const char*)inputBuffer);
+    renderFlush(true);
+    redrawing = false;
+    return false;
+}
 
 
-static void sigwinchHandler(int sigNum)
+static void echoInput(const unsigned char* data, size_t length)
 {
-    (void)sigNum;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &procWindow.termSize);
-    sem_post(&redrawMutex);
+    for (size_t i = 0; i < length; i++)
+    {
+        if (isprint(data[i]))
+            processChar(data[i], inputBuffer, &invocOptions, &procWindow);
+    }
+    renderFlush(true);
 }
 
 
-static noreturn void sigintHandler(int sigNum)
+static void showStats(void)
 {
-    (void)sigNum;
-    if (invocOptions.debug)
-        fclose(debugFile);
-    if (outputFile)
-        fclose(outputFile);
+    unsetTextFormat();
+    printStats(false, &procWindow, &invocOptions);
+    setTextFormat();
+    renderFlush(true);
+}
+
 
+static void restoreTerminal(void)
+{
     tidyStats(&procWindow);
     unsetTextFormat();
-    printf("\n(%s) %s (signal %d) after %.03fs\n", childProcessName, strsignal(sigNum),
-           sigNum, proc_runtime(&procWindow));
 
     if (procWindow.alternateBuffer)
-        fputs("\e[?1049l", stdout);  // Switch to normal screen buffer
+        renderPuts("\e[?1049l");  // Switch to normal screen buffer
     if (invocOptions.useScrollingRegion)
         setScrollArea(procWindow.termSize.ws_row);
-
-    fflush(stdout);
+    renderFlush(true);
     tcsetattr(STDIN_FILENO, TCSANOW, &termRestore);
-    exit(EXIT_SUCCESS);
 }
 
-static void sigtstpHandler(int sigNum)
+
+static noreturn void exitOnSignal(int sigNum)
 {
-    sigset_t tstpMask, prevMask;
-    struct sigaction stpCatch;
+    signalPtyChild(sigNum);
+    if (invocOptions.debug)
+        debugTraceClose();
+    closeOutputFile();
+    statsFileClose();
+    cgroupAbandon();
 
-    (void)sigNum;
+    releaseHeldLine();
     tidyStats(&procWindow);
     unsetTextFormat();
+    renderPrintf("\n(%s) %s (signal %d) after %.03fs\n", childProcessName,
+                 strsignal(sigNum), sigNum, proc_runtime(&procWindow));
 
     if (procWindow.alternateBuffer)
-        fputs("\e[?1049l", stdout);  // Switch to normal screen buffer
+        renderPuts("\e[?1049l");  // Switch to normal screen buffer
     if (invocOptions.useScrollingRegion)
         setScrollArea(procWindow.termSize.ws_row);
-    fflush(stdout);
+
+    renderFlush(true);
+    dumpHeadless();
     tcsetattr(STDIN_FILENO, TCSANOW, &termRestore);
+    exit(EXIT_SUCCESS);
+}
+
+
+static void suspendProcess(void)
+{
+    sigset_t tstpMask, prevMask;
+    struct sigaction prevAction;
+    struct sigaction defaultAction;
+
+    restoreTerminal();
+    signalPtyChild(SIGSTOP);  // SIGTSTP is ignored outside of our session
 
-    // Revert sigtstp hangler to default (i.e. the terminal)
-    if (signal(SIGTSTP, SIG_DFL) == SIG_ERR)
+    // Revert sigtstp handler to default (i.e. the terminal)
+    sigemptyset(&defaultAction.sa_mask);
+    defaultAction.sa_flags = 0;
+    defaultAction.sa_handler = SIG_DFL;
+    if (sigaction(SIGTSTP, &defaultAction, &prevAction) < 0)
         showError(EXIT_FAILURE, false, "Failed to set default sigtstp\n");
 
     // Generate a further SIGTSTP to trigger the default terminal behaviour
     raise(SIGTSTP);
 
-    // Unblock SIGTSTP, the pending SIGTSTP immediately suspends the program
-    // cppcheck-suppress unreachableCode
+    // If SIGTSTP is blocked (i.e. it's going through the signalfd) unblock it, the
+    // pending SIGTSTP immediately suspends the program
     sigemptyset(&tstpMask);
     sigaddset(&tstpMask, SIGTSTP);
-    if (sigprocmask(SIG_UNBLOCK, &tstpMask, &prevMask) == -1)
+    if (pthread_sigmask(SIG_UNBLOCK, &tstpMask, &prevMask) != 0)
         showError(EXIT_FAILURE, false, "Failed to unblock SIGTSTP\n");
 
     // Execution resumes here after SIGCONT, re-apply previous signal mask
-    if (sigprocmask(SIG_SETMASK, &prevMask, NULL) == -1)
+    if (pthread_sigmask(SIG_SETMASK, &prevMask, NULL) != 0)
         showError(EXIT_FAILURE, false, "Failed to reapply previous signal mask\n");
 
-    // Re-configure the signal handler
-    sigemptyset(&stpCatch.sa_mask);
-    stpCatch.sa_flags = SA_RESTART;
-    stpCatch.sa_handler = sigtstpHandler;
-    if (sigaction(SIGTSTP, &stpCatch, NULL) < 0)
+    if (sigaction(SIGTSTP, &prevAction, NULL) < 0)
         showError(EXIT_FAILURE, false, "Failed sigaction for SIGTSTP\n");
+    signalPtyChild(SIGCONT);
+}
+
+
+
+// Sleeps until another thread has something for us, or the next thing we've
+// scheduled is due
+static void waitForRender(void)
+{
+    struct timespec wakeTime;
+
+    if (!redrawing && (!ringEmpty(&outputRing) || !ringEmpty(&inputRing)))
+        return;
+
+    if (nextWakeTime(&wakeTime))
+    {
+        if ((sem_clockwait(&renderWake, CLOCK_MONOTONIC, &wakeTime) != 0) &&
+            (errno == ETIMEDOUT) && !redrawing)
+        {
+            releaseHeldLine();
+            renderFlush(true);
+        }
+    }
+    else
+    {
+        sem_wait(&renderWake);
+    }
+}
+
+
+// The render thread is the only thing that touches the terminal, or procWindow,
+// while the child is running
+static void* renderLoop(void* arg)
+{
+    const unsigned char* data;
+    size_t length;
+    int sigNum;
+    (void)(arg);
+
+    while (1)
+    {
+        waitForRender();
+
+        sigNum = __atomic_exchange_n(&exitSignal, 0, __ATOMIC_ACQ_REL);
+        if (sigNum)
+            exitOnSignal(sigNum);
+        if (__atomic_exchange_n(&suspendPending, false, __ATOMIC_ACQ_REL))
+            suspendProcess();
+        if (__atomic_exchange_n(&redrawPending, false, __ATOMIC_ACQ_REL))
+            startRedraw();
+        if (finishRedraw())
+            continue;
+
+        if ((length = ringReadSpace(&inputRing, &data)) > 0)
+        {
+            echoInput(data, length);
+            ringConsume(&inputRing, length);
+        }
+
+        if ((length = ringReadSpace(&outputRing, &data)) > 0)
+        {
+            showOutput(data, length);
+            ringConsume(&outputRing, length);
+            if (invocOptions.profile)
+                profileRendered(length);
+        }
+
+        if (__atomic_exchange_n(&statsPending, false, __ATOMIC_ACQ_REL))
+            showStats();
+
+        if (!deferOutput())
+            releaseHeldLine();
+        if (!renderFlush(false) && invocOptions.profile)
+            profileFlushed(heldLength);
+
+        if (__atomic_load_n(&outputFinished, __ATOMIC_ACQUIRE) && ringEmpty(&outputRing))
+            break;
+    }
+
+    releaseHeldLine();
+    renderFlush(true);
+    return NULL;
+}
+
+
+
+// The signal handlers only pass the signal on, everything else is done by whichever
+// thread owns the terminal
+static void sigwinchHandler(int sigNum)
+{
+    (void)sigNum;
+    wakeRenderer(&redrawPending);
+}
+
+
+static void sigintHandler(int sigNum)
+{
+    __atomic_store_n(&exitSignal, sigNum, __ATOMIC_RELEASE);
+    wakeRenderer(NULL);
+}
+
+
+static void sigtstpHandler(int sigNum)
+{
+    (void)sigNum;
+    wakeRenderer(&suspendPending);
 }
 
 
@@ -305,7 +853,7 @@ static void setupInterupts(void)
     struct sigaction winchCatch;
 
     sigemptyset(&intCatch.sa_mask);
-    intCatch.sa_flags = 0;
+    intCatch.sa_flags = SA_RESTART;
     intCatch.sa_handler = sigintHandler;
     if (sigaction(SIGINT, &intCatch, NULL) < 0)
         showError(EXIT_FAILURE, false, "sigaction for SIGINT failed\n");
@@ -328,6 +876,23 @@ static void setupInterupts(void)
 }
 
 
+// In event loop mode, all of the signals we care about are read from a signalfd
+// instead. They have to be blocked before the fork so we can't miss the SIGCHLD.
+static void blockEventSignals(sigset_t* eventSignals)
+{
+    sigemptyset(eventSignals);
+    sigaddset(eventSignals, SIGINT);
+    sigaddset(eventSignals, SIGTERM);
+    sigaddset(eventSignals, SIGQUIT);
+    sigaddset(eventSignals, SIGTSTP);
+    sigaddset(eventSignals, SIGWINCH);
+    sigaddset(eventSignals, SIGCHLD);
+
+    if (sigprocmask(SIG_BLOCK, eventSignals, &childSignalMask) != 0)
+        showError(EXIT_FAILURE, false, "sigprocmask failed\n");
+}
+
+
 
 noreturn static int runCommand(int outputPipe[2], int inputPipe[2],
                                const char** commandLine)
@@ -342,6 +907,17 @@ noreturn static int runCommand(int outputPipe[2], int inputPipe[2],
     close(outputPipe[1]);
     close(inputPipe[0]);
     close(inputPipe[1]);
+    sigprocmask(SIG_SETMASK, &childSignalMask, NULL);
+    cgroupJoin();
+
+    // A session of its own makes the pseudo-terminal its controlling terminal, for
+    // /dev/tty, job control, and SIGWINCH when it's resized
+    if ((childPty >= 0) && ((setsid() < 0) || (ioctl(STDIN_FILENO, TIOCSCTTY, 0) != 0)))
+        showError(EXIT_FAILURE, false, "Couldn't make the pseudo-terminal the command's "
+                                       "controlling terminal\n");
+
+    if (invocOptions.replayFile)
+        replayRun(invocOptions.replaySpeed);
 
     command = commandLine[0];
     status_code = execvp(command, (char* const*)commandLine);
@@ -351,51 +927,295 @@ noreturn static int runCommand(int outputPipe[2], int inputPipe[2],
 }
 
 
-static void readOutput(int outputPipe[2], int inputPipe[2])
+static int threadLoop(pid_t childPid, int procPipe, int childStdIn, struct rusage* usage)
 {
-    pthread_t threadId, readThread, inputThread;
+    pthread_t renderThread, readThread, inputThread, samplerThread, stallThread;
+    timer_t ticks[2];
     int exitStatus;
 
-    close(outputPipe[1]);  // Close write end of fd, only need read
-    close(inputPipe[0]);   // Close read end of fd, only need write
+    if ((sem_init(&renderWake, false, 0) != 0) || (sem_init(&samplerWake, false, 0) != 0))
+        showError(EXIT_FAILURE, false, "sem_init failed\n");
+    if (!ringInit(&outputRing, OUTPUT_RING_SIZE) || !ringInit(&inputRing, INPUT_RING_SIZE))
+        showError(EXIT_FAILURE, false, "Ring buffer allocation failed\n");
+
     setupInterupts();
-    initConsole();
 
-    if (pthread_create(&readThread, NULL, &readLoop, &outputPipe[0]) != 0)
+    if (pthread_create(&readThread, NULL, &readLoop, &procPipe) != 0)
+        showError(EXIT_FAILURE, false, "pthread_create failed\n");
+
+    if (pthread_create(&renderThread, NULL, &renderLoop, NULL) != 0)
         showError(EXIT_FAILURE, false, "pthread_create failed\n");
 
-    if (pthread_create(&threadId, NULL, &redrawThread, NULL) != 0)
+    if (pthread_create(&inputThread, NULL, &inputLoop, &childStdIn) != 0)
         showError(EXIT_FAILURE, false, "pthread_create failed\n");
 
-    if (pthread_create(&inputThread, NULL, &inputLoop, &inputPipe[1]) != 0)
+    if (pthread_create(&samplerThread, NULL, &sampleLoop, NULL) != 0)
         showError(EXIT_FAILURE, false, "pthread_create failed\n");
 
-    tick_create(tickCallback, 1U, 0U, false);
+    if (pthread_create(&stallThread, NULL, &stallLoop, NULL) != 0)
+        showError(EXIT_FAILURE, false, "pthread_create failed\n");
+
+    ticks[0] = tick_create(tickCallback, 1U, 0U, false);
     // CPU usage needs to be taken over a time interval
-    tick_create(tickCallback, 0U, MSEC_TO_NSEC(50U), true);
+    ticks[1] = tick_create(tickCallback, 0U, MSEC_TO_NSEC(50U), true);
 
-    wait(&exitStatus);
+    wait4(childPid, &exitStatus, 0, usage);
     pthread_join(readThread, NULL);  // Wait for everything to complete
+    pthread_join(renderThread, NULL);
+
+    // Nothing may post samplerWake once main() destroys it
+    psiStopWaiting();
+    pthread_join(stallThread, NULL);
+    stopTicks(ticks, sizeof(ticks) / sizeof(ticks[0]));
+
+    __atomic_store_n(&samplerStopping, true, __ATOMIC_RELEASE);
+    sem_post(&samplerWake);
+    pthread_join(samplerThread, NULL);
+    return exitStatus;
+}
+
+
+
+static void watchFd(int epollFd, int op, int fd, uint32_t events)
+{
+    struct epoll_event event = {
+        .events = events,
+        .data.fd = fd,
+    };
+
+    if (epoll_ctl(epollFd, op, fd, &event) != 0)
+        showError(EXIT_FAILURE, false, "epoll_ctl failed for fd %d\n", fd);
+}
+
+
+static int wakeTimeout(void)
+{
+    struct timespec wakeTime;
+    struct timespec currentTime;
+    struct timespec timeout;
+
+    if (!nextWakeTime(&wakeTime))
+        return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &currentTime);
+    if (timespeccmp(&wakeTime, &currentTime, <=))
+        return 0;
+
+    timespecsub(&wakeTime, &currentTime, &timeout);
+    return SEC_TO_MSEC(timeout.tv_sec) + NSEC_TO_MSEC(timeout.tv_nsec + 999999L);
+}
+
+
+// Single threaded alternative to threadLoop, everything is multiplexed through one
+// epoll: the child's output, stdin, the stats tick and signals
+static int eventLoop(pid_t childPid, int procPipe, int childStdIn, sigset_t* eventSignals,
+                     struct rusage* usage)
+{
+    struct epoll_event events[8];
+    struct epoll_event stdinEvent = {
+        .events = EPOLLIN,
+        .data.fd = STDIN_FILENO,
+    };
+    struct signalfd_siginfo sigInfo;
+    struct itimerspec statsPeriod = {
+        .it_value.tv_nsec = MSEC_TO_NSEC(50),  // CPU usage needs a time interval
+        .it_interval.tv_sec = 1,
+    };
+    unsigned char readBuffer[READ_CHUNK_SIZE];
+    unsigned char inputChars[64];
+    uint64_t expirations;
+    bool outputOpen = true;
+    bool outputWatched = true;
+    bool childRunning = true;
+    ssize_t numRead;
+    int epollFd, signalFd, timerFd;
+    int numEvents, exitStatus = 0;
+    int triggerFds[PSI_NUM_RESOURCES];
+    unsigned numTriggers;
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    signalFd = signalfd(-1, eventSignals, SFD_CLOEXEC);
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if ((epollFd < 0) || (signalFd < 0) || (timerFd < 0))
+        showError(EXIT_FAILURE, false, "Failed to create event loop fds\n");
+
+    watchFd(epollFd, EPOLL_CTL_ADD, procPipe, EPOLLIN);
+    watchFd(epollFd, EPOLL_CTL_ADD, signalFd, EPOLLIN);
+    watchFd(epollFd, EPOLL_CTL_ADD, timerFd, EPOLLIN);
+    numTriggers = psiTriggerFds(triggerFds, sizeof(triggerFds) / sizeof(triggerFds[0]));
+    for (unsigned i = 0; i < numTriggers; i++)
+        watchFd(epollFd, EPOLL_CTL_ADD, triggerFds[i], EPOLLPRI);
+
+    // stdin can't be polled if it's a regular file or /dev/null, there's nothing
+    // interactive to pass through in that case anyway
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, STDIN_FILENO, &stdinEvent);
+
+    sampleStats();
+    showStats();
+    timerfd_settime(timerFd, 0, &statsPeriod, NULL);
+
+    while (outputOpen || childRunning)
+    {
+        numEvents = epoll_wait(epollFd, events, sizeof(events) / sizeof(events[0]),
+                               wakeTimeout());
+        if ((numEvents < 0) && (errno != EINTR))
+            showError(EXIT_FAILURE, false, "epoll_wait failed\n");
+
+        for (int i = 0; i < numEvents; i++)
+        {
+            if (events[i].data.fd == procPipe)
+            {
+                numRead = read(procPipe, readBuffer, sizeof(readBuffer));
+                if (numRead <= 0)
+                {
+                    watchFd(epollFd, EPOLL_CTL_DEL, procPipe, 0);
+                    outputOpen = false;
+                    continue;
+                }
+                if (invocOptions.profile)
+                    profileRead(numRead);
+                logOutput(readBuffer, numRead);
+                showOutput(readBuffer, numRead);
+                if (invocOptions.profile)
+                    profileRendered(numRead);
+            }
+            else if (events[i].data.fd == STDIN_FILENO)
+            {
+                numRead = read(STDIN_FILENO, inputChars, sizeof(inputChars));
+                if (numRead <= 0)
+                {
+                    watchFd(epollFd, EPOLL_CTL_DEL, STDIN_FILENO, 0);
+                    continue;
+                }
+                echoInput(inputChars, numRead);
+                for (ssize_t j = 0; j < numRead; j++)
+                    passInput(inputChars[j], childStdIn);
+            }
+            else if (events[i].data.fd == timerFd)
+            {
+                if (read(timerFd, &expirations, sizeof(expirations)) > 0)
+                {
+                    sampleStats();
+                    showStats();
+                    if (invocOptions.debug)
+                        debugTraceFlush();
+                }
+            }
+            else if (events[i].events & EPOLLERR)
+            {
+                watchFd(epollFd, EPOLL_CTL_DEL, events[i].data.fd, 0);
+            }
+            else if (events[i].events & EPOLLPRI)
+            {
+                psiTriggerFired(events[i].data.fd);
+                sampleStats();
+                showStats();
+            }
+            else if (events[i].data.fd == signalFd)
+            {
+                if (read(signalFd, &sigInfo, sizeof(sigInfo)) != sizeof(sigInfo))
+                    continue;
+
+                switch (sigInfo.ssi_signo)
+                {
+                case SIGWINCH:
+                    startRedraw();
+                    break;
+                case SIGTSTP:
+                    suspendProcess();
+                    break;
+                case SIGCHLD:
+                    if (wait4(childPid, &exitStatus, WNOHANG, usage) == childPid)
+                        childRunning = false;
+                    break;
+                default:
+                    exitOnSignal(sigInfo.ssi_signo);
+                }
+            }
+        }
+
+        // Leave the output in the pipe while the terminal is settling after a resize
+        if (outputOpen && (finishRedraw() == outputWatched))
+        {
+            outputWatched = !outputWatched;
+            watchFd(epollFd, EPOLL_CTL_MOD, procPipe, outputWatched ? EPOLLIN : 0);
+        }
+        if (!deferOutput())
+            releaseHeldLine();
+        if (!renderFlush(false) && invocOptions.profile)
+            profileFlushed(heldLength);
+    }
+
+    releaseHeldLine();
+    renderFlush(true);
+    close(timerFd);
+    close(signalFd);
+    close(epollFd);
+    return exitStatus;
+}
+
+
+
+static void readOutput(pid_t childPid, int outputPipe[2], int inputPipe[2],
+                       sigset_t* eventSignals)
+{
+    struct rusage usage = {0};
+    double runTime;
+    int exitStatus;
+
+    close(outputPipe[1]);  // Close write end of fd, only need read
+    close(inputPipe[0]);   // Close read end of fd, only need write
+    watchProcessTree(childPid);
+    ptyChildPid = childPid;
+    if (invocOptions.profile)
+        profileInit(outputPipe[0]);
+    initConsole();
+
+    if (invocOptions.eventLoop)
+        exitStatus =
+            eventLoop(childPid, outputPipe[0], inputPipe[1], eventSignals, &usage);
+    else
+        exitStatus = threadLoop(childPid, outputPipe[0], inputPipe[1], &usage);
+    runTime = proc_runtime(&procWindow);
+    cgroupRemove();
+    statsFileClose();
 
     if (procWindow.alternateBuffer)
-        fputs("\e[?1049l", stdout);  // Switch to normal screen buffer
+        renderPuts("\e[?1049l");  // Switch to normal screen buffer
     unsetTextFormat();
     gotoStatLine(&procWindow);
     if (invocOptions.useScrollingRegion)
         setScrollArea(procWindow.termSize.ws_row);
     tcsetattr(STDIN_FILENO, TCSANOW, &termRestore);
 
+    // Everything the sampler recorded is final now that it's been stopped. It goes
+    // first, so the last line is always how the command ended.
+    if (invocOptions.summary)
+        summaryPrint(&usage, runTime);
+
+    // Quiet mode hid the output, so show how it ended if something went wrong
+    if (!invocOptions.verbose &&
+        (WIFSTOPPED(exitStatus) || WIFSIGNALED(exitStatus) ||
+         (WIFEXITED(exitStatus) && WEXITSTATUS(exitStatus))))
+        tailPrint(childProcessName);
+
     if (WIFSTOPPED(exitStatus))
-        printf("(%s) stopped by signal %d in %.03fs\n", childProcessName,
-               WSTOPSIG(exitStatus), proc_runtime(&procWindow));
+        renderPrintf("(%s) stopped by signal %d in %.03fs\n", childProcessName,
+                     WSTOPSIG(exitStatus), proc_runtime(&procWindow));
     else if (WIFSIGNALED(exitStatus))
-        printf("(%s) terminated by signal %d in %.03fs\n", childProcessName,
-               WTERMSIG(exitStatus), proc_runtime(&procWindow));
+        renderPrintf("(%s) terminated by signal %d in %.03fs\n", childProcessName,
+                     WTERMSIG(exitStatus), proc_runtime(&procWindow));
     else if (WIFEXITED(exitStatus) && WEXITSTATUS(exitStatus))
-        printf("(%s) exited with non-zero status %d in %.03fs\n", childProcessName,
-               WEXITSTATUS(exitStatus), proc_runtime(&procWindow));
+        renderPrintf("(%s) exited with non-zero status %d in %.03fs\n",
+                     childProcessName, WEXITSTATUS(exitStatus), proc_runtime(&procWindow));
     else
-        printf("(%s) finished in %.03fs\n", childProcessName, proc_runtime(&procWindow));
+        renderPrintf("(%s) finished in %.03fs\n", childProcessName,
+                     proc_runtime(&procWindow));
+
+    if (invocOptions.summaryJson &&
+        !summaryWriteJson(invocOptions.summaryJson, childProcessName, exitStatus, &usage,
+                          runTime))
+        renderPrintf("Couldn't write summary to %s\n", invocOptions.summaryJson);
 }
 
 
@@ -409,11 +1229,12 @@ static void initDebugFile(const char* program_name)
 
     time(&rawtime);
     strftime(time_string, sizeof(time_string), "%d.%m.%Y-%H.%M.%S", localtime(&rawtime));
-    snprintf(debug_filename, sizeof(debug_filename), "%s_%s.log", program_name,
+    snprintf(debug_filename, sizeof(debug_filename), "%s_%s.trace", program_name,
              time_string);
 
-    debugFile = fopen(debug_filename, "w");
-    if (!debugFile)
+    // The event loop is meant to be a single thread, so it does its own writes
+    if (!debugTraceOpen(debug_filename, &procWindow.procStartTime,
+                        !invocOptions.eventLoop))
         showError(EXIT_FAILURE, false, "debug file creation failed\n");
 }
 
@@ -422,51 +1243,81 @@ static void initDebugFile(const char* program_name)
 int main(int argc, char** argv)
 {
     const char** commandLine;
+    sigset_t eventSignals;
     int outputPipe[2];
     int inputPipe[2];
     pid_t pid;
 
-    if (pipe(outputPipe) != 0)
-        showError(EXIT_FAILURE, false, "pipe failed\n");
-    if (pipe(inputPipe) != 0)
-        showError(EXIT_FAILURE, false, "pipe failed\n");
-
-    if (sem_init(&outputMutex, false, 1) != 0)
-        showError(EXIT_FAILURE, false, "sem_init failed\n");
-    if (sem_init(&redrawMutex, false, 0) != 0)
-        showError(EXIT_FAILURE, false, "sem_init failed\n");
-
+    scanInit();
     commandLine = getArgs(argc, argv, &outputFile, &invocOptions);
-    childProcessName = commandLine[0];
+    childProcessName =
+        (invocOptions.replayFile) ? invocOptions.replayFile : commandLine[0];
+
+    if (invocOptions.replayFile && !replayOpen(invocOptions.replayFile))
+        showError(EXIT_FAILURE, false, "Couldn't read a trace from %s\n",
+                  invocOptions.replayFile);
 
     if (invocOptions.debug)
         initDebugFile(childProcessName);
+    if (!invocOptions.verbose)
+        tailInit(invocOptions.tailLines);
 
-    ioctl(0, TIOCGWINSZ, &procWindow.termSize);
+    getTermSize(STDIN_FILENO);
+    if ((invocOptions.headlessSize.ws_row > 0) &&
+        !renderHeadless(procWindow.termSize.ws_row, procWindow.termSize.ws_col))
+        showError(EXIT_FAILURE, false, "Couldn't allocate the headless terminal\n");
+
+    if (invocOptions.pty)
+        openChildPty(outputPipe, inputPipe);
+    else if ((pipe(outputPipe) != 0) || (pipe(inputPipe) != 0))
+        showError(EXIT_FAILURE, false, "pipe failed\n");
     clock_gettime(CLOCK_MONOTONIC, &procWindow.procStartTime);
 
+    if (outputFile && invocOptions.indexedLog &&
+        !outputLogOpen(outputFile, &procWindow.procStartTime))
+        showError(EXIT_FAILURE, false, "Couldn't write output file header\n");
+
+    if (invocOptions.statsFile &&
+        !statsFileOpen(invocOptions.statsFile, invocOptions.statsFormat,
+                       &procWindow.procStartTime))
+        showError(EXIT_FAILURE, false, "Couldn't open stats file: %s\n",
+                  invocOptions.statsFile);
+
+    if (invocOptions.eventLoop)
+        blockEventSignals(&eventSignals);
+
+    // Without somewhere to create a cgroup, the tree walk and system stats still work
+    if (invocOptions.cgroup && !cgroupCreate(invocOptions.cgroupParent))
+        fputs("procprog: no writable cgroup (v2) found, using /proc stats\n", stderr);
+    psiInit(cgroupPath());
+
     pid = fork();
     if (pid < 0)
         showError(EXIT_FAILURE, false, "fork failed\n");
     else if (pid == 0)
         runCommand(outputPipe, inputPipe, commandLine);
     else
-        readOutput(outputPipe, inputPipe);
+        readOutput(pid, outputPipe, inputPipe, &eventSignals);
 
     if (procWindow.alternateBuffer)
-        fputs("\e[?1049l", stdout);  // Switch to normal screen buffer
+        renderPuts("\e[?1049l");  // Switch to normal screen buffer
     if (invocOptions.useScrollingRegion)
         setScrollArea(procWindow.termSize.ws_row);
-    fflush(stdout);
+    renderFlush(true);
+    dumpHeadless();
 
-    sem_destroy(&outputMutex);
-    sem_destroy(&redrawMutex);
+    if (!invocOptions.eventLoop)
+    {
+        sem_destroy(&renderWake);
+        sem_destroy(&samplerWake);
+        ringDestroy(&outputRing);
+        ringDestroy(&inputRing);
+    }
 
     if (invocOptions.debug)
-        fclose(debugFile);
+        debugTraceClose();
 
-    if (outputFile)
-        fclose(outputFile);
+    closeOutputFile();
 
     return 0;
 }
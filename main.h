@@ -12,9 +12,31 @@ typedef struct
     bool alternateBuffer;
 } window_t;
 
+typedef enum
+{
+    STATS_FORMAT_CSV,
+    STATS_FORMAT_JSON,  // One object per line
+    STATS_FORMAT_BINARY,
+} statsFormat_t;
+
 typedef struct
 {
     bool verbose;
     bool debug;
     bool useScrollingRegion;
+    bool eventLoop;
+    bool cgroup;
+    const char* cgroupParent;  // NULL to pick one next to our own cgroup
+    const char* statsFile;
+    statsFormat_t statsFormat;
+    bool summary;  // Print the resource usage summary at the end
+    const char* summaryJson;
+    bool indexedLog;  // -o writes an outputlog.h log rather than the raw output
+    const char* replayFile;  // A -d trace to play back instead of running a command
+    double replaySpeed;      // REPLAY_SPEED_MAX to not wait at all
+    bool profile;            // Show procprog's own overhead
+    struct winsize headlessSize;  // -H, all zero to draw to the terminal
+    unsigned tailLines;           // Shown if the command fails in quiet mode, 0 for none
+    bool pty;                     // Run the command on a pseudo-terminal rather than pipes
+    bool allHistory;              // Every history series, not just CPU and Mem
 } options_t;
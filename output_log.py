@@ -0,0 +1,115 @@
+#!/usr/bin/python3
+#
+# Reader for the indexed logs procprog -o FILE -i writes, the layout is in outputlog.h.
+# Example: ./output_log.py build.log                the command's output, as it was
+#          ./output_log.py --dump build.log         every line, with its time and source
+#          ./output_log.py --line 5000 build.log    from line 5000, found with the index
+#          ./output_log.py --time 90 build.log      from 90 seconds in, the same way
+#
+import argparse
+import bisect
+import struct
+import sys
+
+MAGIC = b"PPLOG\0\0\0"
+VERSION = 1
+HEADER = struct.Struct("=8sIIQ")   # magic, version, indexStride, startTime
+RECORD = struct.Struct("=QIBBH")   # time, length, source, flags, reserved
+INDEX_ENTRY = struct.Struct("=QQ")  # time, offset
+FOOTER = struct.Struct("=QQII8s")  # indexOffset, numLines, indexStride, numEntries, magic
+SOURCES = ["output", "stdin"]
+PARTIAL = 0x1
+CONTINUED = 0x2
+
+
+class OutputLog:
+    def __init__(self, path):
+        with open(path, "rb") as log:
+            self.data = log.read()
+
+        magic, version, self.stride, self.start_time = HEADER.unpack_from(self.data, 0)
+        if magic != MAGIC or version != VERSION:
+            raise SystemExit(f"{path} isn't a version {VERSION} procprog indexed log")
+        if len(self.data) < HEADER.size + FOOTER.size:
+            raise SystemExit(f"{path} has no footer, procprog didn't finish writing it")
+
+        (self.index_offset, self.num_lines, stride, num_entries,
+         magic) = FOOTER.unpack_from(self.data, len(self.data) - FOOTER.size)
+        if magic != MAGIC or stride != self.stride:
+            raise SystemExit(f"{path} has no footer, procprog didn't finish writing it")
+
+        self.index = [INDEX_ENTRY.unpack_from(self.data, self.index_offset +
+                                              (i * INDEX_ENTRY.size))
+                      for i in range(num_entries)]
+
+    # Yields (line, time, source, text) for every line from the record at offset on,
+    # numbering them from first_line. Each line comes out once it's whole, with the
+    # time its last record was written, so lines can come out of number order.
+    def lines(self, offset=HEADER.size, first_line=0):
+        pending = {}  # Source to [line, text] of its unfinished line
+        line = first_line
+
+        while offset + RECORD.size <= self.index_offset:
+            time, length, source, flags, _ = RECORD.unpack_from(self.data, offset)
+            offset += RECORD.size
+            text = self.data[offset:offset + length]
+            offset += length
+
+            if not flags & CONTINUED:
+                pending[source] = [line, b""]
+                line += 1
+            elif source not in pending:
+                continue  # The rest of a line that started before offset
+
+            pending[source][1] += text
+            if not flags & PARTIAL:
+                number, whole = pending.pop(source)
+                yield number, time / 1e9, source, whole
+
+    def from_line(self, first_line):
+        entry = min(first_line // self.stride, len(self.index) - 1)
+        if entry < 0:
+            return
+        for line in self.lines(self.index[entry][1], entry * self.stride):
+            if line[0] >= first_line:
+                yield line
+
+    def from_time(self, seconds):
+        if not self.index:
+            return
+        times = [time for time, _ in self.index]
+        entry = max(bisect.bisect_left(times, seconds * 1e9) - 1, 0)
+        for line in self.lines(self.index[entry][1], entry * self.stride):
+            if line[1] >= seconds:
+                yield line
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Read a procprog -o FILE -i log")
+    parser.add_argument("log", help="the log procprog -o wrote")
+    parser.add_argument("--dump", action="store_true",
+                        help="show every line's number, time and source, stdin too")
+    start = parser.add_mutually_exclusive_group()
+    start.add_argument("--line", type=int, help="start from this line (from 0)")
+    start.add_argument("--time", type=float, help="start from this many seconds in")
+    args = parser.parse_args()
+
+    log = OutputLog(args.log)
+    if args.line is not None:
+        lines = log.from_line(args.line)
+    elif args.time is not None:
+        lines = log.from_time(args.time)
+    else:
+        lines = log.lines()
+
+    for line, time, source, text in lines:
+        if args.dump:
+            name = SOURCES[source] if source < len(SOURCES) else str(source)
+            print(f"{line}: {time:.06f} {name} ({len(text)}) {text!r}")
+        elif source == 0:
+            sys.stdout.buffer.write(text)
+    sys.stdout.buffer.flush()
+
+
+if __name__ == "__main__":
+    main()
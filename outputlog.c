@@ -0,0 +1,211 @@
+#include "outputlog.h"
+#include "timer.h"    // for timespecsub
+#include <pthread.h>  // for pthread_mutex_lock, pthread_mutex_unlock, PTHREAD_MUT...
+#include <stdbool.h>  // for bool, false, true
+#include <stdio.h>    // for fwrite, fclose, ferror, setvbuf, FILE
+#include <stdlib.h>   // for free, malloc, realloc
+#include <string.h>   // for memchr, memcpy, strncpy
+#include <time.h>     // for clock_gettime, timespec, CLOCK_MONOTONIC
+
+// A line that hasn't seen its newline yet
+struct pendingLine
+{
+    unsigned char text[OUTPUT_LOG_MAX_LINE];
+    size_t length;
+    bool continued;  // The start of the line already went out in a partial record
+};
+
+// The reader and input threads both log, everything below is behind logLock
+static pthread_mutex_t logLock = PTHREAD_MUTEX_INITIALIZER;
+static FILE* logFile;
+static char* fileBuffer;
+static const struct timespec* procStartTime;
+static struct pendingLine pending[OUTPUT_LOG_NUM_SOURCES];
+static uint64_t fileOffset;
+static uint64_t numLines;
+static struct outputLogIndexEntry* lineIndex;
+static unsigned numEntries;
+static unsigned indexSize;
+
+
+
+static uint64_t logTime(void)
+{
+    struct timespec currentTime, timeDiff;
+
+    clock_gettime(CLOCK_MONOTONIC, &currentTime);
+    timespecsub(&currentTime, procStartTime, &timeDiff);
+    return ((uint64_t)timeDiff.tv_sec * 1000000000) + timeDiff.tv_nsec;
+}
+
+
+static void writeBytes(const void* data, size_t length)
+{
+    fwrite(data, 1, length, logFile);
+    fileOffset += length;
+}
+
+
+// If the index can't grow, the lines after that just aren't indexed, the log itself
+// is still complete
+static void indexLine(uint64_t time)
+{
+    struct outputLogIndexEntry* newIndex;
+
+    if (numLines++ != (uint64_t)numEntries * OUTPUT_LOG_INDEX_STRIDE)
+        return;
+
+    if (numEntries == indexSize)
+    {
+        newIndex = (struct outputLogIndexEntry*)realloc(
+            lineIndex, (indexSize ? indexSize * 2 : 256) * sizeof(*lineIndex));
+        if (!newIndex)
+            return;
+        lineIndex = newIndex;
+        indexSize = indexSize ? indexSize * 2 : 256;
+    }
+    lineIndex[numEntries].time = time;
+    lineIndex[numEntries].offset = fileOffset;
+    numEntries++;
+}
+
+
+static void writeRecord(outputLogSource_t source, const unsigned char* text,
+                        size_t length, bool partial, uint64_t time)
+{
+    struct outputLogRecord record = {
+        .time = time,
+        .length = length,
+        .source = source,
+        .flags = ((partial) ? OUTPUT_LOG_PARTIAL : 0) |
+                 ((pending[source].continued) ? OUTPUT_LOG_CONTINUED : 0),
+    };
+
+    if (!pending[source].continued)
+        indexLine(time);
+    pending[source].continued = partial;
+
+    writeBytes(&record, sizeof(record));
+    writeBytes(text, length);
+}
+
+
+static void flushPending(outputLogSource_t source, bool partial, uint64_t time)
+{
+    struct pendingLine* line = &pending[source];
+
+    writeRecord(source, line->text, line->length, partial, time);
+    line->length = 0;
+}
+
+
+// Whole lines go straight from data to the file buffer, only the unfinished line at the
+// end of a chunk is copied
+static void splitLines(outputLogSource_t source, const unsigned char* data, size_t length,
+                       uint64_t time)
+{
+    struct pendingLine* line = &pending[source];
+    const unsigned char* lineEnd;
+    size_t lineLength, toCopy;
+
+    while (length > 0)
+    {
+        lineEnd = (const unsigned char*)memchr(data, '\n', length);
+        lineLength = (lineEnd) ? (size_t)(lineEnd - data) + 1 : length;
+
+        if ((line->length == 0) && lineEnd && (lineLength <= OUTPUT_LOG_MAX_LINE))
+        {
+            writeRecord(source, data, lineLength, false, time);
+        }
+        else
+        {
+            toCopy = OUTPUT_LOG_MAX_LINE - line->length;
+            if (lineLength < toCopy)
+                toCopy = lineLength;
+            memcpy(line->text + line->length, data, toCopy);
+            line->length += toCopy;
+            lineLength = toCopy;
+
+            if (line->length == OUTPUT_LOG_MAX_LINE)
+                flushPending(source, !lineEnd || (data + toCopy <= lineEnd), time);
+            else if (lineEnd && (data + toCopy > lineEnd))
+                flushPending(source, false, time);
+        }
+
+        data += lineLength;
+        length -= lineLength;
+    }
+}
+
+
+// Takes over file, which should be empty, an index can't be appended to
+bool outputLogOpen(FILE* file, const struct timespec* startTime)
+{
+    struct outputLogHeader header = {
+        .version = OUTPUT_LOG_VERSION,
+        .indexStride = OUTPUT_LOG_INDEX_STRIDE,
+    };
+    struct timespec realTime;
+
+    fileBuffer = (char*)malloc(OUTPUT_LOG_BUFFER_SIZE);
+    if (fileBuffer)
+        setvbuf(file, fileBuffer, _IOFBF, OUTPUT_LOG_BUFFER_SIZE);
+
+    clock_gettime(CLOCK_REALTIME, &realTime);
+    strncpy(header.magic, OUTPUT_LOG_MAGIC, sizeof(header.magic));
+    header.startTime = ((uint64_t)realTime.tv_sec * 1000000000) + realTime.tv_nsec;
+
+    logFile = file;
+    procStartTime = startTime;
+    writeBytes(&header, sizeof(header));
+    return (ferror(file) == 0);
+}
+
+
+void outputLogWrite(outputLogSource_t source, const unsigned char* data, size_t length)
+{
+    pthread_mutex_lock(&logLock);
+    if (logFile)
+        splitLines(source, data, length, logTime());
+    pthread_mutex_unlock(&logLock);
+}
+
+
+// Writes out any unfinished lines and the index, then closes the file
+void outputLogClose(void)
+{
+    struct outputLogFooter footer = {
+        .indexStride = OUTPUT_LOG_INDEX_STRIDE,
+    };
+    uint64_t time;
+
+    pthread_mutex_lock(&logLock);
+    if (!logFile)
+    {
+        pthread_mutex_unlock(&logLock);
+        return;
+    }
+
+    time = logTime();
+    for (unsigned source = 0; source < OUTPUT_LOG_NUM_SOURCES; source++)
+    {
+        if (pending[source].length > 0)
+            flushPending((outputLogSource_t)source, false, time);
+    }
+
+    footer.indexOffset = fileOffset;
+    footer.numLines = numLines;
+    footer.numEntries = numEntries;
+    strncpy(footer.magic, OUTPUT_LOG_MAGIC, sizeof(footer.magic));
+    if (lineIndex)
+        writeBytes(lineIndex, numEntries * sizeof(*lineIndex));
+    writeBytes(&footer, sizeof(footer));
+
+    fclose(logFile);
+    free(fileBuffer);
+    free(lineIndex);
+    logFile = NULL;
+    fileBuffer = NULL;
+    lineIndex = NULL;
+    pthread_mutex_unlock(&logLock);
+}
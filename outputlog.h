@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
+#include <stdint.h>   // for uint8_t, uint16_t, uint32_t, uint64_t
+#include <stdio.h>    // for FILE
+#include <time.h>     // for timespec
+
+#define OUTPUT_LOG_BUFFER_SIZE (1024 * 1024)  // Hundreds of lines per write
+#define OUTPUT_LOG_MAX_LINE 4096              // Longer lines are split into records
+#define OUTPUT_LOG_INDEX_STRIDE 64            // Lines per index entry
+#define OUTPUT_LOG_MAGIC "PPLOG"
+#define OUTPUT_LOG_VERSION 1
+
+// An indexed log (-o FILE -i) is:
+//   struct outputLogHeader
+//   one struct outputLogRecord per line, each followed by its length bytes of text,
+//   including the newline
+//   numEntries struct outputLogIndexEntry, starting at indexOffset
+//   struct outputLogFooter, the last 32 bytes of the file
+// All in the host's byte order. Times are nanoseconds of CLOCK_MONOTONIC since the
+// command started, taken when each record was written, so they never go backwards.
+// Lines are counted across both sources in the order their first records are written,
+// which is when they're finished, or when a long line's first OUTPUT_LOG_MAX_LINE
+// bytes are, not when they start. Index entry n points at the first record of line
+// n * indexStride, so finding a line or a time is a binary search of the index then a
+// scan of indexStride lines. That can be many more records: a line longer than
+// OUTPUT_LOG_MAX_LINE is split into OUTPUT_LOG_PARTIAL records, and the other
+// source's records can come between one line's. OUTPUT_LOG_CONTINUED marks the rest
+// of a line's records, so a scan from an index entry can tell them from new lines.
+// output_log.py reads it.
+
+typedef enum
+{
+    OUTPUT_LOG_CHILD,  // The command's stdout and stderr
+    OUTPUT_LOG_STDIN,  // What was typed, as passed on to the command
+    OUTPUT_LOG_NUM_SOURCES,
+} outputLogSource_t;
+
+#define OUTPUT_LOG_PARTIAL 0x1    // The line carries on in this source's next record
+#define OUTPUT_LOG_CONTINUED 0x2  // The line started in this source's previous record
+
+struct outputLogHeader
+{
+    char magic[8];  // OUTPUT_LOG_MAGIC, null padded
+    uint32_t version;
+    uint32_t indexStride;
+    uint64_t startTime;  // CLOCK_REALTIME in nanoseconds, for turning times into dates
+};
+
+struct outputLogRecord
+{
+    uint64_t time;
+    uint32_t length;
+    uint8_t source;  // outputLogSource_t
+    uint8_t flags;
+    uint16_t reserved;
+};
+
+struct outputLogIndexEntry
+{
+    uint64_t time;
+    uint64_t offset;
+};
+
+struct outputLogFooter
+{
+    uint64_t indexOffset;
+    uint64_t numLines;
+    uint32_t indexStride;
+    uint32_t numEntries;
+    char magic[8];  // OUTPUT_LOG_MAGIC again, so a truncated log can be spotted
+};
+
+
+bool outputLogOpen(FILE* file, const struct timespec* startTime);
+void outputLogWrite(outputLogSource_t source, const unsigned char* data, size_t length);
+void outputLogClose(void);
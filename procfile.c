@@ -0,0 +1,135 @@
+#include "procfile.h"
+#include <errno.h>      // for errno, EINTR
+#include <fcntl.h>      // for open, O_CLOEXEC, O_RDONLY
+#include <stdlib.h>     // for free, realloc
+#include <string.h>     // for strchr
+#include <sys/types.h>  // for ssize_t
+#include <unistd.h>     // for close, pread
+
+
+
+static ssize_t readWholeFile(procFile_t* file)
+{
+    size_t length = 0;
+    ssize_t numRead;
+    char* newBuffer;
+
+    while (1)
+    {
+        if ((length + 1) >= file->size)
+        {
+            newBuffer = (char*)realloc(file->buffer, (file->size) ? (file->size * 2)
+                                                                   : PROC_FILE_INITIAL_SIZE);
+            if (!newBuffer)
+                return -1;
+            file->size = (file->size) ? (file->size * 2) : PROC_FILE_INITIAL_SIZE;
+            file->buffer = newBuffer;
+        }
+
+        numRead = pread(file->fd, file->buffer + length, file->size - length - 1, length);
+        if (numRead < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (numRead == 0)
+            break;
+        // seq_file based files (/proc/net/dev, /proc/diskstats) come up short at a
+        // page or even a record at a time, only 0 means the end
+        length += numRead;
+    }
+
+    file->buffer[length] = '\0';
+    return length;
+}
+
+
+// Returns the length of the file contents now in file->buffer (which is always null
+// terminated), or -1 if it couldn't be read
+ssize_t procFileRead(procFile_t* file)
+{
+    ssize_t length;
+
+    for (unsigned attempt = 0; attempt < 2; attempt++)
+    {
+        if (file->fd < 0)
+        {
+            file->fd = open(file->path, O_RDONLY | O_CLOEXEC);
+            if (file->fd < 0)
+                return -1;
+        }
+
+        length = readWholeFile(file);
+        if (length >= 0)
+            return length;
+
+        // The handle may have gone stale, try once more with a fresh one
+        close(file->fd);
+        file->fd = -1;
+    }
+    return -1;
+}
+
+
+void procFileClose(procFile_t* file)
+{
+    if (file->fd >= 0)
+        close(file->fd);
+    free(file->buffer);
+    file->fd = -1;
+    file->buffer = NULL;
+    file->size = 0;
+}
+
+
+// Returns the start of the line after this one, or NULL if this is the last line
+char* nextLine(const char* line)
+{
+    line = strchr(line, '\n');
+    return (line && line[1]) ? (char*)line + 1 : NULL;
+}
+
+
+const char* skipSpaces(const char* str)
+{
+    while ((*str == ' ') || (*str == '\t'))
+        str++;
+    return str;
+}
+
+
+// Skips over count whitespace separated fields, or returns NULL if the line ends first
+const char* skipFields(const char* str, unsigned count)
+{
+    while (count--)
+    {
+        str = skipSpaces(str);
+        if ((unsigned char)*str <= ' ')
+            return NULL;
+        while ((unsigned char)*str > ' ')
+            str++;
+    }
+    return str;
+}
+
+
+// Parses a decimal number after any leading whitespace, returns the character after it
+// or NULL if there wasn't a number there
+const char* parseUnsigned(const char* str, unsigned long long* value)
+{
+    unsigned long long result = 0;
+    unsigned digit;
+
+    str = skipSpaces(str);
+    if ((unsigned)(*str - '0') > 9)
+        return NULL;
+
+    while ((digit = (unsigned)(*str - '0')) <= 9)
+    {
+        result = (result * 10) + digit;
+        str++;
+    }
+    *value = result;
+    return str;
+}
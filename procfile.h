@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>     // for size_t
+#include <sys/types.h>  // for ssize_t
+
+#define PROC_FILE_INITIAL_SIZE 4096
+#define PROC_FILE_INIT(filePath)                                                         \
+    {                                                                                    \
+        .path = (filePath), .fd = -1, .buffer = NULL, .size = 0                         \
+    }
+
+// A /proc (or /sys) file that's kept open between reads, and re-read from the start
+// into a buffer that's reused and only ever grows
+typedef struct
+{
+    const char* path;
+    int fd;
+    char* buffer;
+    size_t size;
+} procFile_t;
+
+
+ssize_t procFileRead(procFile_t* file);
+void procFileClose(procFile_t* file);
+char* nextLine(const char* line);
+const char* skipSpaces(const char* str);
+const char* skipFields(const char* str, unsigned count);
+const char* parseUnsigned(const char* str, unsigned long long* value);
@@ -0,0 +1,127 @@
+#include "procparse.h"
+#include "procfile.h"  // for nextLine, parseUnsigned, skipFields, skipSpaces
+#include <stdbool.h>   // for bool, false, true
+#include <string.h>    // for strncmp
+
+
+
+// Parses the ten time columns of a "cpu" or "cpuN" line, starting after the name.
+// Returns the character after the last one, or NULL if the line is short.
+const char* procParseCpu(const char* statLine, struct procStat* times)
+{
+    unsigned long long* fields[] = {&times->tUser,    &times->tNice,   &times->tSystem,
+                                    &times->tIdle,    &times->tIoWait, &times->tIrq,
+                                    &times->tSoftIrq, &times->tSteal,  &times->tGuest,
+                                    &times->tGuestNice};
+
+    for (unsigned i = 0; i < (sizeof(fields) / sizeof(*fields)); i++)
+    {
+        statLine = parseUnsigned(statLine, fields[i]);
+        if (statLine == NULL)
+            return NULL;
+    }
+    return statLine;
+}
+
+
+// Both are in kB, returns false unless both were found
+bool procParseMemInfo(const char* buffer, unsigned long long* memTotal,
+                      unsigned long long* memAvailable)
+{
+    bool gotTotal = false;
+    bool gotAvailable = false;
+
+    for (const char* memLine = buffer; memLine && (!gotTotal || !gotAvailable);
+         memLine = nextLine(memLine))
+    {
+        if (strncmp(memLine, "Mem", 3) != 0)
+            continue;
+
+        if (!gotTotal && (strncmp(memLine + 3, "Total:", 6) == 0) &&
+            parseUnsigned(memLine + 9, memTotal))
+            gotTotal = true;
+        else if (!gotAvailable && (strncmp(memLine + 3, "Available:", 10) == 0) &&
+                 parseUnsigned(memLine + 13, memAvailable))
+            gotAvailable = true;
+    }
+    return gotTotal && gotAvailable;
+}
+
+
+// Output generated by dev_seq_show() in net/core/net-procfs.c. Sums every interface but
+// the loopback one, returns how many there were.
+unsigned procParseNetDev(const char* buffer, unsigned long long* bytesDown,
+                         unsigned long long* bytesUp)
+{
+    unsigned long long down, up;
+    const char* devName;
+    const char* devStats;
+    unsigned numDevs = 0;
+
+    *bytesDown = 0;
+    *bytesUp = 0;
+    for (const char* devLine = buffer; devLine; devLine = nextLine(devLine))
+    {
+        // Device names are padded to 6 characters but longer ones push the colon out,
+        // the table title rows don't have one at all
+        devName = skipSpaces(devLine);
+        for (devStats = devName; (unsigned char)*devStats > ' '; devStats++)
+        {
+            if (*devStats == ':')
+                break;
+        }
+        if ((*devStats != ':') || (strncmp(devName, "lo:", 3) == 0))
+            continue;
+
+        // Received bytes is the 1st column, transmitted bytes is the 9th
+        devStats = parseUnsigned(devStats + 1, &down);
+        if (devStats)
+            devStats = skipFields(devStats, 7);
+        if (devStats && parseUnsigned(devStats, &up))
+        {
+            *bytesDown += down;
+            *bytesUp += up;
+            numDevs++;
+        }
+    }
+    return numDevs;
+}
+
+
+// Output generated by diskstats_show() in block/genhd.c. Sums the ms spent busy of the
+// first sd, hd or nvme device of each major number, so partitions aren't counted twice.
+// Returns how many devices there were.
+unsigned procParseDiskStats(const char* buffer, unsigned long long* tBusy)
+{
+    unsigned long long busy, devMajor;
+    unsigned long long majorNum = __INT_MAX__;
+    const char* devName;
+    const char* devStats;
+    unsigned numDisks = 0;
+
+    *tBusy = 0;
+    for (const char* devLine = buffer; devLine; devLine = nextLine(devLine))
+    {
+        devName = parseUnsigned(devLine, &devMajor);
+        if ((devName == NULL) || (devMajor == majorNum))
+            continue;
+        devName = skipFields(devName, 1);  // The minor number
+        if (devName == NULL)
+            continue;
+        devName = skipSpaces(devName);
+
+        if ((strncmp(devName, "sd", 2) == 0) || (strncmp(devName, "hd", 2) == 0) ||
+            (strncmp(devName, "nvme", 4) == 0))
+        {
+            // Element 13 is total ms spent active
+            devStats = skipFields(devName, 10);
+            if (devStats && parseUnsigned(devStats, &busy))
+            {
+                majorNum = devMajor;
+                *tBusy += busy;
+                numDisks++;
+            }
+        }
+    }
+    return numDisks;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>  // for bool
+
+// The /proc files stats.c samples, parsed straight from the buffer procFileRead filled.
+// Nothing here keeps any state, so tests/procfile_test can check them on snapshots.
+
+struct procStat
+{
+    unsigned long long tUser;
+    unsigned long long tNice;
+    unsigned long long tSystem;
+    unsigned long long tIdle;
+    unsigned long long tIoWait;
+    unsigned long long tIrq;
+    unsigned long long tSoftIrq;
+    unsigned long long tSteal;
+    unsigned long long tGuest;
+    unsigned long long tGuestNice;
+};
+
+
+const char* procParseCpu(const char* statLine, struct procStat* times);
+bool procParseMemInfo(const char* buffer, unsigned long long* memTotal,
+                      unsigned long long* memAvailable);
+unsigned procParseNetDev(const char* buffer, unsigned long long* bytesDown,
+                         unsigned long long* bytesUp);
+unsigned procParseDiskStats(const char* buffer, unsigned long long* tBusy);
@@ -0,0 +1,305 @@
+#include "proctree.h"
+#include "procfile.h"   // for procFileRead, parseUnsigned, skipFields, procFile_t
+#include <dirent.h>     // for opendir, readdir, closedir, dirent, DIR
+#include <stdbool.h>    // for bool, false, true
+#include <stdio.h>      // for snprintf
+#include <stdlib.h>     // for calloc, free, realloc
+#include <string.h>     // for strrchr
+#include <sys/types.h>  // for pid_t
+#include <unistd.h>     // for close
+
+
+// A process that was in the tree at the last scan. Its fds stay open so that the next
+// scan only has to pread them, the files are all read into the same shared buffers.
+typedef struct
+{
+    pid_t pid;  // 0 for an empty slot
+    unsigned generation;
+    bool persistent;
+    int statFd;
+    int childrenFd;
+    char statPath[32];
+    char childrenPath[48];
+} treeProc_t;
+
+
+// Open addressed on pid with linear probing. The entries are held in the table itself,
+// so a build that spawns thousands of compilers doesn't allocate anything per process.
+static treeProc_t* procTable;
+static size_t tableSize;
+static size_t tableUsed;
+static unsigned openProcs;
+static unsigned generation;
+static pid_t* pidStack;
+static size_t stackSize;
+static size_t stackUsed;
+static procFile_t statFile = PROC_FILE_INIT(NULL);
+static procFile_t childrenFile = PROC_FILE_INIT(NULL);
+static char taskPath[64];
+
+
+
+static size_t pidSlot(pid_t pid)
+{
+    return ((unsigned)pid * 2654435761U) & (tableSize - 1);
+}
+
+
+static size_t findSlot(pid_t pid)
+{
+    size_t slot = pidSlot(pid);
+
+    while (procTable[slot].pid && (procTable[slot].pid != pid))
+        slot = (slot + 1) & (tableSize - 1);
+    return slot;
+}
+
+
+static bool growTable(void)
+{
+    treeProc_t* oldTable = procTable;
+    size_t oldSize = tableSize;
+    size_t newSize = (tableSize) ? (tableSize * 2) : TREE_TABLE_INITIAL_SIZE;
+
+    procTable = (treeProc_t*)calloc(newSize, sizeof(*procTable));
+    if (!procTable)
+    {
+        procTable = oldTable;
+        return false;
+    }
+
+    tableSize = newSize;
+    for (size_t i = 0; i < oldSize; i++)
+    {
+        if (oldTable[i].pid)
+            procTable[findSlot(oldTable[i].pid)] = oldTable[i];
+    }
+    free(oldTable);
+    return true;
+}
+
+
+static void closeFd(int* fd)
+{
+    if (*fd >= 0)
+        close(*fd);
+    *fd = -1;
+}
+
+
+// Reads path (or the already open fd) into file's buffer, and hands back the fd
+static ssize_t readShared(procFile_t* file, const char* path, int* fd)
+{
+    ssize_t length;
+
+    file->path = path;
+    file->fd = *fd;
+    length = procFileRead(file);
+    *fd = file->fd;
+    file->fd = -1;
+    return length;
+}
+
+
+// The entry is only valid until the next call, the table may have moved by then
+static treeProc_t* lookupProc(pid_t pid)
+{
+    treeProc_t* proc;
+
+    if (((tableUsed + 1) * 2 > tableSize) && !growTable())
+        return NULL;
+
+    proc = &procTable[findSlot(pid)];
+    if (proc->pid)
+        return proc;
+
+    proc->pid = pid;
+    proc->generation = generation - 1;
+    proc->persistent = (openProcs < TREE_MAX_OPEN_PROCS);
+    if (proc->persistent)
+        openProcs++;
+    proc->statFd = -1;
+    proc->childrenFd = -1;
+    snprintf(proc->statPath, sizeof(proc->statPath), "/proc/%d/stat", pid);
+    snprintf(proc->childrenPath, sizeof(proc->childrenPath), "/proc/%d/task/%d/children",
+             pid, pid);
+
+    tableUsed++;
+    return proc;
+}
+
+
+// Removes the entry in slot, then moves any later entries in the same probe run back
+// so they can still be found without needing tombstones
+static void removeSlot(size_t slot)
+{
+    size_t next = slot;
+    size_t home;
+
+    closeFd(&procTable[slot].statFd);
+    closeFd(&procTable[slot].childrenFd);
+    if (procTable[slot].persistent)
+        openProcs--;
+    procTable[slot].pid = 0;
+    tableUsed--;
+
+    while (1)
+    {
+        next = (next + 1) & (tableSize - 1);
+        if (!procTable[next].pid)
+            break;
+
+        home = pidSlot(procTable[next].pid);
+        if ((next > slot) ? ((home <= slot) || (home > next))
+                          : ((home <= slot) && (home > next)))
+        {
+            procTable[slot] = procTable[next];
+            procTable[next].pid = 0;
+            slot = next;
+        }
+    }
+}
+
+
+// Anything that wasn't found in this scan has exited, or been reparented out of the tree
+static void sweepTable(void)
+{
+    for (size_t i = 0; i < tableSize; i++)
+    {
+        while (procTable[i].pid && (procTable[i].generation != generation))
+            removeSlot(i);
+    }
+}
+
+
+static bool pushPid(pid_t pid)
+{
+    pid_t* newStack;
+
+    if (stackUsed == stackSize)
+    {
+        newStack = (pid_t*)realloc(pidStack, ((stackSize) ? (stackSize * 2) : 64) *
+                                                 sizeof(*pidStack));
+        if (!newStack)
+            return false;
+        stackSize = (stackSize) ? (stackSize * 2) : 64;
+        pidStack = newStack;
+    }
+    pidStack[stackUsed++] = pid;
+    return true;
+}
+
+
+static void pushChildren(const char* children)
+{
+    unsigned long long pid;
+
+    while ((children = parseUnsigned(children, &pid)))
+        pushPid((pid_t)pid);
+}
+
+
+// Children are listed per thread, so a multithreaded process needs every task checked
+static void pushTaskChildren(pid_t pid)
+{
+    char taskDirPath[32];
+    struct dirent* task;
+    int taskFd;
+    DIR* taskDir;
+
+    snprintf(taskDirPath, sizeof(taskDirPath), "/proc/%d/task", pid);
+    taskDir = opendir(taskDirPath);
+    if (!taskDir)
+        return;
+
+    while ((task = readdir(taskDir)))
+    {
+        if (task->d_name[0] == '.')
+            continue;
+        snprintf(taskPath, sizeof(taskPath), "/proc/%d/task/%s/children", pid,
+                 task->d_name);
+        taskFd = -1;
+        if (readShared(&childrenFile, taskPath, &taskFd) > 0)
+            pushChildren(childrenFile.buffer);
+        closeFd(&taskFd);
+    }
+    closedir(taskDir);
+}
+
+
+// Output generated by do_task_stat() in fs/proc/array.c, the command name can contain
+// spaces and brackets so the fields are counted from the last ')'
+static bool readProc(treeProc_t* proc, struct treeReading* reading)
+{
+    unsigned long long times[4], numThreads, rss;
+    const char* statLine;
+
+    if (readShared(&statFile, proc->statPath, &proc->statFd) <= 0)
+        return false;
+
+    statLine = strrchr(statFile.buffer, ')');
+    if (statLine)
+        statLine = skipFields(statLine + 1, 11);  // state to cmajflt
+
+    // utime, stime, cutime and cstime
+    for (unsigned i = 0; (i < 4) && statLine; i++)
+        statLine = parseUnsigned(statLine, &times[i]);
+    if (statLine)
+        statLine = skipFields(statLine, 2);  // priority and nice
+    if (statLine)
+        statLine = parseUnsigned(statLine, &numThreads);
+    if (statLine)
+        statLine = skipFields(statLine, 3);  // itrealvalue, starttime and vsize
+    if (!statLine || !parseUnsigned(statLine, &rss))
+        return false;
+
+    // A reaped child's time moves into its parent's cutime/cstime, so the total only
+    // goes backwards if something is reparented out of the tree
+    reading->tCpu += times[0] + times[1] + times[2] + times[3];
+    reading->rssPages += rss;
+    reading->numProcs++;
+
+    if (numThreads > 1)
+        pushTaskChildren(proc->pid);
+    else if (readShared(&childrenFile, proc->childrenPath, &proc->childrenFd) > 0)
+        pushChildren(childrenFile.buffer);
+
+    if (!proc->persistent)
+    {
+        closeFd(&proc->statFd);
+        closeFd(&proc->childrenFd);
+    }
+    return true;
+}
+
+
+// Walks the tree under root by following /proc/<pid>/task/<tid>/children links. Returns
+// false if root has gone or nothing could be read.
+bool procTreeScan(pid_t root, struct treeReading* reading)
+{
+    treeProc_t* proc;
+    pid_t pid;
+
+    reading->tCpu = 0;
+    reading->rssPages = 0;
+    reading->numProcs = 0;
+    generation++;
+    stackUsed = 0;
+
+    if (!pushPid(root))
+        return false;
+
+    while (stackUsed > 0)
+    {
+        pid = pidStack[--stackUsed];
+        proc = lookupProc(pid);
+        if (!proc || (proc->generation == generation))
+            continue;  // Out of memory, or already counted
+
+        if (readProc(proc, reading))
+            proc->generation = generation;
+    }
+
+    sweepTable();
+    return (reading->numProcs > 0);
+}
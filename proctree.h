@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>    // for bool
+#include <sys/types.h>  // for pid_t
+
+#define TREE_TABLE_INITIAL_SIZE 64
+#define TREE_MAX_OPEN_PROCS 256  // Each of these keeps two fds open between scans
+
+// Totals across every process in the tree at the time of the scan
+struct treeReading
+{
+    unsigned long long tCpu;  // Clock ticks, including reaped descendants
+    unsigned long long rssPages;
+    unsigned numProcs;
+};
+
+
+bool procTreeScan(pid_t root, struct treeReading* reading);
@@ -0,0 +1,232 @@
+#include "profile.h"
+#include "timer.h"         // for timespecsub
+#include <stdbool.h>       // for bool, false, true
+#include <stdint.h>        // for uint64_t, uint32_t
+#include <string.h>        // for memcpy
+#include <sys/ioctl.h>     // for ioctl, FIONREAD
+#include <sys/resource.h>  // for getrusage, rusage, RUSAGE_SELF
+#include <sys/time.h>      // for timeval
+#include <time.h>          // for clock_gettime, timespec, CLOCK_MONOTONIC
+
+// When a chunk was read, and how far into the output it ends
+struct readStamp
+{
+    struct timespec time;
+    uint64_t position;
+};
+
+static bool profiling;
+static int pipeFd = -1;
+
+// Written by the reader, which is the render thread as well with -E
+static uint64_t bytesRead;
+static struct readStamp stamps[PROFILE_STAMP_QUEUE_SIZE];
+static unsigned stampHead;
+
+// Only touched by the render thread
+static uint64_t bytesRendered;
+static unsigned stampTail;
+
+// Written by the render thread, read by the sampler
+static uint32_t latencies[PROFILE_LATENCY_BUCKETS];
+
+// Only touched by the sampler
+static uint32_t lastLatencies[PROFILE_LATENCY_BUCKETS];
+static struct timespec lastSampleTime;
+static double lastCpuTime;
+static uint64_t lastBytesRead;
+static float peakBacklog;
+
+
+
+static double cpuSeconds(void)
+{
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return usage.ru_utime.tv_sec + (usage.ru_utime.tv_usec * 1e-6) +
+           usage.ru_stime.tv_sec + (usage.ru_stime.tv_usec * 1e-6);
+}
+
+
+// 8 linear buckets below 8us, then 8 per power of two, so each is within 12.5%
+static unsigned latencyBucket(uint64_t usec)
+{
+    unsigned exponent;
+
+    if (usec < 8)
+        return usec;
+
+    exponent = 63 - __builtin_clzll(usec);
+    if (exponent > 31)
+        return PROFILE_LATENCY_BUCKETS - 1;
+    return (8 * (exponent - 2)) + ((usec >> (exponent - 3)) & 7);
+}
+
+
+// The top of the bucket, so a percentile is never flattering
+static float bucketMsec(unsigned bucket)
+{
+    unsigned exponent;
+
+    if (bucket < 8)
+        return (bucket + 1) / 1000.f;
+
+    exponent = (bucket / 8) + 2;
+    return (float)((8 + (bucket % 8) + 1) << (exponent - 3)) / 1000.f;
+}
+
+
+static float latencyPercentile(const uint32_t* counts, uint64_t total, unsigned percent)
+{
+    uint64_t rank = ((total * percent) + 99) / 100;
+    uint64_t seen = 0;
+
+    for (unsigned bucket = 0; bucket < PROFILE_LATENCY_BUCKETS; bucket++)
+    {
+        seen += counts[bucket];
+        if ((seen >= rank) && (seen > 0))
+            return bucketMsec(bucket);
+    }
+    return __FLT_MAX__;
+}
+
+
+void profileInit(int outputPipe)
+{
+    pipeFd = outputPipe;
+    profiling = true;
+    clock_gettime(CLOCK_MONOTONIC, &lastSampleTime);
+    lastCpuTime = cpuSeconds();
+}
+
+
+bool profileActive(void)
+{
+    return profiling;
+}
+
+
+// Called by whatever reads the command's output, straight after the read
+void profileRead(size_t length)
+{
+    unsigned head = stampHead;
+    uint64_t position = bytesRead + length;
+
+    __atomic_store_n(&bytesRead, position, __ATOMIC_RELAXED);
+
+    // A full queue just means this chunk isn't timed
+    if ((head - __atomic_load_n(&stampTail, __ATOMIC_ACQUIRE)) ==
+        PROFILE_STAMP_QUEUE_SIZE)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &stamps[head & (PROFILE_STAMP_QUEUE_SIZE - 1)].time);
+    stamps[head & (PROFILE_STAMP_QUEUE_SIZE - 1)].position = position;
+    __atomic_store_n(&stampHead, head + 1, __ATOMIC_RELEASE);
+}
+
+
+// Called by the render thread once it has processed length bytes of output
+void profileRendered(size_t length)
+{
+    bytesRendered += length;
+}
+
+
+// Called by the render thread when there's nothing left waiting to go to the
+// terminal. Everything rendered so far has now been written, except for the last held
+// bytes, which are being kept back to draw with a later frame and are timed then.
+void profileFlushed(size_t held)
+{
+    unsigned head = __atomic_load_n(&stampHead, __ATOMIC_ACQUIRE);
+    unsigned tail = stampTail;
+    struct timespec now, latency;
+    const struct readStamp* stamp;
+
+    if (tail == head)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (; tail != head; tail++)
+    {
+        stamp = &stamps[tail & (PROFILE_STAMP_QUEUE_SIZE - 1)];
+        if (stamp->position > (bytesRendered - held))
+            break;
+
+        timespecsub(&now, &stamp->time, &latency);
+        __atomic_add_fetch(&latencies[latencyBucket((latency.tv_sec * 1000000ULL) +
+                                                    (latency.tv_nsec / 1000))],
+                           1, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&stampTail, tail, __ATOMIC_RELEASE);
+}
+
+
+// Called by the sampler, the rates are since the last call
+void profileSample(struct profileReading* reading)
+{
+    struct timespec now, elapsed;
+    uint32_t counts[PROFILE_LATENCY_BUCKETS], window[PROFILE_LATENCY_BUCKETS];
+    uint64_t numTimed = 0, read;
+    double seconds, cpuTime;
+    int backlog;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    timespecsub(&now, &lastSampleTime, &elapsed);
+    seconds = elapsed.tv_sec + (elapsed.tv_nsec * 1e-9);
+    if (seconds <= 0)
+        return;
+
+    cpuTime = cpuSeconds();
+    read = __atomic_load_n(&bytesRead, __ATOMIC_RELAXED);
+    reading->cpu = (100 * (cpuTime - lastCpuTime)) / seconds;
+    reading->ingest = (read - lastBytesRead) / (seconds * 1024 * 1024);
+
+    if ((pipeFd >= 0) && (ioctl(pipeFd, FIONREAD, &backlog) == 0))
+    {
+        reading->backlog = backlog / 1024.f;
+        if (reading->backlog > peakBacklog)
+            peakBacklog = reading->backlog;
+    }
+
+    // Only what was timed since the last sample, a quiet moment keeps the last values
+    for (unsigned i = 0; i < PROFILE_LATENCY_BUCKETS; i++)
+    {
+        counts[i] = __atomic_load_n(&latencies[i], __ATOMIC_RELAXED);
+        window[i] = counts[i] - lastLatencies[i];
+        numTimed += window[i];
+    }
+    if (numTimed > 0)
+    {
+        reading->latencyP50 = latencyPercentile(window, numTimed, 50);
+        reading->latencyP99 = latencyPercentile(window, numTimed, 99);
+    }
+    memcpy(lastLatencies, counts, sizeof(lastLatencies));
+
+    lastSampleTime = now;
+    lastCpuTime = cpuTime;
+    lastBytesRead = read;
+}
+
+
+// For the summary at the end, once the render thread has finished
+void profileGetTotals(struct profileTotals* totals)
+{
+    uint32_t counts[PROFILE_LATENCY_BUCKETS];
+    uint64_t numTimed = 0;
+
+    for (unsigned i = 0; i < PROFILE_LATENCY_BUCKETS; i++)
+    {
+        counts[i] = __atomic_load_n(&latencies[i], __ATOMIC_RELAXED);
+        numTimed += counts[i];
+    }
+
+    totals->cpuTime = cpuSeconds();
+    totals->bytesRead = __atomic_load_n(&bytesRead, __ATOMIC_RELAXED);
+    totals->peakBacklog = peakBacklog;
+    totals->latencyP50 =
+        (numTimed > 0) ? latencyPercentile(counts, numTimed, 50) : __FLT_MAX__;
+    totals->latencyP99 =
+        (numTimed > 0) ? latencyPercentile(counts, numTimed, 99) : __FLT_MAX__;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
+
+#define PROFILE_STAMP_QUEUE_SIZE 1024  // Must be a power of two
+#define PROFILE_LATENCY_BUCKETS 240    // Up to ~2^31us, 8 buckets per power of two
+
+// procprog's own cost, for --profile
+struct profileReading
+{
+    float cpu;         // Percent of one core, all of our threads
+    float ingest;      // MB/s read from the command
+    float backlog;     // KB still in the pipe
+    float latencyP50;  // ms from reading a chunk to it being on the terminal
+    float latencyP99;
+};
+
+// The same over the whole run, for the summary
+struct profileTotals
+{
+    double cpuTime;  // Seconds
+    double bytesRead;
+    float peakBacklog;  // KB
+    float latencyP50;   // ms, __FLT_MAX__ if nothing was ever timed
+    float latencyP99;
+};
+
+
+void profileInit(int outputPipe);
+bool profileActive(void);
+void profileRead(size_t length);
+void profileRendered(size_t length);
+void profileFlushed(size_t held);
+void profileSample(struct profileReading* reading);
+void profileGetTotals(struct profileTotals* totals);
@@ -0,0 +1,187 @@
+#include "psi.h"
+#include "cgroup.h"     // for CGROUP_PATH_LENGTH
+#include "procfile.h"   // for procFileRead, nextLine, PROC_FILE_INIT, procFile_t
+#include <errno.h>      // for errno, EINTR
+#include <fcntl.h>      // for open, O_CLOEXEC, O_RDWR, O_NONBLOCK
+#include <poll.h>       // for poll, pollfd, POLLPRI, POLLERR
+#include <stdbool.h>    // for bool, false, true
+#include <stdio.h>      // for snprintf
+#include <string.h>     // for strncmp, strlen, memset
+#include <sys/eventfd.h>  // for eventfd, eventfd_write, EFD_CLOEXEC
+#include <unistd.h>     // for close, write
+
+
+static const char* const resourceNames[PSI_NUM_RESOURCES] = {"cpu", "memory", "io"};
+static char filePaths[PSI_NUM_RESOURCES][CGROUP_PATH_LENGTH + 32];
+static procFile_t files[PSI_NUM_RESOURCES];
+static int triggerFds[PSI_NUM_RESOURCES] = {-1, -1, -1};
+static bool triggered[PSI_NUM_RESOURCES];
+static int stopFd = -1;  // Wakes psiWaitForTrigger to return false
+
+
+
+// The trigger needs its own fd, once one is written it can only be polled
+static int openTrigger(const char* path)
+{
+    char trigger[64];
+    int fd;
+
+    fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    snprintf(trigger, sizeof(trigger), "some %u %u", PSI_TRIGGER_STALL_USEC,
+             PSI_TRIGGER_WINDOW_USEC);
+    if (write(fd, trigger, strlen(trigger) + 1) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+// Reads the pressure files for cgroupPath, or system-wide from /proc/pressure if that's
+// NULL. Triggers are set up where the kernel allows it, they're optional.
+void psiInit(const char* cgroupPath)
+{
+    for (unsigned i = 0; i < PSI_NUM_RESOURCES; i++)
+    {
+        if (cgroupPath)
+            snprintf(filePaths[i], sizeof(filePaths[i]), "%s/%s.pressure", cgroupPath,
+                     resourceNames[i]);
+        else
+            snprintf(filePaths[i], sizeof(filePaths[i]), "/proc/pressure/%s",
+                     resourceNames[i]);
+
+        files[i] = (procFile_t)PROC_FILE_INIT(filePaths[i]);
+        triggerFds[i] = openTrigger(filePaths[i]);
+    }
+    stopFd = eventfd(0, EFD_CLOEXEC);
+}
+
+
+// Output generated by psi_show() in kernel/sched/psi.c, a "some" line and then a "full"
+// line, which is all zeros for the system-wide cpu file
+static bool parseAvg10(const char* line, const char* kind, float* avg10)
+{
+    unsigned long long whole, fraction = 0;
+    size_t kindLength = strlen(kind);
+    const char* value;
+
+    if ((strncmp(line, kind, kindLength) != 0) ||
+        (strncmp(line + kindLength, " avg10=", 7) != 0))
+        return false;
+
+    value = parseUnsigned(line + kindLength + 7, &whole);
+    if (value && (*value == '.'))
+        value = parseUnsigned(value + 1, &fraction);  // Always 2 decimal places
+    if (!value)
+        return false;
+
+    *avg10 = whole + (fraction / 100.0f);
+    return true;
+}
+
+
+bool psiRead(struct psiReading* reading)
+{
+    const char* line;
+    bool gotAny = false;
+
+    memset(reading, 0, sizeof(*reading));
+
+    for (unsigned i = 0; i < PSI_NUM_RESOURCES; i++)
+    {
+        reading->triggered[i] =
+            __atomic_exchange_n(&triggered[i], false, __ATOMIC_ACQ_REL);
+        if (procFileRead(&files[i]) <= 0)
+            continue;
+
+        line = files[i].buffer;
+        if (!parseAvg10(line, "some", &reading->some[i]))
+            continue;
+        line = nextLine(line);
+        if (line)
+            parseAvg10(line, "full", &reading->full[i]);
+        gotAny = true;
+    }
+    return gotAny;
+}
+
+
+// For the event loop to watch with EPOLLPRI
+unsigned psiTriggerFds(int* fds, unsigned maxFds)
+{
+    unsigned numFds = 0;
+
+    for (unsigned i = 0; (i < PSI_NUM_RESOURCES) && (numFds < maxFds); i++)
+    {
+        if (triggerFds[i] >= 0)
+            fds[numFds++] = triggerFds[i];
+    }
+    return numFds;
+}
+
+
+void psiTriggerFired(int fd)
+{
+    for (unsigned i = 0; i < PSI_NUM_RESOURCES; i++)
+    {
+        if (triggerFds[i] == fd)
+            __atomic_store_n(&triggered[i], true, __ATOMIC_RELEASE);
+    }
+}
+
+
+// Blocks until at least one trigger fires, returns false if there aren't any to wait on
+// or psiStopWaiting has been called
+bool psiWaitForTrigger(void)
+{
+    struct pollfd pollFds[PSI_NUM_RESOURCES + 1];
+    unsigned numFds = 0;
+    int numReady;
+
+    for (unsigned i = 0; i < PSI_NUM_RESOURCES; i++)
+    {
+        if (triggerFds[i] >= 0)
+        {
+            pollFds[numFds].fd = triggerFds[i];
+            pollFds[numFds].events = POLLPRI;
+            numFds++;
+        }
+    }
+    if (numFds == 0)
+        return false;
+    if (stopFd >= 0)
+    {
+        pollFds[numFds].fd = stopFd;
+        pollFds[numFds].events = POLLIN;
+        numFds++;
+    }
+
+    do
+        numReady = poll(pollFds, numFds, -1);
+    while ((numReady < 0) && (errno == EINTR));
+    if (numReady < 0)
+        return false;
+
+    for (unsigned i = 0; i < numFds; i++)
+    {
+        if ((pollFds[i].fd == stopFd) && (pollFds[i].revents & POLLIN))
+            return false;
+        if (pollFds[i].revents & POLLERR)
+            return false;  // The cgroup has gone
+        if (pollFds[i].revents & POLLPRI)
+            psiTriggerFired(pollFds[i].fd);
+    }
+    return true;
+}
+
+
+// Makes psiWaitForTrigger return false, now and from then on
+void psiStopWaiting(void)
+{
+    if (stopFd >= 0)
+        eventfd_write(stopFd, 1);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>  // for bool
+
+// Unprivileged triggers need the window to be a multiple of 2s
+#define PSI_TRIGGER_STALL_USEC 200000
+#define PSI_TRIGGER_WINDOW_USEC 2000000
+
+typedef enum
+{
+    PSI_CPU,
+    PSI_MEMORY,
+    PSI_IO,
+    PSI_NUM_RESOURCES,
+} psiResource_t;
+
+// The avg10 stall percentages, and whether a trigger has fired since the last reading
+struct psiReading
+{
+    float some[PSI_NUM_RESOURCES];
+    float full[PSI_NUM_RESOURCES];
+    bool triggered[PSI_NUM_RESOURCES];
+};
+
+
+void psiInit(const char* cgroupPath);
+bool psiRead(struct psiReading* reading);
+unsigned psiTriggerFds(int* fds, unsigned maxFds);
+void psiTriggerFired(int fd);
+bool psiWaitForTrigger(void);
+void psiStopWaiting(void);
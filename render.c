@@ -0,0 +1,159 @@
+#include "render.h"
+#include "timer.h"    // for timespecsub, timespeccmp, timespecadd
+#include "vterm.h"    // for vtermInit, vtermWrite
+#include <errno.h>    // for errno, EINTR
+#include <stdarg.h>   // for va_end, va_list, va_start
+#include <stdbool.h>  // for bool, false, true
+#include <stdio.h>    // for vsnprintf
+#include <string.h>   // for memcpy, strlen
+#include <time.h>     // for timespec, clock_gettime, CLOCK_MONOTONIC
+#include <unistd.h>   // for write, STDOUT_FILENO, ssize_t
+
+
+static char frameBuffer[RENDER_BUFFER_SIZE];
+static size_t frameLength;
+static struct timespec lastFrameTime;
+static bool headless;  // Frames go to the vterm.h grid rather than stdout
+static const struct timespec frameInterval = {
+    .tv_sec = 0,
+    .tv_nsec = 1000000000L / RENDER_FRAME_RATE,
+};
+
+
+
+static void writeFrame(void)
+{
+    const char* pFrame = frameBuffer;
+    ssize_t written;
+
+    if (headless)
+    {
+        vtermWrite(frameBuffer, frameLength);
+        frameLength = 0;
+    }
+
+    while (frameLength > 0)
+    {
+        written = write(STDOUT_FILENO, pFrame, frameLength);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;  // Nothing sensible we can do if the terminal has gone away
+        }
+        pFrame += written;
+        frameLength -= written;
+    }
+
+    frameLength = 0;
+    clock_gettime(CLOCK_MONOTONIC, &lastFrameTime);
+}
+
+
+// Sends every frame from now on to an in-process terminal of this size instead
+bool renderHeadless(unsigned rows, unsigned columns)
+{
+    headless = vtermInit(rows, columns);
+    return headless;
+}
+
+
+void renderWrite(const void* data, size_t length)
+{
+    const char* pData = data;
+    size_t chunk;
+
+    while (length > 0)
+    {
+        if (frameLength == sizeof(frameBuffer))
+            writeFrame();
+
+        chunk = sizeof(frameBuffer) - frameLength;
+        if (chunk > length)
+            chunk = length;
+
+        memcpy(frameBuffer + frameLength, pData, chunk);
+        frameLength += chunk;
+        pData += chunk;
+        length -= chunk;
+    }
+}
+
+
+void renderPutc(char character)
+{
+    if (frameLength == sizeof(frameBuffer))
+        writeFrame();
+    frameBuffer[frameLength++] = character;
+}
+
+
+void renderPuts(const char* str)
+{
+    renderWrite(str, strlen(str));
+}
+
+
+void renderPrintf(const char* format, ...)
+{
+    va_list varArgs;
+    size_t space = sizeof(frameBuffer) - frameLength;
+    int length;
+
+    va_start(varArgs, format);
+    length = vsnprintf(frameBuffer + frameLength, space, format, varArgs);
+    va_end(varArgs);
+
+    if (length < 0)
+        return;
+
+    if ((size_t)length >= space)
+    {
+        // Didn't fit, push out what we've got and format it again into the empty buffer
+        writeFrame();
+        va_start(varArgs, format);
+        length = vsnprintf(frameBuffer, sizeof(frameBuffer), format, varArgs);
+        va_end(varArgs);
+
+        if (length < 0)
+            return;
+        if ((size_t)length >= sizeof(frameBuffer))
+            length = sizeof(frameBuffer) - 1;  // Truncated, drop the terminator
+    }
+
+    frameLength += length;
+}
+
+
+// Sends the current frame to the terminal if it's forced, or if a frame period has
+// elapsed since the last one. Returns true if there is still output waiting to go.
+bool renderFlush(bool force)
+{
+    struct timespec now;
+    struct timespec elapsed;
+
+    if (frameLength == 0)
+        return false;
+
+    if (!force)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        timespecsub(&now, &lastFrameTime, &elapsed);
+        if (timespeccmp(&elapsed, &frameInterval, <))
+            return true;
+    }
+
+    writeFrame();
+    return false;
+}
+
+
+// When the pending frame is due to be sent, returns false if nothing is pending
+bool renderFrameDue(struct timespec* due)
+{
+    if (frameLength == 0)
+        return false;
+
+    timespecadd(&lastFrameTime, &frameInterval, due);
+    return true;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
+#include <time.h>     // for timespec
+
+#define RENDER_BUFFER_SIZE (256 * 1024)
+#define RENDER_FRAME_RATE 60
+
+
+bool renderHeadless(unsigned rows, unsigned columns);
+void renderPutc(char character);
+void renderPuts(const char* str);
+void renderWrite(const void* data, size_t length);
+void renderPrintf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+bool renderFlush(bool force);
+bool renderFrameDue(struct timespec* due);
@@ -0,0 +1,114 @@
+#include "replay.h"
+#include "debugtrace.h"  // for debugTraceHeader, debugTraceRecord, DEBUG_TRACE_...
+#include "timer.h"       // for timespecadd
+#include <errno.h>       // for errno, EINTR
+#include <stdbool.h>     // for bool, false, true
+#include <stdint.h>      // for uint64_t
+#include <stdio.h>       // for fread, fopen, fclose, setvbuf, FILE
+#include <stdlib.h>      // for exit, free, realloc, EXIT_FAILURE, EXIT_SUCCESS
+#include <string.h>      // for strncmp
+#include <time.h>        // for clock_nanosleep, clock_gettime, timespec, CLOCK_...
+#include <unistd.h>      // for write, STDOUT_FILENO
+
+static FILE* traceFile;
+
+
+
+// Checks the header, so a bad file is reported before anything is forked
+bool replayOpen(const char* path)
+{
+    struct debugTraceHeader header;
+
+    traceFile = fopen(path, "rb");
+    if (!traceFile)
+        return false;
+    setvbuf(traceFile, NULL, _IOFBF, REPLAY_BUFFER_SIZE);
+
+    if ((fread(&header, sizeof(header), 1, traceFile) != 1) ||
+        (strncmp(header.magic, DEBUG_TRACE_MAGIC, sizeof(header.magic)) != 0) ||
+        (header.version != DEBUG_TRACE_VERSION))
+    {
+        fclose(traceFile);
+        traceFile = NULL;
+        return false;
+    }
+    return true;
+}
+
+
+static void waitUntil(const struct timespec* startTime, uint64_t recordTime, double speed)
+{
+    struct timespec wakeTime, offset;
+    uint64_t scaledTime;
+
+    if (speed <= REPLAY_SPEED_MAX)
+        return;
+
+    scaledTime = (uint64_t)(recordTime / speed);
+    offset.tv_sec = scaledTime / 1000000000;
+    offset.tv_nsec = scaledTime % 1000000000;
+    timespecadd(startTime, &offset, &wakeTime);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeTime, NULL) == EINTR)
+        ;
+}
+
+
+static bool writeAll(const unsigned char* data, size_t length)
+{
+    ssize_t numWritten;
+
+    while (length > 0)
+    {
+        numWritten = write(STDOUT_FILENO, data, length);
+        if ((numWritten < 0) && (errno == EINTR))
+            continue;
+        if (numWritten <= 0)
+            return false;
+        data += numWritten;
+        length -= numWritten;
+    }
+    return true;
+}
+
+
+// Runs in place of the command, writing the recorded output to the same pipe the
+// command would have, so the rest of procprog can't tell the difference. speed scales
+// the recorded times, REPLAY_SPEED_MAX ignores them. What was typed isn't replayed,
+// only its effect on the output is.
+noreturn void replayRun(double speed)
+{
+    struct debugTraceRecord record;
+    struct timespec startTime;
+    unsigned char* data = NULL;
+    unsigned char* newData;
+    size_t dataSize = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+    while (fread(&record, sizeof(record), 1, traceFile) == 1)
+    {
+        if (record.length > dataSize)
+        {
+            newData = (unsigned char*)realloc(data, record.length);
+            if (!newData)
+                break;
+            data = newData;
+            dataSize = record.length;
+        }
+
+        // A trace cut off part way through a record still replays up to there
+        if (fread(data, 1, record.length, traceFile) != record.length)
+            break;
+        if (record.kind != DEBUG_TRACE_OUTPUT)
+            continue;
+
+        waitUntil(&startTime, record.time, speed);
+        if (!writeAll(data, record.length))
+            break;
+    }
+
+    free(data);
+    fclose(traceFile);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdbool.h>      // for bool
+#include <stdnoreturn.h>  // for noreturn
+
+#define REPLAY_BUFFER_SIZE (1024 * 1024)
+#define REPLAY_SPEED_MAX 0  // No waiting between records at all
+
+
+bool replayOpen(const char* path);
+noreturn void replayRun(double speed);
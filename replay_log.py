@@ -1,14 +1,53 @@
 #!/usr/bin/python3
+#
+# Decoder for the traces procprog -d writes, the layout is in debugtrace.h. To see a
+# trace the way it was displayed, use procprog -r TRACE instead.
+# Example: ./replay_log.py make_01.01.2024-12.00.00.trace
+#          ./replay_log.py --dump make_01.01.2024-12.00.00.trace | less
+#
+import struct
 import sys
-from time import sleep
-
-log = open(sys.argv[1], "rb")
-
-for i, line in enumerate(log.readlines()):
-    try:
-        if not line.decode('cp437').startswith('stdin'):
-            byte = line.decode('cp437')[7:8] # WARNING, you may need to change this
-            print(byte, end='', flush=True)
-    except:
-        print(line)
-        raise SystemExit
+
+MAGIC = b"PPTRACE\0"
+VERSION = 1
+HEADER = struct.Struct("=8sIIQ")   # magic, version, reserved, startTime
+RECORD = struct.Struct("=QIB3x")   # time, length, kind
+KINDS = ["output", "stdin", "stdin failed"]
+
+
+def read_trace(path):
+    with open(path, "rb") as trace:
+        data = trace.read()
+
+    magic, version, _, start_time = HEADER.unpack_from(data, 0)
+    if magic != MAGIC or version != VERSION:
+        raise SystemExit(f"{path} isn't a version {VERSION} procprog trace")
+
+    offset = HEADER.size
+    while offset + RECORD.size <= len(data):
+        time, length, kind = RECORD.unpack_from(data, offset)
+        offset += RECORD.size
+        # A trace cut off by a crash can end part way through a record
+        yield time / 1e9, kind, data[offset:offset + length]
+        offset += length
+
+
+def dump(path):
+    for time, kind, chunk in read_trace(path):
+        name = KINDS[kind] if kind < len(KINDS) else str(kind)
+        print(f"{time:.06f}: {name} ({len(chunk)}) {chunk!r}")
+
+
+def replay(path):
+    for _, kind, chunk in read_trace(path):
+        if kind == 0:
+            sys.stdout.buffer.write(chunk)
+    sys.stdout.buffer.flush()
+
+
+if len(sys.argv) == 3 and sys.argv[1] == "--dump":
+    dump(sys.argv[2])
+elif len(sys.argv) == 2:
+    replay(sys.argv[1])
+else:
+    raise SystemExit(f"Usage: {sys.argv[0]} [--dump] TRACE")
@@ -0,0 +1,100 @@
+#include "ring.h"
+#include <semaphore.h>  // for sem_post, sem_wait, sem_init, sem_destroy
+#include <stdbool.h>    // for bool, false, true
+#include <stdlib.h>     // for free, malloc
+#include <stddef.h>     // for size_t, NULL
+
+
+
+// size must be a power of two
+bool ringInit(ring_t* ring, size_t size)
+{
+    ring->buffer = (unsigned char*)malloc(size);
+    if (!ring->buffer)
+        return false;
+
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->writerWaiting = false;
+    return (sem_init(&ring->spaceAvailable, false, 0) == 0);
+}
+
+
+void ringDestroy(ring_t* ring)
+{
+    sem_destroy(&ring->spaceAvailable);
+    free(ring->buffer);
+    ring->buffer = NULL;
+}
+
+
+// Producer side: returns how much can be written contiguously from *data
+size_t ringWriteSpace(ring_t* ring, unsigned char** data)
+{
+    size_t head = ring->head;
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    size_t offset = head & (ring->size - 1);
+    size_t space = ring->size - (head - tail);
+
+    *data = ring->buffer + offset;
+    return (space < (ring->size - offset)) ? space : (ring->size - offset);
+}
+
+
+// Producer side: publishes length bytes written to the space from ringWriteSpace,
+// returns true if the ring was empty beforehand, i.e. the consumer needs waking
+bool ringCommit(ring_t* ring, size_t length)
+{
+    size_t head = ring->head;
+
+    __atomic_store_n(&ring->head, head + length, __ATOMIC_SEQ_CST);
+
+    // If the consumer had caught up with everything before this, it could have seen
+    // an empty ring and gone to sleep
+    return (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head);
+}
+
+
+// Producer side: blocks until the consumer has freed up some space
+void ringWaitForSpace(ring_t* ring)
+{
+    unsigned char* data;
+
+    __atomic_store_n(&ring->writerWaiting, true, __ATOMIC_SEQ_CST);
+
+    if (ringWriteSpace(ring, &data) == 0)
+        sem_wait(&ring->spaceAvailable);
+    else
+        __atomic_store_n(&ring->writerWaiting, false, __ATOMIC_SEQ_CST);
+}
+
+
+// Consumer side: returns how much can be read contiguously from *data
+size_t ringReadSpace(ring_t* ring, const unsigned char** data)
+{
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    size_t tail = ring->tail;
+    size_t offset = tail & (ring->size - 1);
+    size_t used = head - tail;
+
+    *data = ring->buffer + offset;
+    return (used < (ring->size - offset)) ? used : (ring->size - offset);
+}
+
+
+// Consumer side: releases length bytes back to the producer
+void ringConsume(ring_t* ring, size_t length)
+{
+    __atomic_store_n(&ring->tail, ring->tail + length, __ATOMIC_SEQ_CST);
+
+    if (__atomic_exchange_n(&ring->writerWaiting, false, __ATOMIC_SEQ_CST))
+        sem_post(&ring->spaceAvailable);
+}
+
+
+bool ringEmpty(ring_t* ring)
+{
+    return (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) ==
+            __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST));
+}
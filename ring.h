@@ -0,0 +1,27 @@
+#pragma once
+
+#include <semaphore.h>  // for sem_t
+#include <stdbool.h>    // for bool
+#include <stddef.h>     // for size_t
+
+// Single producer, single consumer byte ring. head is only ever written by the
+// producer and tail by the consumer, both only ever increase and are masked on use.
+typedef struct
+{
+    unsigned char* buffer;
+    size_t size;
+    size_t head;
+    size_t tail;
+    bool writerWaiting;
+    sem_t spaceAvailable;
+} ring_t;
+
+
+bool ringInit(ring_t* ring, size_t size);
+void ringDestroy(ring_t* ring);
+size_t ringWriteSpace(ring_t* ring, unsigned char** data);
+bool ringCommit(ring_t* ring, size_t length);
+void ringWaitForSpace(ring_t* ring);
+size_t ringReadSpace(ring_t* ring, const unsigned char** data);
+void ringConsume(ring_t* ring, size_t length);
+bool ringEmpty(ring_t* ring);
@@ -0,0 +1,254 @@
+#include "scan.h"
+#include <stdbool.h>  // for bool, false, true
+#include <stddef.h>   // for size_t
+#ifdef __SSE2__
+#include <immintrin.h>  // for __m128i, _mm_cmpeq_epi8, _mm_movemask_epi8...
+#endif
+
+
+// Plain text is anything the output loops would hand straight to printChar, i.e.
+// isprint() in the C locale. Line breaks are the '\n' to '\r' range that quiet mode
+// treats as the end of a line.
+static inline bool isPlainText(unsigned char character)
+{
+    return (character >= ' ') && (character <= '~');
+}
+
+static inline bool isLineBreak(unsigned char character)
+{
+    return (character >= '\n') && (character <= '\r');
+}
+
+
+
+static size_t scanPlainTextScalar(const unsigned char* buffer, size_t length)
+{
+    size_t i = 0;
+
+    while ((i < length) && isPlainText(buffer[i]))
+        i++;
+    return i;
+}
+
+static size_t scanLineBreakScalar(const unsigned char* buffer, size_t length)
+{
+    size_t i = 0;
+
+    while ((i < length) && !isLineBreak(buffer[i]))
+        i++;
+    return i;
+}
+
+static size_t scanLastLineBreakScalar(const unsigned char* buffer, size_t length)
+{
+    size_t i = length;
+
+    while (i > 0)
+    {
+        if (isLineBreak(buffer[--i]))
+            return i;
+    }
+    return length;
+}
+
+
+
+#ifdef __SSE2__
+// Bytes below ' ' or above '~', the signed compare catches everything >= 0x80 too
+static inline unsigned plainTextMask128(__m128i chars)
+{
+    __m128i control = _mm_cmplt_epi8(chars, _mm_set1_epi8(' '));
+    __m128i delete = _mm_cmpeq_epi8(chars, _mm_set1_epi8('\x7f'));
+    return _mm_movemask_epi8(_mm_or_si128(control, delete));
+}
+
+// Bytes in the '\n' to '\r' range, as an unsigned (x - '\n') <= 3
+static inline unsigned lineBreakMask128(__m128i chars)
+{
+    __m128i offset = _mm_sub_epi8(chars, _mm_set1_epi8('\n'));
+    __m128i clamped = _mm_min_epu8(offset, _mm_set1_epi8(3));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(offset, clamped));
+}
+
+static size_t scanPlainTextSSE2(const unsigned char* buffer, size_t length)
+{
+    size_t i = 0;
+    unsigned mask;
+
+    for (; (i + 16) <= length; i += 16)
+    {
+        mask = plainTextMask128(_mm_loadu_si128((const __m128i*)(buffer + i)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + scanPlainTextScalar(buffer + i, length - i);
+}
+
+static size_t scanLineBreakSSE2(const unsigned char* buffer, size_t length)
+{
+    size_t i = 0;
+    unsigned mask;
+
+    for (; (i + 16) <= length; i += 16)
+    {
+        mask = lineBreakMask128(_mm_loadu_si128((const __m128i*)(buffer + i)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + scanLineBreakScalar(buffer + i, length - i);
+}
+
+static size_t scanLastLineBreakSSE2(const unsigned char* buffer, size_t length)
+{
+    size_t i = length;
+    size_t tail;
+    unsigned mask;
+
+    for (; i >= 16; i -= 16)
+    {
+        mask = lineBreakMask128(_mm_loadu_si128((const __m128i*)(buffer + i - 16)));
+        if (mask)
+            return i - 16 + (31 - __builtin_clz(mask));
+    }
+    tail = scanLastLineBreakScalar(buffer, i);
+    return (tail == i) ? length : tail;
+}
+#endif
+
+
+
+#ifdef __x86_64__
+__attribute__((target("avx2"))) static inline unsigned plainTextMask256(__m256i chars)
+{
+    __m256i control = _mm256_cmpgt_epi8(_mm256_set1_epi8(' '), chars);
+    __m256i delete = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\x7f'));
+    return _mm256_movemask_epi8(_mm256_or_si256(control, delete));
+}
+
+__attribute__((target("avx2"))) static inline unsigned lineBreakMask256(__m256i chars)
+{
+    __m256i offset = _mm256_sub_epi8(chars, _mm256_set1_epi8('\n'));
+    __m256i clamped = _mm256_min_epu8(offset, _mm256_set1_epi8(3));
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(offset, clamped));
+}
+
+__attribute__((target("avx2"))) static size_t scanPlainTextAVX2(const unsigned char* buffer,
+                                                                size_t length)
+{
+    size_t i = 0;
+    unsigned mask;
+
+    for (; (i + 32) <= length; i += 32)
+    {
+        mask = plainTextMask256(_mm256_loadu_si256((const __m256i*)(buffer + i)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + scanPlainTextSSE2(buffer + i, length - i);
+}
+
+__attribute__((target("avx2"))) static size_t scanLineBreakAVX2(const unsigned char* buffer,
+                                                                size_t length)
+{
+    size_t i = 0;
+    unsigned mask;
+
+    for (; (i + 32) <= length; i += 32)
+    {
+        mask = lineBreakMask256(_mm256_loadu_si256((const __m256i*)(buffer + i)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + scanLineBreakSSE2(buffer + i, length - i);
+}
+
+__attribute__((target("avx2"))) static size_t
+scanLastLineBreakAVX2(const unsigned char* buffer, size_t length)
+{
+    size_t i = length;
+    size_t tail;
+    unsigned mask;
+
+    for (; i >= 32; i -= 32)
+    {
+        mask = lineBreakMask256(_mm256_loadu_si256((const __m256i*)(buffer + i - 32)));
+        if (mask)
+            return i - 32 + (31 - __builtin_clz(mask));
+    }
+    tail = scanLastLineBreakSSE2(buffer, i);
+    return (tail == i) ? length : tail;
+}
+#endif
+
+
+
+static size_t (*scanPlainTextImpl)(const unsigned char*, size_t) = scanPlainTextScalar;
+static size_t (*scanLineBreakImpl)(const unsigned char*, size_t) = scanLineBreakScalar;
+static size_t (*scanLastLineBreakImpl)(const unsigned char*,
+                                       size_t) = scanLastLineBreakScalar;
+
+
+// Switches to one implementation, returns false if this build or CPU doesn't have it.
+// For the tests and benchmarks, which need to compare each of them with the others.
+bool scanSelect(scanImpl_t impl)
+{
+    switch (impl)
+    {
+    case SCAN_SCALAR:
+        scanPlainTextImpl = scanPlainTextScalar;
+        scanLineBreakImpl = scanLineBreakScalar;
+        scanLastLineBreakImpl = scanLastLineBreakScalar;
+        return true;
+#ifdef __SSE2__
+    case SCAN_SSE2:
+        scanPlainTextImpl = scanPlainTextSSE2;
+        scanLineBreakImpl = scanLineBreakSSE2;
+        scanLastLineBreakImpl = scanLastLineBreakSSE2;
+        return true;
+#endif
+#ifdef __x86_64__
+    case SCAN_AVX2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2"))
+            return false;
+        scanPlainTextImpl = scanPlainTextAVX2;
+        scanLineBreakImpl = scanLineBreakAVX2;
+        scanLastLineBreakImpl = scanLastLineBreakAVX2;
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+
+// Picks the widest implementation this CPU supports, should be called before any of
+// the output threads are started
+void scanInit(void)
+{
+    for (int impl = SCAN_NUM_IMPLS - 1; impl > SCAN_SCALAR; impl--)
+    {
+        if (scanSelect((scanImpl_t)impl))
+            return;
+    }
+    scanSelect(SCAN_SCALAR);
+}
+
+
+// Returns the length of the run of printable characters at the start of buffer
+size_t scanPlainText(const unsigned char* buffer, size_t length)
+{
+    return scanPlainTextImpl(buffer, length);
+}
+
+// Returns the index of the first line break in buffer, or length if there isn't one
+size_t scanLineBreak(const unsigned char* buffer, size_t length)
+{
+    return scanLineBreakImpl(buffer, length);
+}
+
+// Returns the index of the last line break in buffer, or length if there isn't one
+size_t scanLastLineBreak(const unsigned char* buffer, size_t length)
+{
+    return scanLastLineBreakImpl(buffer, length);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
+
+typedef enum
+{
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2,
+    SCAN_NUM_IMPLS,
+} scanImpl_t;
+
+
+void scanInit(void);
+bool scanSelect(scanImpl_t impl);
+size_t scanPlainText(const unsigned char* buffer, size_t length);
+size_t scanLineBreak(const unsigned char* buffer, size_t length);
+size_t scanLastLineBreak(const unsigned char* buffer, size_t length);
@@ -0,0 +1,295 @@
+#include "statline.h"
+#include "graphics.h"  // for gotoStatLine, ANSI_RESET_ALL
+#include "render.h"    // for renderPuts, renderPrintf, renderPutc
+#include "vterm.h"     // for vtermCell, vtermSelectGraphicRendition, VTERM_ATTR_...
+#include <stdbool.h>   // for bool, false, true
+#include <stdint.h>    // for uint32_t, uint8_t
+#include <string.h>    // for memcpy
+
+#define NOT_ON_LINE (~0U)
+
+static struct vtermCell shadow[STAT_LINE_MAX_COLUMNS];
+static unsigned shadowColumns;
+static bool shadowValid;
+
+// Where the terminal's cursor and pen are while a diff is being sent
+static unsigned cursorColumn;
+static struct vtermCell pen;
+
+static const struct vtermCell blankCell = {
+    .codePoint = ' ',
+    .foreground = VTERM_COLOUR_DEFAULT,
+    .background = VTERM_COLOUR_DEFAULT,
+};
+
+
+
+// Only the pen, not the character
+static bool pensDiffer(const struct vtermCell* a, const struct vtermCell* b)
+{
+    return (a->foreground != b->foreground) || (a->background != b->background) ||
+           (a->attributes != b->attributes);
+}
+
+
+// Even a space can differ by its background, or by being reversed or underlined
+static bool cellsDiffer(const struct vtermCell* a, const struct vtermCell* b)
+{
+    return (a->codePoint != b->codePoint) || pensDiffer(a, b);
+}
+
+
+static bool isBlank(const struct vtermCell* cell)
+{
+    return (cell->codePoint == ' ') && !pensDiffer(cell, &blankCell);
+}
+
+
+static const unsigned char* decodeUtf8(const unsigned char* str, uint32_t* codePoint)
+{
+    unsigned extra = (*str >= 0xF0) ? 3 : (*str >= 0xE0) ? 2 : (*str >= 0xC0) ? 1 : 0;
+
+    *codePoint = *str++ & (0x7F >> extra);
+    for (; extra > 0 && ((*str & 0xC0) == 0x80); extra--)
+        *codePoint = (*codePoint << 6) | (*str++ & 0x3F);
+    return str;
+}
+
+
+// Collects the parameters of the escape sequence starting at sequence the way vterm.c
+// does, semicolons and colons both separating them, and returns its final byte
+static const unsigned char* parseEscape(const unsigned char* sequence, unsigned* params,
+                                        unsigned* numParams)
+{
+    *numParams = 0;
+    for (sequence++; (*sequence != '\0') && ((*sequence < 0x40) || (*sequence == '[') ||
+                                             (*sequence > 0x7E));
+         sequence++)
+    {
+        if ((*sequence >= '0') && (*sequence <= '9'))
+        {
+            if (*numParams == 0)
+                params[(*numParams)++] = 0;
+            if ((*numParams <= VTERM_MAX_PARAMS) && (params[*numParams - 1] < 100000))
+                params[*numParams - 1] = (params[*numParams - 1] * 10) + (*sequence - '0');
+        }
+        else if ((*sequence == ';') || (*sequence == ':'))
+        {
+            if (*numParams == 0)
+                params[(*numParams)++] = 0;
+            if (*numParams < VTERM_MAX_PARAMS)
+                params[*numParams] = 0;
+            (*numParams)++;
+        }
+    }
+    if (*numParams > VTERM_MAX_PARAMS)
+        *numParams = VTERM_MAX_PARAMS;
+    return sequence;
+}
+
+
+// Lays out the formatted stat line the way the terminal would, only SGR sequences
+// matter, every other escape sequence in it is about where it's drawn. Returns the
+// length without trailing blanks.
+static unsigned parseLine(const char* line, struct vtermCell* cells, unsigned columns)
+{
+    const unsigned char* pLine = (const unsigned char*)line;
+    unsigned params[VTERM_MAX_PARAMS];
+    unsigned length = 0, numParams, trimmed = 0;
+    struct vtermCell linePen = blankCell;
+
+    while ((*pLine != '\0') && (length < columns))
+    {
+        if (*pLine == '\e')
+        {
+            pLine = parseEscape(pLine, params, &numParams);
+            if (*pLine == 'm')
+                vtermSelectGraphicRendition(&linePen, params, numParams);
+            if (*pLine != '\0')
+                pLine++;
+        }
+        else if (*pLine < ' ')
+        {
+            pLine++;
+        }
+        else
+        {
+            cells[length] = linePen;
+            pLine = decodeUtf8(pLine, &cells[length].codePoint);
+            if (!isBlank(&cells[length++]))
+                trimmed = length;
+        }
+    }
+
+    for (; length < columns; length++)
+        cells[length] = blankCell;
+    return trimmed;
+}
+
+
+static unsigned trimmedLength(const struct vtermCell* cells, unsigned columns)
+{
+    while ((columns > 0) && isBlank(&cells[columns - 1]))
+        columns--;
+    return columns;
+}
+
+
+static void putColour(unsigned base, int16_t colour)
+{
+    if (colour < 8)
+        renderPrintf(";%u", base + colour);
+    else if (colour < 16)
+        renderPrintf(";%u", base + 60 + colour - 8);
+    else
+        renderPrintf(";%u;5;%d", base + 8, colour);
+}
+
+
+// Sets the terminal's pen to cell's from scratch, rather than working out what to undo
+static void putPen(const struct vtermCell* cell)
+{
+    static const unsigned attributeCodes[] = {1, 2, 4, 5, 7, 8};
+
+    renderPuts("\e[0");
+    for (unsigned i = 0; i < sizeof(attributeCodes) / sizeof(*attributeCodes); i++)
+    {
+        if (cell->attributes & (1U << i))
+            renderPrintf(";%u", attributeCodes[i]);
+    }
+    if (cell->foreground != VTERM_COLOUR_DEFAULT)
+        putColour(30, cell->foreground);
+    if (cell->background != VTERM_COLOUR_DEFAULT)
+        putColour(40, cell->background);
+    renderPutc('m');
+    pen = *cell;
+}
+
+
+static void putCell(const struct vtermCell* cell)
+{
+    uint32_t codePoint = cell->codePoint;
+
+    if (pensDiffer(cell, &pen))
+        putPen(cell);
+
+    if (codePoint < 0x80)
+    {
+        renderPutc(codePoint);
+    }
+    else if (codePoint < 0x800)
+    {
+        renderPutc(0xC0 | (codePoint >> 6));
+        renderPutc(0x80 | (codePoint & 0x3F));
+    }
+    else if (codePoint < 0x10000)
+    {
+        renderPutc(0xE0 | (codePoint >> 12));
+        renderPutc(0x80 | ((codePoint >> 6) & 0x3F));
+        renderPutc(0x80 | (codePoint & 0x3F));
+    }
+    else
+    {
+        renderPutc(0xF0 | (codePoint >> 18));
+        renderPutc(0x80 | ((codePoint >> 12) & 0x3F));
+        renderPutc(0x80 | ((codePoint >> 6) & 0x3F));
+        renderPutc(0x80 | (codePoint & 0x3F));
+    }
+}
+
+
+// Gets the cursor to column on the stat line the cheapest way: a full move the first
+// time, rewriting a short run of unchanged cells, or a column move past a longer one
+static void moveTo(const window_t* window, const struct vtermCell* cells, unsigned column)
+{
+    if (cursorColumn == NOT_ON_LINE)
+    {
+        renderPrintf("\e[s\e[%u;%uH" ANSI_RESET_ALL, window->termSize.ws_row, column + 1);
+        pen = blankCell;
+    }
+    else if ((column - cursorColumn) <= STAT_LINE_MAX_GAP)
+    {
+        for (; cursorColumn < column; cursorColumn++)
+            putCell(&cells[cursorColumn]);
+    }
+    else
+    {
+        renderPrintf("\e[%uG", column + 1);
+    }
+    cursorColumn = column;
+}
+
+
+// The next draw can't assume anything about what's on the stat line
+void statLineInvalidate(void)
+{
+    shadowValid = false;
+}
+
+
+// For anything drawn straight onto the stat line, like the spinner
+void statLineSetCell(unsigned column, unsigned codePoint, int foreground)
+{
+    if (shadowValid && (column < shadowColumns))
+    {
+        shadow[column] = blankCell;
+        shadow[column].codePoint = codePoint;
+        shadow[column].foreground = foreground;
+    }
+}
+
+
+// Draws line, a stat line formatted by printStats, onto the bottom row. Only the
+// cells that differ from the last one are sent, unless the shadow is invalid.
+void statLineDraw(window_t* window, const char* line)
+{
+    struct vtermCell cells[STAT_LINE_MAX_COLUMNS];
+    unsigned columns = window->termSize.ws_col;
+    unsigned length, oldLength;
+
+    if (!shadowValid || (columns != shadowColumns) || (columns > STAT_LINE_MAX_COLUMNS))
+    {
+        renderPuts("\e[s");
+        gotoStatLine(window);
+        renderPuts(line);
+        renderPuts("\e[u");
+
+        if (columns <= STAT_LINE_MAX_COLUMNS)
+        {
+            parseLine(line, shadow, columns);
+            shadowColumns = columns;
+            shadowValid = true;
+        }
+        return;
+    }
+
+    length = parseLine(line, cells, columns);
+    oldLength = trimmedLength(shadow, columns);
+    cursorColumn = NOT_ON_LINE;
+
+    for (unsigned column = 0; column < length; column++)
+    {
+        if (!cellsDiffer(&cells[column], &shadow[column]))
+            continue;
+
+        moveTo(window, cells, column);
+        putCell(&cells[column]);
+        cursorColumn++;
+    }
+
+    if (oldLength > length)
+    {
+        moveTo(window, cells, length);
+        if (pensDiffer(&pen, &blankCell))
+            putPen(&blankCell);  // \e[K erases with the pen's background
+        renderPuts("\e[K");
+    }
+
+    if (cursorColumn != NOT_ON_LINE)
+    {
+        if (pensDiffer(&pen, &blankCell))
+            renderPuts(ANSI_RESET_ALL);
+        renderPuts("\e[u");
+    }
+    memcpy(shadow, cells, columns * sizeof(*cells));
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "main.h"  // for window_t
+
+#define STAT_LINE_MAX_COLUMNS 512  // Wider terminals always get the whole line redrawn
+#define STAT_LINE_MAX_GAP 4        // Unchanged cells rewritten rather than jumped over
+
+// A copy of what's on the stat line, so each tick only sends the cells that changed
+// rather than the whole line. Anything that clears or scrolls the stat line has to
+// call statLineInvalidate, so the next draw starts again from a cleared line.
+
+
+void statLineInvalidate(void);
+void statLineSetCell(unsigned column, unsigned codePoint, int foreground);
+void statLineDraw(window_t* window, const char* line);
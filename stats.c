@@ -1,23 +1,61 @@
 #include "stats.h"
-#include "graphics.h"   // for ANSI_RESET_ALL, gotoStatLine, ANSI_FG_CYAN
+#include "cgroup.h"     // for cgroupRead, cgroupActive, cgroupReading
+#include "graphics.h"   // for ANSI_RESET_ALL, ANSI_FG_CYAN
+#include "history.h"    // for historyRecord, historySummarise, historySummary
 #include "main.h"       // for window_t
+#include "procfile.h"   // for procFileRead, nextLine, PROC_FILE_INIT, procFile_t
+#include "procparse.h"  // for procParseCpu, procParseMemInfo, procParseNetDev, procPa...
+#include "profile.h"    // for profileSample, profileActive, profileReading
+#include "proctree.h"   // for procTreeScan, treeReading
+#include "psi.h"        // for psiRead, psiReading, PSI_CPU, PSI_MEMORY, PSI_IO
+#include "render.h"     // for renderPuts, renderPrintf
+#include "statline.h"   // for statLineDraw, statLineInvalidate, statLineSetCell
+#include "statsfile.h"  // for statsFileWrite
 #include "timer.h"      // for timespecsub, SECS_IN_DAY, SEC_TO_MSEC
 #include "util.h"       // for printable_strlen
 #include <stdarg.h>     // for va_end, va_list, va_start
 #include <stdbool.h>    // for false, bool, true
-#include <stdio.h>      // for fputs, sscanf, fclose, fgets, fopen, stdout
-#include <stdlib.h>     // for strtol
-#include <string.h>     // for memcpy, strncmp, memset, strncat
+#include <stdio.h>      // for sprintf
+#include <string.h>     // for memcpy, strncmp, strlen, strcat
 #include <sys/ioctl.h>  // for winsize
+#include <sys/types.h>  // for pid_t
 #include <time.h>       // for NULL, timespec, clock_gettime, CLOCK_MONOTONIC
+#include <unistd.h>     // for sysconf, _SC_CLK_TCK, _SC_NPROCESSORS_ONLN, _SC_PAGESIZE
 
 
 static char spinner = '-';
+static procFile_t cpuFile = PROC_FILE_INIT("/proc/stat");
+static procFile_t memFile = PROC_FILE_INIT("/proc/meminfo");
+static procFile_t netFile = PROC_FILE_INIT("/proc/net/dev");
+static procFile_t diskFile = PROC_FILE_INIT("/proc/diskstats");
+static struct statSnapshot latestStats = {
+    .cpuUsage = __FLT_MAX__,
+    .memUsage = __FLT_MAX__,
+    .diskUsage = __FLT_MAX__,
+    .download = __FLT_MAX__,
+    .upload = __FLT_MAX__,
+    .treeCpu = __FLT_MAX__,
+    .treeMem = __FLT_MAX__,
+    .treeMemShare = __FLT_MAX__,
+    .treeMemPeak = __FLT_MAX__,
+    .treeRead = __FLT_MAX__,
+    .treeWrite = __FLT_MAX__,
+    .oomKills = __FLT_MAX__,
+    .stallSome = {__FLT_MAX__, __FLT_MAX__, __FLT_MAX__},
+    .stallFull = {__FLT_MAX__, __FLT_MAX__, __FLT_MAX__},
+    .self = {__FLT_MAX__, __FLT_MAX__, __FLT_MAX__, __FLT_MAX__, __FLT_MAX__},
+};
+static unsigned statsSequence;  // Odd while latestStats is being updated
+static pid_t treeRoot;
+static unsigned long long memTotalKb;
+static long numCores = 1;
 
 static void addStatIfRoom(window_t* window, char* statOutput, statColour_t status,
                           const char* format, ...) __attribute__((format(printf, 4, 5)));
+static void addStatWithin(unsigned columns, char* statOutput, statColour_t status,
+                          const char* format, ...) __attribute__((format(printf, 4, 5)));
 
-void advanceSpinner(window_t* window, options_t* options)
+static void stepSpinner(void)
 {
     switch (spinner)
     {
@@ -34,68 +72,117 @@ void advanceSpinner(window_t* window, options_t* options)
         spinner = '/';
         break;
     }
+}
+
+// Moves the spinner on without drawing it, for lines that are never displayed
+void skipSpinner(unsigned steps)
+{
+    for (steps %= 4; steps > 0; steps--)
+        stepSpinner();
+}
+
+void advanceSpinner(window_t* window, options_t* options)
+{
+    stepSpinner();
     if (options->useScrollingRegion)
-        printf("\e[s\e[%u;10H" ANSI_FG_CYAN "%c" ANSI_RESET_ALL "\e[u",
-               window->termSize.ws_row + 1, spinner);
+    {
+        renderPrintf("\e[s\e[%u;10H" ANSI_FG_CYAN "%c" ANSI_RESET_ALL "\e[u",
+                     window->termSize.ws_row + 1, spinner);
+        statLineSetCell(9, spinner, 6);  // ANSI_FG_CYAN
+    }
 }
 
-// On linux this will always be false on the first call
-static bool getCPUUsage(float* usage)
+// Parses the time columns of a "cpu" or "cpuN" line, starting after the name
+static const char* parseCpuLine(const char* statLine, struct cpuStat* reading)
 {
-    FILE* fp;
-    char* retVal;
-    char statLine[256];  // Theoretically could be up to ~220 characters, usually ~50
-    float interval, idleTime;
     struct procStat statBuffer;
-    struct cpuStat newReading;
-    static struct cpuStat oldReading;
 
-    if (usage == NULL)
+    statLine = procParseCpu(statLine, &statBuffer);
+    if (statLine == NULL)
+        return NULL;
+
+    reading->tBusy = statBuffer.tUser + statBuffer.tNice + statBuffer.tSystem +
+                     statBuffer.tIrq + statBuffer.tSoftIrq + statBuffer.tSteal +
+                     statBuffer.tGuest + statBuffer.tGuestNice;
+    reading->tIdle = statBuffer.tIdle + statBuffer.tIoWait;
+    return statLine;
+}
+
+
+static bool cpuBusyPercent(const struct cpuStat* oldReading,
+                           const struct cpuStat* newReading, float* usage)
+{
+    float interval, idleTime;
+
+    if ((oldReading->tBusy == 0) && (oldReading->tIdle == 0))
         return false;
 
-    fp = fopen("/proc/stat", "r");
-    if (fp == NULL)
+    interval = (newReading->tBusy + newReading->tIdle) -
+               (oldReading->tBusy + oldReading->tIdle);
+    idleTime = newReading->tIdle - oldReading->tIdle;
+
+    if ((interval <= 0) || (idleTime > interval))
         return false;
 
-    retVal = fgets(statLine, sizeof(statLine), fp);
-    fclose(fp);
-    if ((retVal == NULL) || (statLine[0] != 'c'))
+    *usage = ((interval - idleTime) / interval) * 100;
+    return true;
+}
+
+
+// The cpuN lines straight after the aggregate one, a core that's gone offline is just
+// missing so each goes in the slot for its number
+static void getCoreUsage(const char* statLine, struct statSnapshot* sample)
+{
+    static struct cpuStat oldReadings[CPU_BAR_MAX_CORES];
+    struct cpuStat newReading;
+    unsigned long long core;
+    float usage;
+
+    memset(sample->coreUsage, CORE_USAGE_UNKNOWN, sizeof(sample->coreUsage));
+    sample->numCores = 0;
+
+    for (; statLine && (strncmp(statLine, "cpu", 3) == 0); statLine = nextLine(statLine))
     {
-        return false;
+        statLine = parseUnsigned(statLine + 3, &core);
+        if (!statLine || (core >= CPU_BAR_MAX_CORES))
+            break;
+        statLine = parseCpuLine(statLine, &newReading);
+        if (!statLine)
+            break;
+
+        if (cpuBusyPercent(&oldReadings[core], &newReading, &usage))
+            sample->coreUsage[core] = (unsigned char)(usage + 0.5f);
+        oldReadings[core] = newReading;
+        if (core >= sample->numCores)
+            sample->numCores = core + 1;
     }
+}
 
-    if (sscanf(statLine, "cpu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
-               &(statBuffer.tUser), &(statBuffer.tNice), &(statBuffer.tSystem),
-               &(statBuffer.tIdle), &(statBuffer.tIoWait), &(statBuffer.tIrq),
-               &(statBuffer.tSoftIrq), &(statBuffer.tSteal), &(statBuffer.tGuest),
-               &(statBuffer.tGuestNice)) != 10)
-    {
+
+// On linux this will always be false on the first call. The per-core lines are read
+// from the same buffer, so it's still one read of /proc/stat.
+static bool getCPUUsage(float* usage, struct statSnapshot* sample)
+{
+    static struct cpuStat oldReading;
+    struct cpuStat newReading;
+    const char* statLine;
+    bool gotUsage;
+
+    if ((usage == NULL) || (sample == NULL))
         return false;
-    }
 
-    newReading.tBusy = statBuffer.tUser + statBuffer.tNice + statBuffer.tSystem +
-                       statBuffer.tIrq + statBuffer.tSoftIrq + statBuffer.tSteal +
-                       statBuffer.tGuest + statBuffer.tGuestNice;
-    newReading.tIdle = statBuffer.tIdle + statBuffer.tIoWait;
+    if ((procFileRead(&cpuFile) <= 0) || (strncmp(cpuFile.buffer, "cpu ", 4) != 0))
+        return false;
 
-    if ((oldReading.tBusy == 0) && (oldReading.tIdle == 0))
-    {
-        memcpy(&oldReading, &newReading, sizeof(oldReading));
+    statLine = parseCpuLine(cpuFile.buffer + 3, &newReading);
+    if (statLine == NULL)
         return false;
-    }
-    else
-    {
-        interval = (newReading.tBusy + newReading.tIdle) -
-                   (oldReading.tBusy + oldReading.tIdle);
-        idleTime = newReading.tIdle - oldReading.tIdle;
 
-        if ((interval <= 0) || (idleTime >= interval))
-            return false;
+    getCoreUsage(nextLine(statLine), sample);
 
-        *usage = ((interval - idleTime) / interval) * 100;
-        memcpy(&oldReading, &newReading, sizeof(oldReading));
-        return true;
-    }
+    gotUsage = cpuBusyPercent(&oldReading, &newReading, usage);
+    memcpy(&oldReading, &newReading, sizeof(oldReading));
+    return gotUsage;
 }
 
 
@@ -103,49 +190,18 @@ static bool getCPUUsage(float* usage)
 
 static bool getMemUsage(float* usage)
 {
-    char memLine[64];  // should really be around 30 characters
-    FILE* fp;
-    unsigned long memAvailable = 0, memTotal = 0;
-    bool gotTotal = false;
-    bool gotAvailable = false;
+    unsigned long long memAvailable = 0, memTotal = 0;
 
     if (usage == NULL)
         return false;
 
-    fp = fopen("/proc/meminfo", "r");
-    if (fp == NULL)
+    if ((procFileRead(&memFile) <= 0) ||
+        !procParseMemInfo(memFile.buffer, &memTotal, &memAvailable) || (memTotal == 0))
         return false;
 
-    while ((fgets(memLine, sizeof(memLine), fp)) && (!gotTotal || !gotAvailable))
-    {
-        if (strncmp(memLine, "Mem", 3) == 0)
-        {
-            if (!gotTotal)
-            {
-                if (sscanf(memLine, "MemTotal: %lu", &memTotal) == 1)
-                {
-                    gotTotal = true;
-                    continue;  // No point looking for available on this line
-                }
-            }
-            if (!gotAvailable)
-            {
-                if (sscanf(memLine, "MemAvailable: %lu", &memAvailable) == 1)
-                    gotAvailable = true;
-            }
-        }
-    }
-    fclose(fp);
-
-    if (gotTotal && gotAvailable && (memTotal != 0))
-    {
-        *usage = (1 - ((float)memAvailable / memTotal)) * 100;
-        return true;
-    }
-    else
-    {
-        return false;
-    }
+    memTotalKb = memTotal;
+    *usage = (1 - ((float)memAvailable / memTotal)) * 100;
+    return true;
 }
 
 
@@ -157,9 +213,7 @@ static bool getNetdevUsage(float* download, float* upload)
     struct netDevReading newReading = {0};
     unsigned long long bytesDown, bytesUp;
     struct timespec timeDiff;
-    char devLine[256];  // should be no longer than ~120 characters
     float interval;
-    FILE* fp;
 
     if ((download == NULL) || (upload == NULL))
         return false;
@@ -167,24 +221,9 @@ static bool getNetdevUsage(float* download, float* upload)
     memset(&newReading, 0, sizeof(newReading));
     clock_gettime(CLOCK_MONOTONIC, &newReading.time);
 
-    fp = fopen("/proc/net/dev", "r");
-    if (fp == NULL)
+    if (procFileRead(&netFile) <= 0)
         return false;
-
-    while (fgets(devLine, sizeof(devLine), fp))
-    {
-        // Ignores all of the table title rows, and the loopback device
-        if (*(devLine + 4) != 'l' && *(devLine + 5) != 'o' && *(devLine + 6) == ':')
-        {
-            if (sscanf(devLine + 7, "%llu %*u %*u %*u %*u %*u %*u %*u %llu", &bytesDown,
-                       &bytesUp) == 2)
-            {
-                newReading.bytesDown += bytesDown;
-                newReading.bytesUp += bytesUp;
-            }
-        }
-    }
-    fclose(fp);
+    procParseNetDev(netFile.buffer, &newReading.bytesDown, &newReading.bytesUp);
 
     if ((newReading.bytesDown == 0) && (newReading.bytesUp == 0))
     {
@@ -221,11 +260,8 @@ static bool getDiskUsage(float* activity)
     static struct diskReading oldReading;
     struct diskReading newReading = {0};
     struct timespec timeDiff;
-    unsigned long tBusy;
-    int majorNum = __INT_MAX__;
-    char devLine[256];  // should be no longer than ~120 characters
+    unsigned long long tBusy;
     float interval;
-    FILE* fp;
 
     if (activity == NULL)
         return false;
@@ -233,34 +269,65 @@ static bool getDiskUsage(float* activity)
     memset(&newReading, 0, sizeof(newReading));
     clock_gettime(CLOCK_MONOTONIC, &newReading.time);
 
-    fp = fopen("/proc/diskstats", "r");
-    if (fp == NULL)
+    if (procFileRead(&diskFile) <= 0)
+        return false;
+
+    if (procParseDiskStats(diskFile.buffer, &tBusy) == 0)
         return false;
+    newReading.tBusy = tBusy;
 
-    while (fgets(devLine, sizeof(devLine), fp))
+    if (oldReading.time.tv_sec == 0)
     {
-        // Output generated by diskstats_show() in block/genhd.c
-        // Skip major numbers we've already seen to avoid double-counting
-        if ((strtol(devLine, NULL, 10) != majorNum) &&
-            ((strncmp(devLine + 13, "sd", 2) == 0) ||
-             (strncmp(devLine + 13, "hd", 2) == 0) ||
-             (strncmp(devLine + 13, "nvme", 4) == 0)))
-        {
-            // Element 13 is total ms spent active
-            if (sscanf(devLine, " %d %*d %*s %*u %*u %*u %*u %*u %*u %*u %*u %*u %lu",
-                       &majorNum, &tBusy) == 2)
-            {
-                newReading.tBusy += tBusy;
-            }
-        }
+        memcpy(&oldReading, &newReading, sizeof(oldReading));
+        return false;
     }
-    fclose(fp);
-
-    if (majorNum == __INT_MAX__)
+    else
     {
+        timespecsub(&newReading.time, &oldReading.time, &timeDiff);
+        interval = SEC_TO_MSEC(timeDiff.tv_sec + (timeDiff.tv_nsec * 1e-9));
+
+        if ((interval <= 0) || (oldReading.tBusy > newReading.tBusy))
+            return false;
+
+        *activity = (100 * (newReading.tBusy - oldReading.tBusy)) / interval;
+
+        memcpy(&oldReading, &newReading, sizeof(oldReading));
+        return true;
+    }
+}
+
+
+// CPU is in cores rather than a percentage, so that -j8 using all 8 shows as 8.0
+static bool getTreeUsage(float* cpu, float* memory, float* memShare)
+{
+    static struct treeUsageReading oldReading;
+    static long ticksPerSec, pageSize;
+    struct treeUsageReading newReading;
+    struct treeReading tree;
+    struct timespec timeDiff;
+    float interval;
+
+    if ((cpu == NULL) || (memory == NULL) || (memShare == NULL) || (treeRoot <= 0))
         return false;
+
+    if (ticksPerSec == 0)
+    {
+        ticksPerSec = sysconf(_SC_CLK_TCK);
+        pageSize = sysconf(_SC_PAGESIZE);
+        if ((ticksPerSec <= 0) || (pageSize <= 0))
+            return false;
     }
-    else if (oldReading.time.tv_sec == 0)
+
+    clock_gettime(CLOCK_MONOTONIC, &newReading.time);
+    if (!procTreeScan(treeRoot, &tree))
+        return false;
+    newReading.tCpu = tree.tCpu;
+
+    *memory = (tree.rssPages * pageSize) / 1e6f;
+    if (memTotalKb != 0)
+        *memShare = (100 * ((tree.rssPages * pageSize) / 1024.0f)) / memTotalKb;
+
+    if (oldReading.time.tv_sec == 0)
     {
         memcpy(&oldReading, &newReading, sizeof(oldReading));
         return false;
@@ -268,12 +335,72 @@ static bool getDiskUsage(float* activity)
     else
     {
         timespecsub(&newReading.time, &oldReading.time, &timeDiff);
-        interval = SEC_TO_MSEC(timeDiff.tv_sec + (timeDiff.tv_nsec * 1e-9));
+        interval = timeDiff.tv_sec + (timeDiff.tv_nsec * 1e-9);
+        if (interval <= 0)
+            return false;
 
-        if ((interval <= 0) || (oldReading.tBusy > newReading.tBusy))
+        // Something was reparented out of the tree and took its time with it
+        if (newReading.tCpu < oldReading.tCpu)
+            *cpu = 0;
+        else
+            *cpu = ((newReading.tCpu - oldReading.tCpu) / (float)ticksPerSec) / interval;
+
+        memcpy(&oldReading, &newReading, sizeof(oldReading));
+        return true;
+    }
+}
+
+
+// Everything that's run in the child's cgroup, so unlike the tree walk nothing is
+// missed between samples, and it's the same few reads however big the build gets
+static bool getCgroupUsage(struct statSnapshot* sample)
+{
+    static struct cgroupUsageReading oldReading;
+    struct cgroupUsageReading newReading;
+    struct cgroupReading cgroup;
+    struct timespec timeDiff;
+    float interval;
+
+    clock_gettime(CLOCK_MONOTONIC, &newReading.time);
+    if (!cgroupRead(&cgroup))
+        return false;
+    newReading.usageUsec = cgroup.usageUsec;
+    newReading.ioRead = cgroup.ioRead;
+    newReading.ioWrite = cgroup.ioWrite;
+
+    if (cgroup.hasMemory)
+    {
+        sample->treeMem = cgroup.memCurrent / 1e6f;
+        if (memTotalKb != 0)
+            sample->treeMemShare = (100 * (cgroup.memCurrent / 1024.0f)) / memTotalKb;
+    }
+    if (cgroup.hasPeak)
+        sample->treeMemPeak = cgroup.memPeak / 1e6f;
+    if (cgroup.hasEvents)
+        sample->oomKills = cgroup.oomKills;
+
+    if (oldReading.time.tv_sec == 0)
+    {
+        memcpy(&oldReading, &newReading, sizeof(oldReading));
+        return false;
+    }
+    else
+    {
+        timespecsub(&newReading.time, &oldReading.time, &timeDiff);
+        interval = timeDiff.tv_sec + (timeDiff.tv_nsec * 1e-9);
+        if ((interval <= 0) || (newReading.usageUsec < oldReading.usageUsec))
             return false;
 
-        *activity = (100 * (newReading.tBusy - oldReading.tBusy)) / interval;
+        sample->treeCpu =
+            ((newReading.usageUsec - oldReading.usageUsec) / 1e6f) / interval;
+        if (cgroup.hasIo && (newReading.ioRead >= oldReading.ioRead) &&
+            (newReading.ioWrite >= oldReading.ioWrite))
+        {
+            sample->treeRead =
+                ((newReading.ioRead - oldReading.ioRead) / 1e6f) / interval;
+            sample->treeWrite =
+                ((newReading.ioWrite - oldReading.ioWrite) / 1e6f) / interval;
+        }
 
         memcpy(&oldReading, &newReading, sizeof(oldReading));
         return true;
@@ -281,13 +408,136 @@ static bool getDiskUsage(float* activity)
 }
 
 
-static void addStatIfRoom(window_t* window, char* statOutput, statColour_t status,
-                          const char* format, ...)
+static bool getStallUsage(struct statSnapshot* sample)
+{
+    struct psiReading psi;
+
+    if (!psiRead(&psi))
+        return false;
+
+    sample->stallTriggered = false;
+    for (unsigned i = 0; i < PSI_NUM_RESOURCES; i++)
+    {
+        sample->stallSome[i] = psi.some[i];
+        sample->stallFull[i] = psi.full[i];
+        sample->stallTriggered |= psi.triggered[i];
+    }
+    return true;
+}
+
+
+// Only accounts for root and its descendants from now on, on top of the system stats
+void watchProcessTree(pid_t root)
+{
+    treeRoot = root;
+    numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (numCores < 1)
+        numCores = 1;
+}
+
+
+// Once a second, the PSI triggers can cause extra samples in between
+static void recordHistory(struct statSnapshot* sample)
+{
+    static struct timespec lastRecord;
+    struct timespec currentTime, timeDiff;
+    const float scales[HISTORY_NUM_METRICS] = {
+        [HISTORY_CPU] = 100, [HISTORY_MEM] = 100, [HISTORY_DISK] = 100,
+        // Network rates are relative to the highest in the window
+    };
+    float values[HISTORY_NUM_METRICS];
+
+    clock_gettime(CLOCK_MONOTONIC, &currentTime);
+    timespecsub(&currentTime, &lastRecord, &timeDiff);
+    if ((lastRecord.tv_sec != 0) &&
+        (SEC_TO_MSEC(timeDiff.tv_sec) + NSEC_TO_MSEC(timeDiff.tv_nsec) <
+         HISTORY_INTERVAL_MSEC))
+        return;
+    lastRecord = currentTime;
+
+    values[HISTORY_CPU] = sample->cpuUsage;
+    values[HISTORY_MEM] = sample->memUsage;
+    values[HISTORY_DISK] = sample->diskUsage;
+    values[HISTORY_DOWNLOAD] = sample->download;
+    values[HISTORY_UPLOAD] = sample->upload;
+    values[HISTORY_TREE_CPU] = sample->treeCpu;
+    values[HISTORY_TREE_MEM] = sample->treeMem;
+    historyRecord(values);
+
+    for (unsigned i = 0; i < HISTORY_NUM_METRICS; i++)
+    {
+        if (!historySummarise(i, HISTORY_WINDOW, scales[i], &sample->history[i]))
+            sample->history[i].numSamples = 0;
+    }
+}
+
+
+// Reads everything from /proc, this is the only place that does. Must only be called
+// from one thread at a time, but printStats can run alongside it.
+void sampleStats(void)
+{
+    static struct statSnapshot sample = {
+        .cpuUsage = __FLT_MAX__,
+        .memUsage = __FLT_MAX__,
+        .diskUsage = __FLT_MAX__,
+        .download = __FLT_MAX__,
+        .upload = __FLT_MAX__,
+        .treeCpu = __FLT_MAX__,
+        .treeMem = __FLT_MAX__,
+        .treeMemShare = __FLT_MAX__,
+        .treeMemPeak = __FLT_MAX__,
+        .treeRead = __FLT_MAX__,
+        .treeWrite = __FLT_MAX__,
+        .oomKills = __FLT_MAX__,
+        .stallSome = {__FLT_MAX__, __FLT_MAX__, __FLT_MAX__},
+        .stallFull = {__FLT_MAX__, __FLT_MAX__, __FLT_MAX__},
+        .self = {__FLT_MAX__, __FLT_MAX__, __FLT_MAX__, __FLT_MAX__, __FLT_MAX__},
+    };
+
+    // Each of these leaves the previous value alone if there's no new reading
+    getCPUUsage(&sample.cpuUsage, &sample);
+    getMemUsage(&sample.memUsage);
+    getNetdevUsage(&sample.download, &sample.upload);
+    getDiskUsage(&sample.diskUsage);
+    if (cgroupActive())
+        getCgroupUsage(&sample);
+    else
+        getTreeUsage(&sample.treeCpu, &sample.treeMem, &sample.treeMemShare);
+    getStallUsage(&sample);
+    if (profileActive())
+        profileSample(&sample.self);
+    recordHistory(&sample);
+
+    __atomic_store_n(&statsSequence, statsSequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&latestStats, &sample, sizeof(latestStats));
+    __atomic_store_n(&statsSequence, statsSequence + 1, __ATOMIC_RELEASE);
+
+    statsFileWrite(&sample);
+}
+
+
+// Copies latestStats, trying again if sampleStats updated it while we were copying
+static void readSnapshot(struct statSnapshot* stats)
+{
+    unsigned sequence;
+
+    do
+    {
+        sequence = __atomic_load_n(&statsSequence, __ATOMIC_ACQUIRE);
+        memcpy(stats, &latestStats, sizeof(*stats));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((sequence & 1) ||
+             (sequence != __atomic_load_n(&statsSequence, __ATOMIC_RELAXED)));
+}
+
+
+static void vaddStat(unsigned columns, char* statOutput, statColour_t status,
+                     const char* format, va_list varArgs)
 {
     unsigned prevLength = printable_strlen(statOutput);
-    char format_buffer[64] = {0};  // The longest this should be is ~45 chars
-    char output_buffer[64] = {0};  // The longest this should be is ~40 chars
-    va_list varArgs;
+    char format_buffer[96] = {0};  // The longest this should be is ~65 chars
+    char output_buffer[96] = {0};  // The longest this should be is ~65 chars
 
     if (status == STAT_COLOUR_RED)
         sprintf(format_buffer, " [" ANSI_FG_RED "%s" ANSI_RESET_ALL "]", format);
@@ -296,12 +546,33 @@ static void addStatIfRoom(window_t* window, char* statOutput, statColour_t statu
     else
         sprintf(format_buffer, " [" ANSI_FG_DGRAY "%s" ANSI_RESET_ALL "]", format);
 
-    va_start(varArgs, format);
     vsprintf(output_buffer, format_buffer, varArgs);
+
+    // A stat is either added whole or not at all, by width on screen and by bytes
+    if (((prevLength + printable_strlen(output_buffer)) < columns) &&
+        ((strlen(statOutput) + strlen(output_buffer)) < STAT_OUTPUT_LENGTH))
+        strcat(statOutput, output_buffer);
+}
+
+static void addStatIfRoom(window_t* window, char* statOutput, statColour_t status,
+                          const char* format, ...)
+{
+    va_list varArgs;
+
+    va_start(varArgs, format);
+    vaddStat(window->termSize.ws_col, statOutput, status, format, varArgs);
     va_end(varArgs);
+}
+
+// For stats that go before something else that's already had its room set aside
+static void addStatWithin(unsigned columns, char* statOutput, statColour_t status,
+                          const char* format, ...)
+{
+    va_list varArgs;
 
-    if ((prevLength + printable_strlen(output_buffer)) < window->termSize.ws_col)
-        strncat(statOutput, output_buffer, STAT_OUTPUT_LENGTH - prevLength);
+    va_start(varArgs, format);
+    vaddStat(columns, statOutput, status, format, varArgs);
+    va_end(varArgs);
 }
 
 static statColour_t getStatColour(float value, float amber_thr, float red_thr)
@@ -314,19 +585,149 @@ static statColour_t getStatColour(float value, float amber_thr, float red_thr)
         return STAT_COLOUR_GREY;
 }
 
-void printStats(bool newLine, bool redraw, window_t* window, options_t* options)
+// The worst of any resource. A trigger firing means the stall has only just started,
+// so avg10 won't have caught up with it yet.
+static statColour_t getStallColour(const struct statSnapshot* stats)
+{
+    statColour_t worst = (stats->stallTriggered) ? STAT_COLOUR_AMBER : STAT_COLOUR_GREY;
+    statColour_t status;
+
+    for (unsigned i = 0; i < PSI_NUM_RESOURCES; i++)
+    {
+        status = getStatColour(stats->stallSome[i], STALL_SOME_AMBER, STALL_SOME_RED);
+        if (status > worst)
+            worst = status;
+        status = getStatColour(stats->stallFull[i], STALL_FULL_AMBER, STALL_FULL_RED);
+        if (status > worst)
+            worst = status;
+    }
+    return worst;
+}
+
+static void appendUtf8(char** output, unsigned codePoint)
+{
+    *(*output)++ = (char)(0xE0 | (codePoint >> 12));
+    *(*output)++ = (char)(0x80 | ((codePoint >> 6) & 0x3F));
+    *(*output)++ = (char)(0x80 | (codePoint & 0x3F));
+}
+
+
+// Empty cells are left blank, so a sparkline with only a few samples fills in from the
+// right as the history builds up
+static void formatSparkline(const unsigned char* spark, char* output)
+{
+    for (unsigned i = 0; i < HISTORY_SPARK_CELLS; i++)
+    {
+        if (spark[i] == HISTORY_SPARK_EMPTY)
+            *output++ = ' ';
+        else
+            appendUtf8(&output, 0x2581 + spark[i]);
+    }
+    *output = '\0';
+}
+
+
+// The history for the metric as p50/p95/max over the window, if there's room left for
+// it within columns. Coloured by p95 (times colourScale, to match the thresholds), so
+// one spike doesn't make the whole window look bad.
+static void addHistoryIfRoom(unsigned columns, char* statOutput,
+                             const struct historySummary* history, const char* name,
+                             const char* unit, int precision, float colourScale,
+                             float amber_thr, float red_thr)
+{
+    char sparkline[(HISTORY_SPARK_CELLS * 3) + 1];
+
+    if (history->numSamples == 0)
+        return;
+
+    formatSparkline(history->spark, sparkline);
+    addStatWithin(columns, statOutput,
+                  getStatColour(history->p95 * colourScale, amber_thr, red_thr),
+                  "%s %um: %s %.*f/%.*f/%.*f%s", name, HISTORY_WINDOW / 60, sparkline,
+                  precision, history->p50, precision, history->p95, precision,
+                  history->max, unit);
+}
+
+
+// One block per core, or if there isn't room for that, one braille cell per pair of
+// cores with a 4 dot column each. Each cell is coloured like the CPU stat.
+static void buildCoreBar(const window_t* window, const char* statOutput,
+                         const struct statSnapshot* stats, char* barOutput)
+{
+    static const unsigned char leftDots[] = {0x40, 0x04, 0x02, 0x01};
+    static const unsigned char rightDots[] = {0x80, 0x20, 0x10, 0x08};
+    static const char* const colours[] = {ANSI_FG_DGRAY, ANSI_FG_YELLOW, ANSI_FG_RED};
+    unsigned used = printable_strlen(statOutput);
+    unsigned room, coresPerCell, usage, dots, level;
+    statColour_t colour, lastColour = STAT_COLOUR_GREY;
+    char* output = barOutput;
+
+    barOutput[0] = '\0';
+    if ((stats->numCores < 2) || ((used + 4) > window->termSize.ws_col))
+        return;
+    room = window->termSize.ws_col - used - 3;  // " []"
+
+    if (stats->numCores <= room)
+        coresPerCell = 1;
+    else if (((stats->numCores + 1) / 2) <= room)
+        coresPerCell = 2;
+    else
+        return;
+
+    output += sprintf(output, " [" ANSI_FG_DGRAY);
+    for (unsigned core = 0; core < stats->numCores; core += coresPerCell)
+    {
+        colour = STAT_COLOUR_GREY;
+        dots = 0x2800;
+        for (unsigned i = 0; (i < coresPerCell) && ((core + i) < stats->numCores); i++)
+        {
+            usage = stats->coreUsage[core + i];
+            if (usage == CORE_USAGE_UNKNOWN)
+                usage = 0;
+            if (getStatColour(usage, CPU_AMBER, CPU_RED) > colour)
+                colour = getStatColour(usage, CPU_AMBER, CPU_RED);
+
+            if (coresPerCell == 1)
+            {
+                level = (usage * 8 + 50) / 100;
+                dots = (level) ? (0x2580 + level) : 0;
+            }
+            else
+            {
+                level = (usage * 4 + 50) / 100;
+                for (unsigned dot = 0; dot < level; dot++)
+                    dots |= (i == 0) ? leftDots[dot] : rightDots[dot];
+            }
+        }
+
+        if (colour != lastColour)
+        {
+            output += sprintf(output, "%s", colours[colour]);
+            lastColour = colour;
+        }
+        if (dots)
+            appendUtf8(&output, dots);
+        else
+            *output++ = ' ';
+    }
+    sprintf(output, ANSI_RESET_ALL "]");
+}
+
+
+// Only formats the latest snapshot, the reading is all done by sampleStats
+void printStats(bool newLine, window_t* window, options_t* options)
 {
     struct timespec timeDiff;
     struct timespec currentTime;
-    char statOutput[STAT_OUTPUT_LENGTH] = {0};  // Max should be ~100 chars
-    static float cpuUsage = __FLT_MAX__;
-    static float memUsage = __FLT_MAX__;
-    static float diskUsage = __FLT_MAX__;
-    static float download = __FLT_MAX__;
-    static float upload = __FLT_MAX__;
+    struct statSnapshot stats;
+    char statOutput[STAT_OUTPUT_LENGTH] = {0};  // Max should be ~800 chars
+    char barOutput[CORE_BAR_OUTPUT_LENGTH];
+    char lineOutput[STAT_OUTPUT_LENGTH + CORE_BAR_OUTPUT_LENGTH];
     unsigned numLines = window->numCharacters / (window->termSize.ws_col + 1);
-    statColour_t status;
+    unsigned historyColumns;
+    statColour_t status, memStatus;
 
+    readSnapshot(&stats);
     clock_gettime(CLOCK_MONOTONIC, &currentTime);
     // cppcheck-suppress unreadVariable
     timespecsub(&currentTime, &window->procStartTime, &timeDiff);
@@ -336,44 +737,124 @@ void printStats(bool newLine, bool redraw, window_t* window, options_t* options)
             (timeDiff.tv_sec % SECS_IN_DAY) / 3600, (timeDiff.tv_sec % 3600) / 60,
             (timeDiff.tv_sec % 60), spinner);
 
-    if (((cpuUsage != __FLT_MAX__) && redraw) || getCPUUsage(&cpuUsage))
+    if (stats.cpuUsage != __FLT_MAX__)
+    {
+        status = getStatColour(stats.cpuUsage, CPU_AMBER, CPU_RED);
+        addStatIfRoom(window, statOutput, status, "CPU: %4.1f%%", stats.cpuUsage);
+    }
+
+    if (stats.memUsage != __FLT_MAX__)
     {
-        status = getStatColour(cpuUsage, CPU_AMBER, CPU_RED);
-        addStatIfRoom(window, statOutput, status, "CPU: %4.1f%%", cpuUsage);
+        status = getStatColour(stats.memUsage, MEMORY_AMBER, MEMORY_RED);
+        addStatIfRoom(window, statOutput, status, "Mem: %4.1f%%", stats.memUsage);
     }
 
-    if (((memUsage != __FLT_MAX__) && redraw) || getMemUsage(&memUsage))
+    if ((stats.download != __FLT_MAX__) && (stats.upload != __FLT_MAX__))
     {
-        status = getStatColour(memUsage, MEMORY_AMBER, MEMORY_RED);
-        addStatIfRoom(window, statOutput, status, "Mem: %4.1f%%", memUsage);
+        status = getStatColour((stats.download > stats.upload) ? stats.download
+                                                               : stats.upload,
+                               NET_AMBER, NET_RED);
+        addStatIfRoom(window, statOutput, status, "Rx/Tx: %4.1fKB/s / %.1fKB/s",
+                      stats.download, stats.upload);
     }
 
-    if (((download != __FLT_MAX__) && (upload != __FLT_MAX__) && redraw) ||
-        getNetdevUsage(&download, &upload))
+    if (stats.diskUsage != __FLT_MAX__)
     {
-        status = getStatColour((download > upload) ? download : upload, NET_AMBER,
-                               NET_RED);
-        addStatIfRoom(window, statOutput, status, "Rx/Tx: %4.1fKB/s / %.1fKB/s", download,
-                      upload);
+        status = getStatColour(stats.diskUsage, DISK_AMBER, DISK_RED);
+        addStatIfRoom(window, statOutput, status, "Disk: %4.1f%%", stats.diskUsage);
     }
 
-    if (((diskUsage != __FLT_MAX__) && redraw) || getDiskUsage(&diskUsage))
+    if (stats.treeCpu != __FLT_MAX__)
     {
-        status = getStatColour(diskUsage, DISK_AMBER, DISK_RED);
-        addStatIfRoom(window, statOutput, status, "Disk: %4.1f%%", diskUsage);
+        status = getStatColour((100 * stats.treeCpu) / numCores, CPU_AMBER, CPU_RED);
+        memStatus = (stats.treeMemShare != __FLT_MAX__)
+                        ? getStatColour(stats.treeMemShare, MEMORY_AMBER, MEMORY_RED)
+                        : STAT_COLOUR_GREY;
+        if (memStatus > status)
+            status = memStatus;
+
+        // A cgroup without the memory controller only has the CPU time
+        if (stats.treeMem == __FLT_MAX__)
+            addStatIfRoom(window, statOutput, status, "Tree: %.1f cores", stats.treeCpu);
+        else if (stats.treeMemPeak == __FLT_MAX__)
+            addStatIfRoom(window, statOutput, status, "Tree: %.1f cores / %.0fMB",
+                          stats.treeCpu, stats.treeMem);
+        else
+            addStatIfRoom(window, statOutput, status,
+                          "Tree: %.1f cores / %.0fMB (%.0f peak)", stats.treeCpu,
+                          stats.treeMem, stats.treeMemPeak);
+    }
+
+    if ((stats.oomKills != __FLT_MAX__) && (stats.oomKills > 0))
+        addStatIfRoom(window, statOutput, STAT_COLOUR_RED, "OOM kills: %.0f",
+                      stats.oomKills);
+
+    if ((stats.treeRead != __FLT_MAX__) && (stats.treeWrite != __FLT_MAX__))
+    {
+        status = getStatColour((stats.treeRead > stats.treeWrite) ? stats.treeRead
+                                                                  : stats.treeWrite,
+                               IO_AMBER, IO_RED);
+        addStatIfRoom(window, statOutput, status, "R/W: %.1fMB/s / %.1fMB/s",
+                      stats.treeRead, stats.treeWrite);
+    }
+
+    if (stats.stallSome[PSI_CPU] != __FLT_MAX__)
+    {
+        status = getStallColour(&stats);
+        addStatIfRoom(window, statOutput, status,
+                      "Stall: cpu %.1f%% mem %.1f/%.1f%% io %.1f/%.1f%%",
+                      stats.stallSome[PSI_CPU], stats.stallSome[PSI_MEMORY],
+                      stats.stallFull[PSI_MEMORY], stats.stallSome[PSI_IO],
+                      stats.stallFull[PSI_IO]);
+    }
+
+    if (stats.self.cpu != __FLT_MAX__)
+    {
+        status = getStatColour(stats.self.cpu, SELF_AMBER, SELF_RED);
+        if (stats.self.latencyP50 == __FLT_MAX__)
+            addStatIfRoom(window, statOutput, status, "Self: %.1f%% %.1fMB/s %.0fKB",
+                          stats.self.cpu, stats.self.ingest, stats.self.backlog);
+        else
+            addStatIfRoom(window, statOutput, status,
+                          "Self: %.1f%% %.1fMB/s %.0fKB %.2f/%.2fms", stats.self.cpu,
+                          stats.self.ingest, stats.self.backlog, stats.self.latencyP50,
+                          stats.self.latencyP99);
+    }
+
+    // The core bar has its room set aside before the history, which only gets what's
+    // left once all of the current values have had their chance to fit
+    buildCoreBar(window, statOutput, &stats, barOutput);
+    historyColumns = window->termSize.ws_col - printable_strlen(barOutput);
+    addHistoryIfRoom(historyColumns, statOutput, &stats.history[HISTORY_CPU], "CPU", "%",
+                     0, 1, CPU_AMBER, CPU_RED);
+    addHistoryIfRoom(historyColumns, statOutput, &stats.history[HISTORY_MEM], "Mem", "%",
+                     0, 1, MEMORY_AMBER, MEMORY_RED);
+    if (options->allHistory)
+    {
+        addHistoryIfRoom(historyColumns, statOutput, &stats.history[HISTORY_DISK], "Disk",
+                         "%", 0, 1, DISK_AMBER, DISK_RED);
+        addHistoryIfRoom(historyColumns, statOutput, &stats.history[HISTORY_DOWNLOAD],
+                         "Rx", "KB/s", 1, 1, NET_AMBER, NET_RED);
+        addHistoryIfRoom(historyColumns, statOutput, &stats.history[HISTORY_UPLOAD], "Tx",
+                         "KB/s", 1, 1, NET_AMBER, NET_RED);
+        addHistoryIfRoom(historyColumns, statOutput, &stats.history[HISTORY_TREE_CPU],
+                         "Tree", " cores", 1, 100.f / numCores, CPU_AMBER, CPU_RED);
+        addHistoryIfRoom(historyColumns, statOutput, &stats.history[HISTORY_TREE_MEM],
+                         "Tree mem", "MB", 0, 1, __FLT_MAX__, __FLT_MAX__);
     }
 
     if ((!options->useScrollingRegion) && (newLine))
     {
         if (numLines >= (window->termSize.ws_row - 2U))
-            fputs("\n\e[1S\e[A", stdout);
+            renderPuts("\n\e[1S\e[A");
         else
-            fputs("\n\n\e[A", stdout);
+            renderPuts("\n\n\e[A");
     }
 
-    fputs("\e[s", stdout);
-    gotoStatLine(window);
-    fputs(statOutput, stdout);
-    fputs("\e[u", stdout);
-    fflush(stdout);
+    // Without a scrolling region the output scrolls the stat line along with it
+    if (!options->useScrollingRegion)
+        statLineInvalidate();
+
+    sprintf(lineOutput, "%s%s", statOutput, barOutput);
+    statLineDraw(window, lineOutput);
 }
@@ -1,10 +1,19 @@
 #pragma once
 
+#include "history.h"      // for historySummary, HISTORY_NUM_METRICS
 #include "main.h"
-#include <stdbool.h>  // for bool
-#include <time.h>     // for timespec
+#include "profile.h"      // for profileReading
+#include "psi.h"          // for PSI_NUM_RESOURCES
+#include <stdbool.h>    // for bool
+#include <sys/types.h>  // for pid_t
+#include <time.h>       // for timespec
 
-#define STAT_OUTPUT_LENGTH 128
+#define STAT_OUTPUT_LENGTH 1024
+#define CPU_BAR_MAX_CORES 512
+#define HISTORY_INTERVAL_MSEC 900  // Extra samples from PSI triggers aren't recorded
+#define CORE_USAGE_UNKNOWN 0xFF
+// Worst case is a colour change and a 3 byte character for every core
+#define CORE_BAR_OUTPUT_LENGTH (CPU_BAR_MAX_CORES * 8 + 32)
 
 #define CPU_AMBER 20.f
 #define CPU_RED 80.f
@@ -18,6 +27,17 @@
 #define NET_AMBER 1000.f
 #define NET_RED 10000.f
 
+#define STALL_SOME_AMBER 10.f
+#define STALL_SOME_RED 40.f
+#define STALL_FULL_AMBER 5.f
+#define STALL_FULL_RED 20.f
+
+#define IO_AMBER 50.f
+#define IO_RED 200.f
+
+#define SELF_AMBER 10.f  // Percent of a core
+#define SELF_RED 50.f
+
 typedef enum
 {
     STAT_COLOUR_GREY,
@@ -25,20 +45,6 @@ typedef enum
     STAT_COLOUR_RED,
 } statColour_t;
 
-struct procStat
-{
-    unsigned long long tUser;
-    unsigned long long tNice;
-    unsigned long long tSystem;
-    unsigned long long tIdle;
-    unsigned long long tIoWait;
-    unsigned long long tIrq;
-    unsigned long long tSoftIrq;
-    unsigned long long tSteal;
-    unsigned long long tGuest;
-    unsigned long long tGuestNice;
-};
-
 struct netDevReading
 {
     struct timespec time;
@@ -46,6 +52,20 @@ struct netDevReading
     unsigned long long bytesUp;
 };
 
+struct treeUsageReading
+{
+    struct timespec time;
+    unsigned long long tCpu;
+};
+
+struct cgroupUsageReading
+{
+    struct timespec time;
+    unsigned long long usageUsec;
+    unsigned long long ioRead;
+    unsigned long long ioWrite;
+};
+
 struct diskReading
 {
     struct timespec time;
@@ -59,5 +79,32 @@ struct cpuStat
     unsigned long long tIdle;
 };
 
-void printStats(bool newLine, bool redraw, window_t* window, options_t* options);
-void advanceSpinner(window_t* window, options_t* options);
\ No newline at end of file
+// The most recent value of each stat, or __FLT_MAX__ if it hasn't been read yet
+struct statSnapshot
+{
+    float cpuUsage;
+    float memUsage;
+    float diskUsage;
+    float download;
+    float upload;
+    float treeCpu;       // In cores
+    float treeMem;       // In MB
+    float treeMemShare;  // As a percentage of MemTotal
+    float treeMemPeak;   // In MB, only from a cgroup
+    float treeRead;      // In MB/s, only from a cgroup
+    float treeWrite;     // In MB/s, only from a cgroup
+    float oomKills;      // Only from a cgroup
+    float stallSome[PSI_NUM_RESOURCES];  // PSI avg10 percentages
+    float stallFull[PSI_NUM_RESOURCES];
+    bool stallTriggered;  // A PSI trigger has fired since the last sample
+    unsigned char coreUsage[CPU_BAR_MAX_CORES];  // Percent, or CORE_USAGE_UNKNOWN
+    unsigned numCores;
+    struct profileReading self;  // Only with --profile
+    struct historySummary history[HISTORY_NUM_METRICS];  // numSamples is 0 until ready
+};
+
+void watchProcessTree(pid_t root);
+void sampleStats(void);
+void printStats(bool newLine, window_t* window, options_t* options);
+void advanceSpinner(window_t* window, options_t* options);
+void skipSpinner(unsigned steps);
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include "statsfile.h"
+#include "psi.h"        // for PSI_CPU, PSI_MEMORY, PSI_IO
+#include "timer.h"      // for timespecsub
+#include <math.h>       // for NAN, isnan
+#include <pthread.h>    // for pthread_mutex_lock, pthread_mutex_unlock, PTHREAD_MUT...
+#include <stdbool.h>    // for bool, false, true
+#include <stdint.h>     // for uint32_t
+#include <stdio.h>      // for fopen, fprintf, fwrite, fclose, setvbuf, FILE
+#include <stdlib.h>     // for free, malloc
+#include <string.h>     // for strlen
+#include <time.h>       // for clock_gettime, timespec, CLOCK_MONOTONIC
+
+
+// The column for each field, in the order they're written
+static const char* const fieldNames[] = {
+    "time",          "cpu",        "mem",        "disk",       "download",
+    "upload",        "tree_cpu",   "tree_mem",   "tree_peak",  "tree_read",
+    "tree_write",    "oom_kills",  "stall_cpu",  "stall_mem",  "stall_mem_full",
+    "stall_io",      "stall_io_full",
+};
+#define NUM_FIELDS (sizeof(fieldNames) / sizeof(fieldNames[0]))
+
+// A signal can close the file while the sampler is writing, so both are behind statsLock
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static FILE* statsFile;
+static char* fileBuffer;
+static statsFormat_t fileFormat;
+static const struct timespec* procStartTime;
+
+
+
+static void writeHeader(void)
+{
+    uint32_t header[2] = {STATS_FILE_VERSION, NUM_FIELDS};
+
+    switch (fileFormat)
+    {
+    case STATS_FORMAT_CSV:
+        for (unsigned i = 0; i < NUM_FIELDS; i++)
+            fprintf(statsFile, "%s%c", fieldNames[i], (i == NUM_FIELDS - 1) ? '\n' : ',');
+        break;
+    case STATS_FORMAT_BINARY:
+        fwrite(STATS_FILE_MAGIC, 1, sizeof(STATS_FILE_MAGIC), statsFile);
+        fwrite(header, sizeof(header[0]), 2, statsFile);
+        for (unsigned i = 0; i < NUM_FIELDS; i++)
+            fwrite(fieldNames[i], 1, strlen(fieldNames[i]) + 1, statsFile);
+        break;
+    case STATS_FORMAT_JSON:
+        break;  // Each line names its own fields
+    }
+}
+
+
+// stdio does the batching, the buffer is big enough that the sampler only actually
+// writes every few minutes
+bool statsFileOpen(const char* path, statsFormat_t format,
+                   const struct timespec* startTime)
+{
+    statsFile = fopen(path, (format == STATS_FORMAT_BINARY) ? "wb" : "w");
+    if (!statsFile)
+        return false;
+
+    fileBuffer = (char*)malloc(STATS_FILE_BUFFER_SIZE);
+    if (fileBuffer)
+        setvbuf(statsFile, fileBuffer, _IOFBF, STATS_FILE_BUFFER_SIZE);
+
+    fileFormat = format;
+    procStartTime = startTime;
+    writeHeader();
+    return true;
+}
+
+
+static float fieldValue(float value)
+{
+    return (value == __FLT_MAX__) ? NAN : value;
+}
+
+
+// Called by the sampler after every sample, never by the render thread
+void statsFileWrite(const struct statSnapshot* stats)
+{
+    struct timespec currentTime, timeDiff;
+    double time;
+    float fields[NUM_FIELDS - 1];  // Everything but the time
+
+    pthread_mutex_lock(&statsLock);
+    if (!statsFile)
+    {
+        pthread_mutex_unlock(&statsLock);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &currentTime);
+    timespecsub(&currentTime, procStartTime, &timeDiff);
+
+    time = timeDiff.tv_sec + (timeDiff.tv_nsec * 1e-9);
+    fields[0] = fieldValue(stats->cpuUsage);
+    fields[1] = fieldValue(stats->memUsage);
+    fields[2] = fieldValue(stats->diskUsage);
+    fields[3] = fieldValue(stats->download);
+    fields[4] = fieldValue(stats->upload);
+    fields[5] = fieldValue(stats->treeCpu);
+    fields[6] = fieldValue(stats->treeMem);
+    fields[7] = fieldValue(stats->treeMemPeak);
+    fields[8] = fieldValue(stats->treeRead);
+    fields[9] = fieldValue(stats->treeWrite);
+    fields[10] = fieldValue(stats->oomKills);
+    fields[11] = fieldValue(stats->stallSome[PSI_CPU]);
+    fields[12] = fieldValue(stats->stallSome[PSI_MEMORY]);
+    fields[13] = fieldValue(stats->stallFull[PSI_MEMORY]);
+    fields[14] = fieldValue(stats->stallSome[PSI_IO]);
+    fields[15] = fieldValue(stats->stallFull[PSI_IO]);
+
+    switch (fileFormat)
+    {
+    case STATS_FORMAT_CSV:
+        fprintf(statsFile, "%.3f", time);
+        for (unsigned i = 0; i < NUM_FIELDS - 1; i++)
+        {
+            if (!isnan(fields[i]))
+                fprintf(statsFile, ",%.2f", fields[i]);
+            else
+                fputc(',', statsFile);
+        }
+        fputc('\n', statsFile);
+        break;
+    case STATS_FORMAT_JSON:
+        fprintf(statsFile, "{\"%s\":%.3f", fieldNames[0], time);
+        for (unsigned i = 0; i < NUM_FIELDS - 1; i++)
+        {
+            if (!isnan(fields[i]))
+                fprintf(statsFile, ",\"%s\":%.2f", fieldNames[i + 1], fields[i]);
+            else
+                fprintf(statsFile, ",\"%s\":null", fieldNames[i + 1]);
+        }
+        fputs("}\n", statsFile);
+        break;
+    case STATS_FORMAT_BINARY:
+        fwrite(&time, sizeof(time), 1, statsFile);
+        fwrite(fields, sizeof(fields[0]), NUM_FIELDS - 1, statsFile);
+        break;
+    }
+    pthread_mutex_unlock(&statsLock);
+}
+
+
+void statsFileClose(void)
+{
+    pthread_mutex_lock(&statsLock);
+    if (statsFile)
+    {
+        fclose(statsFile);
+        free(fileBuffer);
+        statsFile = NULL;
+        fileBuffer = NULL;
+    }
+    pthread_mutex_unlock(&statsLock);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "main.h"     // for statsFormat_t
+#include "stats.h"    // for statSnapshot
+#include <stdbool.h>  // for bool
+#include <time.h>     // for timespec
+
+#define STATS_FILE_BUFFER_SIZE (64 * 1024)  // Each write covers a few minutes of samples
+#define STATS_FILE_MAGIC "PPSTATS"
+#define STATS_FILE_VERSION 2
+
+// The binary format starts with a header:
+//   char magic[8]         STATS_FILE_MAGIC, null terminated
+//   uint32_t version      STATS_FILE_VERSION
+//   uint32_t numFields    Including the time
+//   the field names, each null terminated, in the order they appear in a record
+// then has one record per sample, in the host's byte order: the time in seconds as a
+// double, so it stays exact to the microsecond over days, then numFields - 1 floats.
+// Missing values are NaN, the same as null in the JSON and an empty field in the CSV.
+
+
+bool statsFileOpen(const char* path, statsFormat_t format,
+                   const struct timespec* startTime);
+void statsFileWrite(const struct statSnapshot* stats);
+void statsFileClose(void);
@@ -0,0 +1,158 @@
+#include "summary.h"
+#include "graphics.h"      // for ANSI_FG_CYAN, ANSI_FG_DGRAY, ANSI_RESET_ALL
+#include "history.h"       // for historyRunTotals, HISTORY_CPU, HISTORY_MEM
+#include "profile.h"       // for profileGetTotals, profileActive, profileTotals
+#include "render.h"        // for renderPrintf, renderPuts
+#include <stdbool.h>       // for bool, false, true
+#include <stdio.h>         // for fprintf, fopen, fclose, fputc, FILE
+#include <sys/resource.h>  // for rusage
+#include <sys/time.h>      // for timeval
+#include <sys/wait.h>      // for WIFEXITED, WEXITSTATUS, WIFSIGNALED, WTERMSIG
+
+
+// The sampled stats that make sense averaged over the whole run
+static const struct
+{
+    historyMetric_t metric;
+    const char* name;    // For the terminal
+    const char* key;     // For the JSON
+    const char* unit;    // For the terminal
+    int precision;
+} sampledStats[] = {
+    {HISTORY_CPU, "CPU", "cpu_percent", "%", 0},
+    {HISTORY_MEM, "Mem", "mem_percent", "%", 0},
+    {HISTORY_DISK, "Disk", "disk_percent", "%", 0},
+    {HISTORY_DOWNLOAD, "Rx", "download_kbps", "KB/s", 0},
+    {HISTORY_UPLOAD, "Tx", "upload_kbps", "KB/s", 0},
+    {HISTORY_TREE_CPU, "Tree", "tree_cores", " cores", 1},
+    {HISTORY_TREE_MEM, "Tree mem", "tree_mem_mb", "MB", 0},
+};
+#define NUM_SAMPLED_STATS (sizeof(sampledStats) / sizeof(sampledStats[0]))
+
+
+
+static double timevalSecs(const struct timeval* time)
+{
+    return time->tv_sec + (time->tv_usec * 1e-6);
+}
+
+
+static void printProfile(double wallTime)
+{
+    struct profileTotals totals;
+
+    profileGetTotals(&totals);
+    renderPrintf(ANSI_FG_DGRAY "(procprog)" ANSI_RESET_ALL " " ANSI_FG_CYAN
+                 "CPU:" ANSI_RESET_ALL " %.2fs (%.1f%%)  " ANSI_FG_CYAN
+                 "Read:" ANSI_RESET_ALL " %.1fMB (%.1fMB/s)  " ANSI_FG_CYAN
+                 "Peak backlog:" ANSI_RESET_ALL " %.0fKB",
+                 totals.cpuTime, (wallTime > 0) ? (100 * totals.cpuTime / wallTime) : 0,
+                 totals.bytesRead / (1024 * 1024),
+                 (wallTime > 0) ? (totals.bytesRead / (1024 * 1024 * wallTime)) : 0,
+                 totals.peakBacklog);
+    if (totals.latencyP50 != __FLT_MAX__)
+        renderPrintf("  " ANSI_FG_CYAN "Latency:" ANSI_RESET_ALL " %.2f/%.2fms",
+                     totals.latencyP50, totals.latencyP99);
+    renderPuts("\n");
+}
+
+
+// Only covers the child and the descendants that were waited for, which for a build is
+// everything. maxrss is the single largest process, not the total.
+void summaryPrint(const struct rusage* usage, double wallTime)
+{
+    double cpuTime = timevalSecs(&usage->ru_utime) + timevalSecs(&usage->ru_stime);
+    float mean, peak;
+    bool first = true;
+
+    renderPrintf(ANSI_FG_CYAN "CPU:" ANSI_RESET_ALL " %.2fs user, %.2fs sys (%.2fx)",
+                 timevalSecs(&usage->ru_utime), timevalSecs(&usage->ru_stime),
+                 (wallTime > 0) ? (cpuTime / wallTime) : 0);
+    renderPrintf("  " ANSI_FG_CYAN "Peak RSS:" ANSI_RESET_ALL " %.1fMB",
+                 usage->ru_maxrss / 1024.0);
+    renderPrintf("  " ANSI_FG_CYAN "Faults:" ANSI_RESET_ALL " %ld major, %ld minor",
+                 usage->ru_majflt, usage->ru_minflt);
+    renderPrintf("  " ANSI_FG_CYAN "Switches:" ANSI_RESET_ALL " %ld vol, %ld invol",
+                 usage->ru_nvcsw, usage->ru_nivcsw);
+    renderPrintf("  " ANSI_FG_CYAN "Block I/O:" ANSI_RESET_ALL " %ld in, %ld out\n",
+                 usage->ru_inblock, usage->ru_oublock);
+
+    for (unsigned i = 0; i < NUM_SAMPLED_STATS; i++)
+    {
+        if (!historyRunTotals(sampledStats[i].metric, &mean, &peak))
+            continue;
+
+        renderPrintf("%s" ANSI_FG_CYAN "%s:" ANSI_RESET_ALL " %.*f/%.*f%s",
+                     (first) ? ANSI_FG_DGRAY "(mean/peak)" ANSI_RESET_ALL " " : "  ",
+                     sampledStats[i].name, sampledStats[i].precision, mean,
+                     sampledStats[i].precision, peak, sampledStats[i].unit);
+        first = false;
+    }
+    if (!first)
+        renderPuts("\n");
+
+    if (profileActive())
+        printProfile(wallTime);
+}
+
+
+// Everything from summaryPrint, for CI to pick up. Times are in seconds.
+bool summaryWriteJson(const char* path, const char* name, int exitStatus,
+                      const struct rusage* usage, double wallTime)
+{
+    double cpuTime = timevalSecs(&usage->ru_utime) + timevalSecs(&usage->ru_stime);
+    struct profileTotals totals;
+    FILE* jsonFile;
+    float mean, peak;
+
+    jsonFile = fopen(path, "w");
+    if (!jsonFile)
+        return false;
+
+    fputs("{\"command\":\"", jsonFile);
+    for (; *name; name++)
+    {
+        if ((*name == '"') || (*name == '\\'))
+            fputc('\\', jsonFile);
+        if ((unsigned char)*name >= ' ')
+            fputc(*name, jsonFile);
+    }
+    fputc('"', jsonFile);
+
+    if (WIFEXITED(exitStatus))
+        fprintf(jsonFile, ",\"exit_status\":%d", WEXITSTATUS(exitStatus));
+    else if (WIFSIGNALED(exitStatus))
+        fprintf(jsonFile, ",\"signal\":%d", WTERMSIG(exitStatus));
+
+    fprintf(jsonFile,
+            ",\"wall_time\":%.3f,\"user_time\":%.3f,\"sys_time\":%.3f,"
+            "\"parallelism\":%.3f,\"max_rss_kb\":%ld,\"major_faults\":%ld,"
+            "\"minor_faults\":%ld,\"voluntary_switches\":%ld,"
+            "\"involuntary_switches\":%ld,\"block_in\":%ld,\"block_out\":%ld",
+            wallTime, timevalSecs(&usage->ru_utime), timevalSecs(&usage->ru_stime),
+            (wallTime > 0) ? (cpuTime / wallTime) : 0, usage->ru_maxrss, usage->ru_majflt,
+            usage->ru_minflt, usage->ru_nvcsw, usage->ru_nivcsw, usage->ru_inblock,
+            usage->ru_oublock);
+
+    for (unsigned i = 0; i < NUM_SAMPLED_STATS; i++)
+    {
+        if (historyRunTotals(sampledStats[i].metric, &mean, &peak))
+            fprintf(jsonFile, ",\"%s\":{\"mean\":%.3f,\"peak\":%.3f}",
+                    sampledStats[i].key, mean, peak);
+    }
+    if (profileActive())
+    {
+        profileGetTotals(&totals);
+        fprintf(jsonFile,
+                ",\"procprog\":{\"cpu_time\":%.3f,\"bytes_read\":%.0f,"
+                "\"peak_backlog_kb\":%.1f",
+                totals.cpuTime, totals.bytesRead, totals.peakBacklog);
+        if (totals.latencyP50 != __FLT_MAX__)
+            fprintf(jsonFile, ",\"latency_p50_ms\":%.3f,\"latency_p99_ms\":%.3f",
+                    totals.latencyP50, totals.latencyP99);
+        fputc('}', jsonFile);
+    }
+    fputs("}\n", jsonFile);
+
+    return (fclose(jsonFile) == 0);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdbool.h>       // for bool
+#include <sys/resource.h>  // for rusage
+
+
+void summaryPrint(const struct rusage* usage, double wallTime);
+bool summaryWriteJson(const char* path, const char* name, int exitStatus,
+                      const struct rusage* usage, double wallTime);
@@ -0,0 +1,154 @@
+#include "tail.h"
+#include "graphics.h"  // for ANSI_FG_DGRAY, ANSI_RESET_ALL
+#include "render.h"    // for renderPutc, renderPrintf, renderPuts
+#include <stdbool.h>   // for bool, false, true
+#include <stddef.h>    // for size_t
+#include <stdint.h>    // for uint64_t
+#include <string.h>    // for memchr, memcpy
+
+static unsigned char arena[TAIL_ARENA_SIZE];
+static uint64_t written;  // Everything ever written, masked to find it in the arena
+
+// Where each of the last lines starts, the newest at lineStarts[newestStart]
+static uint64_t lineStarts[TAIL_MAX_LINES + 1];
+static unsigned newestStart;
+static unsigned numStarts;
+static unsigned linesKept;
+
+
+
+static unsigned char arenaAt(uint64_t position)
+{
+    return arena[position & (TAIL_ARENA_SIZE - 1)];
+}
+
+
+// One more start than lines kept, so a trailing empty line doesn't push one out
+void tailInit(unsigned maxLines)
+{
+    linesKept = (maxLines > TAIL_MAX_LINES) ? TAIL_MAX_LINES : maxLines;
+    written = 0;
+    newestStart = 0;
+    lineStarts[0] = 0;
+    numStarts = 1;
+}
+
+
+// Called with everything the command writes, in order. The line starts are found
+// first, then the data goes into the arena in at most two copies, one either side of
+// the wrap. Only the last arena's worth of it could ever be printed.
+void tailWrite(const unsigned char* data, size_t length)
+{
+    const unsigned char* end = data + length;
+    const unsigned char* lineBreak;
+    size_t offset, firstCopy;
+
+    if (linesKept == 0)
+        return;
+
+    for (const unsigned char* from = data;
+         (lineBreak = memchr(from, '\n', end - from)) != NULL; from = lineBreak + 1)
+    {
+        newestStart = (newestStart + 1) % (TAIL_MAX_LINES + 1);
+        lineStarts[newestStart] = written + (lineBreak - data) + 1;
+        if (numStarts <= linesKept)
+            numStarts++;
+    }
+
+    if (length > TAIL_ARENA_SIZE)
+    {
+        written += length - TAIL_ARENA_SIZE;
+        data = end - TAIL_ARENA_SIZE;
+        length = TAIL_ARENA_SIZE;
+    }
+    offset = written & (TAIL_ARENA_SIZE - 1);
+    firstCopy = (length < TAIL_ARENA_SIZE - offset) ? length : TAIL_ARENA_SIZE - offset;
+    memcpy(arena + offset, data, firstCopy);
+    memcpy(arena, data + firstCopy, length - firstCopy);
+    written += length;
+}
+
+
+// Steps past an escape sequence starting at position, only SGR is let through, the
+// rest could move the cursor or clear the screen
+static uint64_t putEscape(uint64_t position, uint64_t end)
+{
+    uint64_t start = position++;
+
+    if ((position < end) && (arenaAt(position) == '['))
+    {
+        for (position++; (position < end) && (arenaAt(position) >= 0x20) &&
+                         (arenaAt(position) < 0x40);
+             position++)
+            ;
+        if ((position < end) && (arenaAt(position) == 'm'))
+        {
+            for (; start <= position; start++)
+                renderPutc(arenaAt(start));
+        }
+    }
+    return (position < end) ? position + 1 : end;
+}
+
+
+// A line as it would have ended up on a terminal: only what follows the last carriage
+// return counts, so progress bars come out as their final state
+static void putLine(uint64_t start, uint64_t end)
+{
+    uint64_t position = start;
+    unsigned char character;
+
+    while ((end > start) && ((arenaAt(end - 1) == '\r') || (arenaAt(end - 1) == '\n')))
+        end--;
+    for (uint64_t i = start; i < end; i++)
+    {
+        if (arenaAt(i) == '\r')
+            position = i + 1;
+    }
+
+    while (position < end)
+    {
+        character = arenaAt(position);
+        if (character == '\e')
+        {
+            position = putEscape(position, end);
+            continue;
+        }
+        if ((character >= ' ') || (character == '\t'))
+            renderPutc(character);
+        position++;
+    }
+    renderPuts(ANSI_RESET_ALL "\n");
+}
+
+
+// Prints the kept lines, or as much of them as still fits in the arena
+void tailPrint(const char* name)
+{
+    uint64_t from, lineEnd;
+    bool endsWithBreak = (lineStarts[newestStart] == written);
+    unsigned numLines = numStarts - ((endsWithBreak) ? 1 : 0);
+    unsigned oldest;
+
+    if (numLines > linesKept)
+        numLines = linesKept;
+    if (numLines == 0)
+        return;
+
+    // Counting back from the newest start, past the empty one after a final line break
+    oldest = numLines - ((endsWithBreak) ? 0 : 1);
+    oldest = (newestStart + (TAIL_MAX_LINES + 1) - oldest) % (TAIL_MAX_LINES + 1);
+    from = lineStarts[oldest];
+    if ((written - from) > TAIL_ARENA_SIZE)
+        from = written - TAIL_ARENA_SIZE;
+
+    renderPrintf(ANSI_FG_DGRAY "(%s) last %u lines of output:" ANSI_RESET_ALL "\n",
+                 name, numLines);
+    while (from < written)
+    {
+        for (lineEnd = from; (lineEnd < written) && (arenaAt(lineEnd) != '\n'); lineEnd++)
+            ;
+        putLine(from, lineEnd);
+        from = lineEnd + 1;
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+
+#define TAIL_ARENA_SIZE (64 * 1024)  // Must be a power of two
+#define TAIL_DEFAULT_LINES 30
+#define TAIL_MAX_LINES 1000
+
+// The last few lines of the command's output, kept in quiet mode so there's something
+// to show when it fails without running it again with -v. Lines are kept in one fixed
+// arena with an index of where each starts, nothing is allocated per line.
+
+
+void tailInit(unsigned maxLines);
+void tailWrite(const unsigned char* data, size_t length);
+void tailPrint(const char* name);
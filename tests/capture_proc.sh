@@ -0,0 +1,22 @@
+#!/bin/sh
+#
+# Captures the /proc files stats.c samples into tests/fixtures/NAME, for procfile_test
+# to check the parsers against and time them on. Every directory there is used.
+# Example: tests/capture_proc.sh large-host
+#
+
+set -e
+
+if [ $# -ne 1 ]; then
+    echo "usage: $0 NAME" >&2
+    exit 1
+fi
+
+dir="$(dirname "$0")/fixtures/$1"
+mkdir -p "$dir"
+cat /proc/stat > "$dir/stat"
+cat /proc/meminfo > "$dir/meminfo"
+cat /proc/net/dev > "$dir/net_dev"
+cat /proc/diskstats > "$dir/diskstats"
+echo "captured $(nproc) cores, $(($(wc -l < /proc/net/dev) - 2)) interfaces and" \
+     "$(wc -l < /proc/diskstats) block devices into $dir"
@@ -0,0 +1,135 @@
+#!/usr/bin/python3
+import argparse
+import subprocess
+import sys
+
+#
+# End to end tests for procprog, through its headless terminal (-H)
+# Example: make test
+#          tests/headless_test.py --procprog ./procprog
+#
+# Each case runs a command under procprog -H, then checks the final screen procprog
+# prints and the cursor position on the line after it.
+#
+
+RUN_TIMEOUT = 30
+FILL = "seq 1 20; "  # Output starts at the top, the end of run lines would scroll it away
+
+
+def run(procprog, size, options, command):
+    result = subprocess.run([procprog, *options, "-H", size, "sh", "-c", command],
+                            stdin=subprocess.DEVNULL, stdout=subprocess.PIPE,
+                            timeout=RUN_TIMEOUT, check=False)
+    lines = result.stdout.decode().split("\n")[:-1]
+    rows = int(size.split("x")[1])
+
+    if (len(lines) != rows + 1) or not lines[-1].startswith("cursor "):
+        raise AssertionError(f"expected {rows} rows and the cursor, got {lines!r}")
+    cursor = tuple(int(n) for n in lines[-1][len("cursor "):].split(","))
+    return lines[:-1], cursor
+
+
+def expect(condition, message, screen):
+    if not condition:
+        raise AssertionError(message + "\n" + "\n".join(f"|{row}" for row in screen))
+
+
+def verbose_scrolls(procprog):
+    screen, cursor = run(procprog, "60x14", ["-v"], "seq 1 20")
+    expect(screen[:11] == [str(n) for n in range(10, 21)],
+           "the last of the output should be above the finished message", screen)
+    expect(screen[12].startswith("(sh) finished in "), "no finished message", screen)
+    expect(cursor == (14, 1), f"cursor at {cursor}, expected the start of the last row",
+           screen)
+
+
+def verbose_wraps(procprog):
+    screen, cursor = run(procprog, "30x24", ["-v"],
+                         FILL + "echo abcdefghijklmnopqrstuvwxyz0123456789")
+    row = screen.index("abcdefghijklmnopqrstuvwxyz0123")
+    expect(screen[row + 1] == "456789", "the line should wrap at 30 columns", screen)
+    expect(cursor[0] == 24, f"cursor at {cursor}, expected the last row", screen)
+
+
+def quiet_failure_tail(procprog):
+    screen, cursor = run(procprog, "60x14", [], "printf 'first\\nsecond\\nthird'; exit 2")
+    row = screen.index("(sh) last 3 lines of output:")
+    expect(screen[row + 1:row + 4] == ["first", "second", "third"],
+           "the tail should show the hidden output", screen)
+    expect(screen[row + 4].startswith("(sh) exited with non-zero status 2 in "),
+           "no exit status after the tail", screen)
+    expect(cursor == (14, 1), f"cursor at {cursor}, expected the start of the last row",
+           screen)
+
+
+def quiet_success_has_no_tail(procprog):
+    screen, _ = run(procprog, "60x14", [], "printf 'first\\nsecond\\n'")
+    expect(not any("lines of output" in row for row in screen),
+           "there should be no tail when the command succeeds", screen)
+    expect(any(row.startswith("(sh) finished in ") for row in screen),
+           "no finished message", screen)
+
+
+# The resource usage summary is only there with -u, and the finished message stays last
+def summary_option(procprog):
+    screen, _ = run(procprog, "60x14", ["-v"], "true")
+    expect(not any(row.startswith("CPU: ") for row in screen),
+           "there should be no summary without -u", screen)
+
+    screen, _ = run(procprog, "60x14", ["-v", "-u"], "true")
+    rows = [row for row in screen if row]
+    expect(any(row.startswith("CPU: ") for row in rows), "no summary with -u", screen)
+    expect(rows[-1].startswith("(sh) finished in "),
+           "the finished message should be the last line", screen)
+
+
+def pty_size(procprog):
+    screen, _ = run(procprog, "60x14", ["-v", "-P"],
+                     FILL + "stty size; test -t 1 && echo tty")
+    expect("13 60" in screen, "the pty should be the terminal less the stat line",
+           screen)
+    expect("tty" in screen, "stdout should be a terminal with -P", screen)
+
+
+# Not just a terminal, but the command's controlling terminal, in its own session
+def pty_controlling(procprog):
+    screen, _ = run(procprog, "60x14", ["-v", "-P"],
+                    FILL + "echo via /dev/tty > /dev/tty; "
+                    "test \"$(ps -o sid= -p $$)\" -eq $$ && echo session leader")
+    expect("via /dev/tty" in screen, "/dev/tty should be the pty with -P", screen)
+    expect("session leader" in screen, "the command should have its own session",
+           screen)
+
+
+CASES = [
+    verbose_scrolls,
+    verbose_wraps,
+    quiet_failure_tail,
+    quiet_success_has_no_tail,
+    summary_option,
+    pty_size,
+    pty_controlling,
+]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="End to end tests through -H")
+    parser.add_argument("--procprog", default="./procprog", help="procprog to test")
+    args = parser.parse_args()
+    failures = 0
+
+    for case in CASES:
+        try:
+            case(args.procprog)
+            print(f"{case.__name__:<28} passed")
+        except (AssertionError, ValueError, subprocess.TimeoutExpired) as error:
+            print(f"FAIL {case.__name__}: {error}")
+            failures += 1
+
+    if failures:
+        print(f"headless_test: {failures} failures")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
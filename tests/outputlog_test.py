@@ -0,0 +1,120 @@
+#!/usr/bin/python3
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.dont_write_bytecode = True  # No __pycache__ left in the tree
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+import output_log  # noqa: E402
+
+#
+# Round trip tests for the indexed log (-o FILE -i), written by procprog and read back
+# with output_log.py
+# Example: make test
+#          tests/outputlog_test.py --procprog ./procprog
+#
+# Each case runs a command under procprog -H with -o FILE -i, then checks the footer,
+# the index and the lines output_log.py reads back.
+#
+
+RUN_TIMEOUT = 30
+STRIDE = 64  # OUTPUT_LOG_INDEX_STRIDE
+LONG_LINE = 10000  # Split across OUTPUT_LOG_MAX_LINE records
+
+
+def run(procprog, command, typed=None):
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        path = os.path.join(tmp_dir, "output.log")
+        proc = subprocess.Popen([procprog, "-H", "80x10", "-o", path, "-i", "sh", "-c",
+                                 command], stdin=subprocess.PIPE,
+                                stdout=subprocess.DEVNULL)
+        if typed:
+            time.sleep(0.5)  # Until the command is waiting for it
+            proc.stdin.write(typed)
+        proc.stdin.close()
+        proc.wait(timeout=RUN_TIMEOUT)
+        return output_log.OutputLog(path)
+
+
+def expect(condition, message):
+    if not condition:
+        raise AssertionError(message)
+
+
+def whole_output(procprog):
+    log = run(procprog, f"seq 1 300; head -c {LONG_LINE} /dev/zero | tr '\\0' x; echo; "
+                        "printf unfinished")
+    expected = ([f"{n}\n".encode() for n in range(1, 301)] +
+                [b"x" * LONG_LINE + b"\n", b"unfinished"])
+    lines = list(log.lines())
+
+    expect([text for _, _, _, text in lines] == expected,
+           "the lines read back aren't the command's output")
+    expect([number for number, _, _, _ in lines] == list(range(len(expected))),
+           "the lines should be numbered in order")
+    expect(log.num_lines == len(expected),
+           f"the footer has {log.num_lines} lines, expected {len(expected)}")
+    expect(len(log.index) == (len(expected) + STRIDE - 1) // STRIDE,
+           f"{len(log.index)} index entries for {len(expected)} lines")
+    expect(all(a[0] <= b[0] for a, b in zip(log.index, log.index[1:])),
+           "index times should never go backwards")
+
+
+# Every index entry has to point at the start of line entry * STRIDE
+def index_points_at_lines(procprog):
+    log = run(procprog, "seq 0 299")
+    for entry in range(len(log.index)):
+        first = next(log.from_line(entry * STRIDE))
+        expect(first[3] == f"{entry * STRIDE}\n".encode(),
+               f"index entry {entry} finds {first[3]!r}")
+
+    expect(next(log.from_line(130))[3] == b"130\n", "line 130 wasn't found")
+    expect(next(log.from_time(0))[3] == b"0\n", "time 0 should find the first line")
+
+
+# A stdin line between the records of a long output line, on an index entry, mustn't
+# turn the rest of the output line into a line of its own
+def interleaved_sources(procprog):
+    log = run(procprog, "seq 1 63; head -c 5000 /dev/zero | tr '\\0' x; read typed; "
+                        "echo; echo \"got $typed\"", typed=b"typed\n")
+    lines = {number: (source, text) for number, _, source, text in log.lines()}
+
+    expect(lines.get(63) == (0, b"x" * 5000 + b"\n"), "the long line is line 63")
+    expect(lines.get(64) == (1, b"typed\n"), "what was typed should be line 64")
+    expect(lines.get(65) == (0, b"got typed\n"), "the last line should be 65")
+    expect([(number, text) for number, _, _, text in log.from_line(64)] ==
+           [(64, b"typed\n"), (65, b"got typed\n")],
+           "reading from index entry 1 should skip the end of line 63")
+
+
+CASES = [
+    whole_output,
+    index_points_at_lines,
+    interleaved_sources,
+]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Round trip tests for -o FILE -i")
+    parser.add_argument("--procprog", default="./procprog", help="procprog to test")
+    args = parser.parse_args()
+    failures = 0
+
+    for case in CASES:
+        try:
+            case(args.procprog)
+            print(f"{case.__name__:<28} passed")
+        except (AssertionError, StopIteration, subprocess.TimeoutExpired) as error:
+            print(f"FAIL {case.__name__}: {error}")
+            failures += 1
+
+    if failures:
+        print(f"outputlog_test: {failures} failures")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,339 @@
+#include "procfile.h"   // for procFileRead, procFileClose, nextLine, PROC_FILE_INIT
+#include "procparse.h"  // for procParseCpu, procParseMemInfo, procParseNetDev, procPa...
+#include "timer.h"      // for timespecsub
+#include <dirent.h>     // for opendir, readdir, closedir, dirent, DIR, DT_DIR
+#include <stdbool.h>    // for bool, false, true
+#include <stdio.h>      // for printf, sscanf, snprintf, fopen, fread, fclose
+#include <stdlib.h>     // for atoi, EXIT_FAILURE, EXIT_SUCCESS
+#include <string.h>     // for memcpy, memset, strcmp, strncmp, strchr, strlen
+#include <time.h>       // for clock_gettime, timespec, CLOCK_MONOTONIC
+
+//
+// Checks the procparse.h parsers stats.c samples with against the sscanf formats they
+// replaced, on every /proc snapshot tests/capture_proc.sh has captured into
+// tests/fixtures and on the live /proc, checks procFileRead gets the whole of a file
+// that comes up short on every read, and times both ways of sampling with --bench
+// Example: make test
+//          tests/procfile_test --bench [ITERATIONS]
+//
+
+#define FIXTURE_DIR "tests/fixtures"  // Run from the top of the tree, as make test does
+#define NUM_CPU_FIELDS 10
+#define MAX_CPU_LINES 1025  // The aggregate line, then one per core
+#define BENCH_ITERATIONS 20000
+#define SEQ_FILE "/proc/kallsyms"  // Read a page at a time, and doesn't change
+
+enum
+{
+    STAT,
+    MEMINFO,
+    NET_DEV,
+    DISKSTATS,
+    NUM_FILES,
+};
+
+static const char* const fileNames[NUM_FILES] = {"stat", "meminfo", "net_dev",
+                                                 "diskstats"};
+static const char* const liveNames[NUM_FILES] = {"/proc/stat", "/proc/meminfo",
+                                                 "/proc/net/dev", "/proc/diskstats"};
+
+// Everything stats.c takes from the four files in one sample
+struct procTotals
+{
+    unsigned long long cpu[MAX_CPU_LINES][NUM_CPU_FIELDS];
+    unsigned numCpuLines;
+    unsigned long long memTotal;
+    unsigned long long memAvailable;
+    unsigned long long bytesDown;
+    unsigned long long bytesUp;
+    unsigned long long diskBusy;
+    unsigned numNetDevs;
+    unsigned numDisks;
+};
+
+static unsigned failures;
+
+
+
+// What stats.c gets from each file, through the same calls
+static void parseFast(char* const buffers[NUM_FILES], struct procTotals* totals)
+{
+    struct procStat times;
+    const char* statLine;
+
+    totals->numCpuLines = 0;
+    for (statLine = buffers[STAT];
+         statLine && (strncmp(statLine, "cpu", 3) == 0) &&
+         (totals->numCpuLines < MAX_CPU_LINES);
+         statLine = nextLine(statLine))
+    {
+        statLine = skipFields(statLine, 1);
+        if (!statLine || !procParseCpu(statLine, &times))
+            break;
+        memcpy(totals->cpu[totals->numCpuLines++], &times, sizeof(times));
+    }
+
+    if (!procParseMemInfo(buffers[MEMINFO], &totals->memTotal, &totals->memAvailable))
+        totals->memTotal = totals->memAvailable = 0;
+    totals->numNetDevs =
+        procParseNetDev(buffers[NET_DEV], &totals->bytesDown, &totals->bytesUp);
+    totals->numDisks = procParseDiskStats(buffers[DISKSTATS], &totals->diskBusy);
+}
+
+
+// The sscanf formats stats.c used before procfile.h had its own parsers. The net/dev
+// device name is found by its colon rather than at a fixed column, so that long names
+// are counted the same way by both.
+static void parseScanf(char* const buffers[NUM_FILES], struct procTotals* totals)
+{
+    unsigned long long bytesDown, bytesUp, busy;
+    unsigned long long* cpu;
+    int devMajor, majorNum = __INT_MAX__;
+    char devName[64];
+    const char* colon;
+    char* line;
+
+    memset(totals, 0, sizeof(*totals));
+
+    for (line = buffers[STAT]; line && (strncmp(line, "cpu", 3) == 0) &&
+                               (totals->numCpuLines < MAX_CPU_LINES);
+         line = nextLine(line))
+    {
+        cpu = totals->cpu[totals->numCpuLines];
+        if (sscanf(line, "%*s %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu", &cpu[0],
+                   &cpu[1], &cpu[2], &cpu[3], &cpu[4], &cpu[5], &cpu[6], &cpu[7], &cpu[8],
+                   &cpu[9]) != NUM_CPU_FIELDS)
+            break;
+        totals->numCpuLines++;
+    }
+
+    for (line = buffers[MEMINFO]; line; line = nextLine(line))
+    {
+        if (sscanf(line, "MemTotal: %llu", &totals->memTotal) == 1)
+            continue;
+        sscanf(line, "MemAvailable: %llu", &totals->memAvailable);
+    }
+
+    for (line = buffers[NET_DEV]; line; line = nextLine(line))
+    {
+        colon = strchr(line, ':');
+        if (!colon || (nextLine(line) && (colon > nextLine(line))) ||
+            (sscanf(line, " %63[^:]", devName) != 1) || (strcmp(devName, "lo") == 0))
+            continue;
+
+        if (sscanf(colon + 1, "%llu %*u %*u %*u %*u %*u %*u %*u %llu", &bytesDown,
+                   &bytesUp) == 2)
+        {
+            totals->bytesDown += bytesDown;
+            totals->bytesUp += bytesUp;
+            totals->numNetDevs++;
+        }
+    }
+
+    for (line = buffers[DISKSTATS]; line; line = nextLine(line))
+    {
+        if ((sscanf(line, " %d %*d %63s", &devMajor, devName) != 2) ||
+            (devMajor == majorNum))
+            continue;
+
+        if ((strncmp(devName, "sd", 2) == 0) || (strncmp(devName, "hd", 2) == 0) ||
+            (strncmp(devName, "nvme", 4) == 0))
+        {
+            if (sscanf(line, " %d %*d %*s %*u %*u %*u %*u %*u %*u %*u %*u %*u %llu",
+                       &majorNum, &busy) == 2)
+            {
+                totals->diskBusy += busy;
+                totals->numDisks++;
+            }
+        }
+    }
+}
+
+
+static bool readFiles(procFile_t files[NUM_FILES], char* buffers[NUM_FILES])
+{
+    for (unsigned i = 0; i < NUM_FILES; i++)
+    {
+        if (procFileRead(&files[i]) <= 0)
+            return false;
+        buffers[i] = files[i].buffer;
+    }
+    return true;
+}
+
+
+static void closeFiles(procFile_t files[NUM_FILES])
+{
+    for (unsigned i = 0; i < NUM_FILES; i++)
+        procFileClose(&files[i]);
+}
+
+
+static void checkEqual(const char* snapshot, const char* field, unsigned long long fast,
+                       unsigned long long scanned)
+{
+    if (fast == scanned)
+        return;
+
+    printf("FAIL %s: %s is %llu, sscanf gives %llu\n", snapshot, field, fast, scanned);
+    failures++;
+}
+
+
+static void checkSnapshot(const char* snapshot, procFile_t files[NUM_FILES])
+{
+    static struct procTotals fast, scanned;  // Too big for the stack with every core
+    char* buffers[NUM_FILES];
+    char field[32];
+
+    if (!readFiles(files, buffers))
+    {
+        printf("FAIL %s: couldn't read the snapshot\n", snapshot);
+        failures++;
+        return;
+    }
+
+    parseFast(buffers, &fast);
+    parseScanf(buffers, &scanned);
+
+    checkEqual(snapshot, "cpu lines", fast.numCpuLines, scanned.numCpuLines);
+    for (unsigned line = 0; line < fast.numCpuLines; line++)
+    {
+        for (unsigned i = 0; i < NUM_CPU_FIELDS; i++)
+        {
+            snprintf(field, sizeof(field), "cpu line %u[%u]", line, i);
+            checkEqual(snapshot, field, fast.cpu[line][i], scanned.cpu[line][i]);
+        }
+    }
+    checkEqual(snapshot, "memTotal", fast.memTotal, scanned.memTotal);
+    checkEqual(snapshot, "memAvailable", fast.memAvailable, scanned.memAvailable);
+    checkEqual(snapshot, "bytesDown", fast.bytesDown, scanned.bytesDown);
+    checkEqual(snapshot, "bytesUp", fast.bytesUp, scanned.bytesUp);
+    checkEqual(snapshot, "numNetDevs", fast.numNetDevs, scanned.numNetDevs);
+    checkEqual(snapshot, "diskBusy", fast.diskBusy, scanned.diskBusy);
+    checkEqual(snapshot, "numDisks", fast.numDisks, scanned.numDisks);
+
+    printf("%-24s %u cores, %u net devices, %u disks\n", snapshot, fast.numCpuLines - 1,
+           fast.numNetDevs, fast.numDisks);
+}
+
+
+// A file that comes up short on every read has to be read to the end all the same
+static void checkWholeFile(void)
+{
+    procFile_t file = PROC_FILE_INIT(SEQ_FILE);
+    size_t expected = 0, numRead;
+    ssize_t length;
+    char buffer[4096];
+    FILE* stream;
+
+    stream = fopen(SEQ_FILE, "r");
+    if (!stream)
+        return;  // Not every kernel has it
+    while ((numRead = fread(buffer, 1, sizeof(buffer), stream)) > 0)
+        expected += numRead;
+    fclose(stream);
+
+    length = procFileRead(&file);
+    if ((length < 0) || ((size_t)length != expected) || (strlen(file.buffer) != expected))
+    {
+        printf("FAIL %s: read %zd bytes, stdio reads %zu\n", SEQ_FILE, length, expected);
+        failures++;
+    }
+    procFileClose(&file);
+}
+
+
+// The parsers on their own, then a whole sample (read and parse) of the live /proc
+static double timeSamples(procFile_t files[NUM_FILES], bool reread, bool fast,
+                          unsigned iterations)
+{
+    struct timespec start, finish, elapsed;
+    static struct procTotals totals;
+    char* buffers[NUM_FILES];
+
+    if (!readFiles(files, buffers))
+        return 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned i = 0; i < iterations; i++)
+    {
+        if (reread)
+            readFiles(files, buffers);
+        if (fast)
+            parseFast(buffers, &totals);
+        else
+            parseScanf(buffers, &totals);
+        __asm__ volatile("" : : "r"(&totals) : "memory");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+
+    timespecsub(&finish, &start, &elapsed);
+    return ((elapsed.tv_sec * 1e9) + elapsed.tv_nsec) / iterations / 1000;
+}
+
+
+static void benchSnapshot(const char* snapshot, procFile_t files[NUM_FILES], bool reread,
+                          unsigned iterations)
+{
+    double scanfTime = timeSamples(files, reread, false, iterations);
+    double fastTime = timeSamples(files, reread, true, iterations);
+
+    printf("%-24s sscanf %8.2fus  procfile %8.2fus  %5.2fx\n", snapshot, scanfTime,
+           fastTime, scanfTime / fastTime);
+}
+
+
+int main(int argc, char** argv)
+{
+    char paths[NUM_FILES][512];
+    procFile_t files[NUM_FILES];
+    bool bench = (argc > 1) && (strcmp(argv[1], "--bench") == 0);
+    unsigned iterations = (bench && (argc > 2)) ? (unsigned)atoi(argv[2]) : 0;
+    struct dirent* entry;
+    DIR* fixtures;
+    char name[300];
+
+    if (bench && (iterations == 0))
+        iterations = BENCH_ITERATIONS;
+
+    // Every snapshot tests/capture_proc.sh has taken
+    fixtures = opendir(FIXTURE_DIR);
+    while (fixtures && ((entry = readdir(fixtures)) != NULL))
+    {
+        if ((entry->d_type != DT_DIR) || (entry->d_name[0] == '.'))
+            continue;
+
+        for (unsigned i = 0; i < NUM_FILES; i++)
+        {
+            snprintf(paths[i], sizeof(paths[i]), "%s/%s/%s", FIXTURE_DIR, entry->d_name,
+                     fileNames[i]);
+            files[i] = (procFile_t)PROC_FILE_INIT(paths[i]);
+        }
+
+        snprintf(name, sizeof(name), "fixtures/%s", entry->d_name);
+        if (bench)
+            benchSnapshot(name, files, false, iterations);
+        else
+            checkSnapshot(name, files);
+        closeFiles(files);
+    }
+    if (fixtures)
+        closedir(fixtures);
+
+    for (unsigned i = 0; i < NUM_FILES; i++)
+        files[i] = (procFile_t)PROC_FILE_INIT(liveNames[i]);
+    if (bench)
+    {
+        benchSnapshot("/proc (read and parse)", files, true, iterations / 10);
+    }
+    else
+    {
+        checkSnapshot("/proc", files);
+        checkWholeFile();
+    }
+    closeFiles(files);
+
+    if (failures)
+        printf("procfile_test: %u failures\n", failures);
+    return (failures) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,291 @@
+#include "scan.h"      // for scanSelect, scanPlainText, scanLineBreak, SCAN_SCALAR
+#include "timer.h"     // for timespecsub
+#include <stdbool.h>   // for bool, false, true
+#include <stdio.h>     // for printf, fopen, fread, fclose
+#include <stdlib.h>    // for malloc, free, rand, srand, EXIT_FAILURE, EXIT_SUCCESS
+#include <string.h>    // for memset, memcpy, strcmp
+#include <sys/mman.h>  // for mmap, mprotect, munmap, PROT_NONE
+#include <time.h>      // for clock_gettime, timespec, CLOCK_MONOTONIC
+#include <unistd.h>    // for sysconf, _SC_PAGESIZE
+
+//
+// Checks every scan.c implementation this CPU has against a plain per-byte loop, at
+// every alignment and every length up to a few vectors, with an unreadable page on
+// either side of the buffer so reading past either end crashes. --bench times each of
+// them walking real compiler output the way the output loops do.
+// Example: make test
+//          tests/scan_test --bench
+//
+
+#define FIXTURE "tests/fixtures/compiler.log"  // Run from the top of the tree
+#define MAX_ALIGNMENT 64
+#define VALUE_LENGTH 64  // Two AVX2 vectors
+#define MAX_LENGTH 160  // Five AVX2 vectors, so every tail length comes up
+#define RANDOM_ROUNDS 20000
+#define BENCH_REPEATS 200
+
+static const char* const implNames[SCAN_NUM_IMPLS] = {"scalar", "sse2", "avx2"};
+static unsigned failures;
+
+
+
+// What the output loops did one byte at a time before scan.c
+static size_t referencePlainText(const unsigned char* buffer, size_t length)
+{
+    size_t i = 0;
+
+    while ((i < length) && (buffer[i] >= ' ') && (buffer[i] <= '~'))
+        i++;
+    return i;
+}
+
+static size_t referenceLineBreak(const unsigned char* buffer, size_t length)
+{
+    size_t i = 0;
+
+    while ((i < length) && ((buffer[i] < '\n') || (buffer[i] > '\r')))
+        i++;
+    return i;
+}
+
+static size_t referenceLastLineBreak(const unsigned char* buffer, size_t length)
+{
+    for (size_t i = length; i > 0; i--)
+    {
+        if ((buffer[i - 1] >= '\n') && (buffer[i - 1] <= '\r'))
+            return i - 1;
+    }
+    return length;
+}
+
+
+static void check(const char* impl, const char* function, const unsigned char* buffer,
+                  size_t length, size_t result, size_t expected)
+{
+    if (result == expected)
+        return;
+
+    printf("FAIL %s %s: length %zu at offset %zu returned %zu, expected %zu\n", impl,
+           function, length, (size_t)buffer % MAX_ALIGNMENT, result, expected);
+    failures++;
+}
+
+
+static void checkBuffer(const char* impl, const unsigned char* buffer, size_t length)
+{
+    check(impl, "scanPlainText", buffer, length, scanPlainText(buffer, length),
+          referencePlainText(buffer, length));
+    check(impl, "scanLineBreak", buffer, length, scanLineBreak(buffer, length),
+          referenceLineBreak(buffer, length));
+    check(impl, "scanLastLineBreak", buffer, length, scanLastLineBreak(buffer, length),
+          referenceLastLineBreak(buffer, length));
+}
+
+
+// A page of guard either side of the area, the area's first byte is page aligned and
+// its last byte is the end of a page
+static unsigned char* mapGuarded(size_t size, unsigned char** areaEnd)
+{
+    long pageSize = sysconf(_SC_PAGESIZE);
+    size_t areaSize = ((size + pageSize - 1) / pageSize) * pageSize;
+    unsigned char* map;
+
+    map = (unsigned char*)mmap(NULL, areaSize + (2 * pageSize), PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    mprotect(map, pageSize, PROT_NONE);
+    mprotect(map + pageSize + areaSize, pageSize, PROT_NONE);
+    *areaEnd = map + pageSize + areaSize;
+    return map + pageSize;
+}
+
+
+// Every byte value at every position of a couple of vectors, so each lane sees each
+// character class
+static void checkEveryByte(const char* impl, unsigned char* area, unsigned char* areaEnd)
+{
+    unsigned char* buffer;
+
+    for (unsigned end = 0; end < 2; end++)
+    {
+        buffer = (end) ? areaEnd - VALUE_LENGTH : area;
+        memset(buffer, 'a', VALUE_LENGTH);
+        for (size_t position = 0; position < VALUE_LENGTH; position++)
+        {
+            for (unsigned value = 0; value < 256; value++)
+            {
+                buffer[position] = value;
+                checkBuffer(impl, buffer, VALUE_LENGTH);
+            }
+            buffer[position] = 'a';
+        }
+    }
+}
+
+
+// Every length, at every alignment, hard against the start and the end of the area,
+// with nothing special in it and then with a character from either side of each
+// class boundary at each position
+static void checkEveryLength(const char* impl, unsigned char* area, unsigned char* areaEnd)
+{
+    static const unsigned char boundaries[] = {0x00, '\t', '\n', '\r', 0x0e, 0x1f,
+                                               ' ',  '~',  0x7f, 0x80, 0xff};
+    unsigned char* buffer;
+
+    for (size_t length = 0; length <= MAX_LENGTH; length++)
+    {
+        for (size_t offset = 0; offset < MAX_ALIGNMENT; offset++)
+        {
+            for (unsigned end = 0; end < 2; end++)
+            {
+                buffer = (end) ? areaEnd - length - offset : area + offset;
+                memset(buffer, 'a', length);
+                checkBuffer(impl, buffer, length);
+
+                for (size_t position = 0; position < length; position++)
+                {
+                    buffer[position] =
+                        boundaries[(position + length + offset) % sizeof(boundaries)];
+                    checkBuffer(impl, buffer, length);
+                    buffer[position] = 'a';
+                }
+            }
+        }
+    }
+}
+
+
+// Mostly plain text, with line breaks and control characters scattered through it,
+// and runs of high bytes like UTF-8
+static void checkRandom(const char* impl, unsigned char* area, unsigned char* areaEnd)
+{
+    static const unsigned char special[] = {'\n', '\r', '\t', '\e', '\b', '\x7f',
+                                            0x80, 0xc3, 0xff, 0x00, '\v', '\f'};
+    unsigned char* buffer;
+    size_t length, offset;
+
+    srand(1);
+    for (unsigned round = 0; round < RANDOM_ROUNDS; round++)
+    {
+        length = rand() % (MAX_LENGTH * 4);
+        offset = rand() % MAX_ALIGNMENT;
+        buffer = (round & 1) ? areaEnd - length - offset : area + offset;
+
+        for (size_t i = 0; i < length; i++)
+        {
+            buffer[i] = ((rand() % 64) == 0) ? special[rand() % sizeof(special)]
+                                             : (unsigned char)(' ' + (rand() % 95));
+        }
+        checkBuffer(impl, buffer, length);
+    }
+}
+
+
+static unsigned char* readFixture(size_t* length)
+{
+    unsigned char* data;
+    FILE* file = fopen(FIXTURE, "rb");
+    long size;
+
+    if (!file)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    rewind(file);
+
+    data = (unsigned char*)malloc(size);
+    if (data && (fread(data, 1, size, file) != (size_t)size))
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *length = size;
+    return data;
+}
+
+
+// Quiet mode looks for each line break, verbose mode walks each plain text run then
+// the character that ended it
+static double timeWalk(const unsigned char* data, size_t length, bool lineBreaks)
+{
+    struct timespec start, finish, elapsed;
+    size_t position, total = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned repeat = 0; repeat < BENCH_REPEATS; repeat++)
+    {
+        for (position = 0; position < length; position++)
+        {
+            position += (lineBreaks) ? scanLineBreak(data + position, length - position)
+                                     : scanPlainText(data + position, length - position);
+            total += position;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    __asm__ volatile("" : : "r"(total));
+
+    timespecsub(&finish, &start, &elapsed);
+    return (length * (double)BENCH_REPEATS) /
+           ((elapsed.tv_sec + (elapsed.tv_nsec * 1e-9)) * 1024 * 1024);
+}
+
+
+static int bench(void)
+{
+    unsigned char* data;
+    size_t length;
+
+    data = readFixture(&length);
+    if (!data)
+    {
+        printf("scan_test: couldn't read %s\n", FIXTURE);
+        return EXIT_FAILURE;
+    }
+
+    printf("%zu bytes of compiler output, %u times\n", length, BENCH_REPEATS);
+    for (int impl = SCAN_SCALAR; impl < SCAN_NUM_IMPLS; impl++)
+    {
+        if (!scanSelect((scanImpl_t)impl))
+            continue;
+        printf("%-8s plain text %8.0f MB/s  line breaks %8.0f MB/s\n", implNames[impl],
+               timeWalk(data, length, false), timeWalk(data, length, true));
+    }
+    free(data);
+    return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char** argv)
+{
+    unsigned char *area, *areaEnd;
+
+    if ((argc > 1) && (strcmp(argv[1], "--bench") == 0))
+        return bench();
+
+    area = mapGuarded(MAX_LENGTH * 4 + MAX_ALIGNMENT, &areaEnd);
+    if (!area)
+    {
+        printf("scan_test: mmap failed\n");
+        return EXIT_FAILURE;
+    }
+
+    for (int impl = SCAN_SCALAR; impl < SCAN_NUM_IMPLS; impl++)
+    {
+        if (!scanSelect((scanImpl_t)impl))
+        {
+            printf("%-8s not supported here, skipped\n", implNames[impl]);
+            continue;
+        }
+        checkEveryByte(implNames[impl], area, areaEnd);
+        checkEveryLength(implNames[impl], area, areaEnd);
+        checkRandom(implNames[impl], area, areaEnd);
+        printf("%-8s checked\n", implNames[impl]);
+    }
+
+    if (failures)
+        printf("scan_test: %u failures\n", failures);
+    return (failures) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
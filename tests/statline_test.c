@@ -0,0 +1,253 @@
+#include "graphics.h"  // for gotoStatLine
+#include "render.h"    // for renderPuts, renderWrite, renderPutc, renderPrintf
+#include "statline.h"  // for statLineDraw, statLineInvalidate
+#include "vterm.h"     // for vtermCell, vtermInit, vtermWrite, vtermDestroy
+#include <stdarg.h>    // for va_list, va_start, va_end
+#include <stdio.h>     // for printf, vsnprintf, snprintf
+#include <stdlib.h>    // for EXIT_FAILURE, EXIT_SUCCESS
+#include <string.h>    // for memcpy, strlen
+
+//
+// Checks that drawing only the stat line's changed cells (statline.c) leaves the
+// terminal looking exactly like drawing the whole line would have, cell by cell,
+// using the headless terminal (vterm.c) as the terminal. Then counts the bytes a
+// minute of stat lines takes, diffed and redrawn whole.
+// Example: make test
+//
+
+#define ROWS 4
+#define COLUMNS 120
+#define NUM_TICKS 60
+#define NUM_CORES 16
+#define MIN_SAVING 2  // Diffing has to send at most half the bytes
+
+static char sent[64 * 1024];  // What statline.c sent for one draw
+static size_t sentLength;
+static unsigned failures;
+static window_t window = {.termSize = {.ws_row = ROWS, .ws_col = COLUMNS}};
+
+
+
+// statline.c draws through render.c and graphics.c, here it only needs to be captured
+void renderPuts(const char* str)
+{
+    renderWrite(str, strlen(str));
+}
+
+void renderWrite(const void* data, size_t length)
+{
+    if (sentLength + length <= sizeof(sent))
+    {
+        memcpy(sent + sentLength, data, length);
+        sentLength += length;
+    }
+}
+
+void renderPutc(char character)
+{
+    renderWrite(&character, 1);
+}
+
+void renderPrintf(const char* format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    sentLength += vsnprintf(sent + sentLength, sizeof(sent) - sentLength, format, args);
+    va_end(args);
+}
+
+void gotoStatLine(window_t* drawWindow)
+{
+    statLineInvalidate();
+    renderPrintf("\e[0J\e[%u;1H", drawWindow->termSize.ws_row + 1U);
+}
+
+
+static unsigned cellCodePoint(const struct vtermCell* cell)
+{
+    return cell->codePoint ? cell->codePoint : ' ';
+}
+
+
+// Draws line on top of whatever the terminal has, and checks the bottom row against a
+// terminal that was sent the whole of line. Returns how many bytes it took.
+static size_t expectDraw(const char* test, const char* line)
+{
+    struct vtermCell drawn[COLUMNS];
+    char whole[1024];
+    int wholeLength;
+    const struct vtermCell* expected;
+
+    sentLength = 0;
+    statLineDraw(&window, line);
+    vtermWrite(sent, sentLength);
+    for (unsigned column = 0; column < COLUMNS; column++)
+        drawn[column] = *vtermCell(ROWS - 1, column);
+
+    vtermDestroy();
+    vtermInit(ROWS, COLUMNS);
+    wholeLength = snprintf(whole, sizeof(whole), "\e[%u;1H%s", ROWS, line);
+    vtermWrite(whole, wholeLength);
+
+    for (unsigned column = 0; column < COLUMNS; column++)
+    {
+        expected = vtermCell(ROWS - 1, column);
+        if ((cellCodePoint(&drawn[column]) != cellCodePoint(expected)) ||
+            (drawn[column].foreground != expected->foreground) ||
+            (drawn[column].background != expected->background) ||
+            (drawn[column].attributes != expected->attributes))
+        {
+            printf("FAIL %s: column %u is U+%04X %d/%d/%02X, "
+                   "expected U+%04X %d/%d/%02X\n",
+                   test, column, cellCodePoint(&drawn[column]), drawn[column].foreground,
+                   drawn[column].background, drawn[column].attributes,
+                   cellCodePoint(expected), expected->foreground, expected->background,
+                   expected->attributes);
+            failures++;
+            break;
+        }
+    }
+    return sentLength;
+}
+
+
+static void reset(void)
+{
+    vtermDestroy();
+    vtermInit(ROWS, COLUMNS);
+    statLineInvalidate();
+}
+
+
+static void testText(void)
+{
+    reset();
+    expectDraw("first draw", "00:00:01 - [CPU:  5.0%]");
+    expectDraw("changed digits", "00:00:02 \\ [CPU: 15.5%]");
+    expectDraw("shorter", "00:00:03 |");
+    expectDraw("longer", "00:00:04 / [CPU: 15.5%] [Mem:  8.1%]");
+    if (expectDraw("unchanged", "00:00:04 / [CPU: 15.5%] [Mem:  8.1%]") != 0)
+    {
+        printf("FAIL unchanged: an unchanged line was sent again\n");
+        failures++;
+    }
+}
+
+
+static void testColours(void)
+{
+    reset();
+    expectDraw("coloured", "\e[36m00:00:01\e[0m [\e[31mCPU: 99%\e[0m]");
+    expectDraw("foreground change", "\e[36m00:00:01\e[0m [\e[33mCPU: 99%\e[0m]");
+    expectDraw("bright", "\e[36m00:00:01\e[0m [\e[90mCPU: 99%\e[0m]");
+    expectDraw("combined", "\e[1;4;36m00:00:01\e[0m [\e[90mCPU: 99%\e[0m]");
+}
+
+
+// Blanks look alike whatever they're written with, unless there's a background,
+// they're reversed or underlined
+static void testBlanks(void)
+{
+    reset();
+    expectDraw("background blanks", "ab \e[41m   \e[0m cd");
+    expectDraw("background change", "ab \e[42m   \e[0m cd");
+    expectDraw("background gone", "ab       cd");
+    expectDraw("reversed blanks", "ab \e[7m   \e[27m cd");
+    expectDraw("underlined blanks", "ab \e[4m   \e[0m cd");
+    expectDraw("trailing background", "ab \e[44m     ");
+    expectDraw("trailing background gone", "ab");
+}
+
+
+static void testExtendedColours(void)
+{
+    reset();
+    expectDraw("256 colours", "a\e[38;5;200mb\e[48;5;19mc\e[0md");
+    expectDraw("256 colour change", "a\e[38;5;201mb\e[48;5;19mc\e[0md");
+    expectDraw("colon separated", "a\e[38:5:202mb\e[48:5:20mc\e[0md");
+    expectDraw("true colour skipped", "a\e[38;2;1;2;3;1mb\e[0mc");
+}
+
+
+// A stat line the way printStats lays it out, with a core bar
+static void formatStatLine(char* line, unsigned tick, const unsigned* coreUsage)
+{
+    unsigned cpuUsage = 0, level;
+
+    for (unsigned core = 0; core < NUM_CORES; core++)
+        cpuUsage += coreUsage[core];
+
+    line += sprintf(line,
+                    "\e[1G\e[K\e[0m\e[36m00:%02u:%02u %c\e[0m [\e[90mCPU: %4.1f%%\e[0m]"
+                    " [\e[90mMem: %4.1f%%\e[0m] [\e[90mRx/Tx: %4.1fKB/s / %4.1fKB/s\e[0m]"
+                    " [\e[90m",
+                    tick / 60, tick % 60, "-\\|/"[tick % 4], cpuUsage / (float)NUM_CORES,
+                    40.0f + tick / 10.0f, (tick % 7) * 1.5f, (tick % 3) * 0.5f);
+    for (unsigned core = 0; core < NUM_CORES; core++)
+    {
+        level = (coreUsage[core] * 8 + 50) / 100;  // U+2581 to U+2588
+        if (coreUsage[core] >= 50)
+            line += sprintf(line, "\e[33m\xe2\x96%c\e[90m", 0x80 + level);
+        else if (level > 0)
+            line += sprintf(line, "\xe2\x96%c", 0x80 + level);
+        else
+            *line++ = ' ';
+    }
+    sprintf(line, "\e[0m]");
+}
+
+
+// Every tick changes the time, the spinner and some of the usage, but most of the line
+// stays put
+static void testBytes(void)
+{
+    char line[1024];
+    unsigned coreUsage[NUM_CORES] = {0};
+    unsigned random = 1;
+    size_t diffedBytes = 0, wholeBytes = 0;
+
+    reset();
+    for (unsigned tick = 0; tick < NUM_TICKS; tick++)
+    {
+        for (unsigned core = 0; core < NUM_CORES; core++)
+        {
+            random = random * 1103515245 + 12345;
+            if (((random >> 16) % 4) == 0)
+                coreUsage[core] = (random >> 8) % 101;
+        }
+        formatStatLine(line, tick, coreUsage);
+        diffedBytes += expectDraw("minute of ticks", line);
+
+        statLineInvalidate();
+        sentLength = 0;
+        statLineDraw(&window, line);
+        wholeBytes += sentLength;
+    }
+
+    printf("statline_test: %zu bytes a tick diffed, %zu redrawn whole\n",
+           diffedBytes / NUM_TICKS, wholeBytes / NUM_TICKS);
+    if ((diffedBytes * MIN_SAVING) > wholeBytes)
+    {
+        printf("FAIL bytes: diffing sent %zu bytes, redrawing whole %zu\n", diffedBytes,
+               wholeBytes);
+        failures++;
+    }
+}
+
+
+int main(void)
+{
+    testText();
+    testColours();
+    testBlanks();
+    testExtendedColours();
+    testBytes();
+    vtermDestroy();
+
+    if (failures)
+        printf("statline_test: %u failures\n", failures);
+    else
+        printf("statline_test: passed\n");
+    return (failures) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
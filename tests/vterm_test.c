@@ -0,0 +1,239 @@
+#include "vterm.h"    // for vtermInit, vtermWrite, vtermCell, vtermCursor, vtermDestroy
+#include <stdbool.h>  // for bool, false, true
+#include <stdio.h>    // for printf
+#include <stdlib.h>   // for EXIT_FAILURE, EXIT_SUCCESS
+#include <string.h>   // for strlen
+
+//
+// Checks the headless terminal (vterm.c) cell by cell, for the sequences procprog
+// sends and passes through. tests/headless_test.py checks the whole of procprog
+// through it.
+// Example: make test
+//
+
+#define ROWS 6
+#define COLUMNS 10
+
+static unsigned failures;
+static const char* currentTest;
+
+
+
+static void reset(const char* test)
+{
+    currentTest = test;
+    vtermDestroy();
+    if (!vtermInit(ROWS, COLUMNS))
+    {
+        printf("FAIL %s: vtermInit failed\n", test);
+        failures++;
+    }
+}
+
+
+static void send(const char* sequence)
+{
+    vtermWrite(sequence, strlen(sequence));
+}
+
+
+// text is what row should read from column onwards, ' ' matches a blank cell
+static void expectText(unsigned row, unsigned column, const char* text)
+{
+    const struct vtermCell* cell;
+    unsigned codePoint;
+
+    for (unsigned i = 0; text[i] != '\0'; i++)
+    {
+        cell = vtermCell(row, column + i);
+        codePoint = (cell && cell->codePoint) ? cell->codePoint : ' ';
+        if (codePoint != (unsigned char)text[i])
+        {
+            printf("FAIL %s: row %u column %u is U+%04X, expected '%c'\n", currentTest,
+                   row, column + i, codePoint, text[i]);
+            failures++;
+            return;
+        }
+    }
+}
+
+
+static void expectCursor(unsigned row, unsigned column)
+{
+    unsigned cursorRow, cursorColumn;
+
+    vtermCursor(&cursorRow, &cursorColumn);
+    if ((cursorRow != row) || (cursorColumn != column))
+    {
+        printf("FAIL %s: cursor at %u,%u, expected %u,%u\n", currentTest, cursorRow,
+               cursorColumn, row, column);
+        failures++;
+    }
+}
+
+
+static void expectPen(unsigned row, unsigned column, int foreground, int background,
+                      unsigned attributes)
+{
+    const struct vtermCell* cell = vtermCell(row, column);
+
+    if (!cell || (cell->foreground != foreground) || (cell->background != background) ||
+        (cell->attributes != attributes))
+    {
+        printf("FAIL %s: row %u column %u has colours %d/%d attributes %#x, expected "
+               "%d/%d %#x\n",
+               currentTest, row, column, cell ? cell->foreground : 0,
+               cell ? cell->background : 0, cell ? cell->attributes : 0, foreground,
+               background, attributes);
+        failures++;
+    }
+}
+
+
+
+static void testText(void)
+{
+    reset("text");
+    send("hello\nworld");
+    expectText(0, 0, "hello     ");
+    expectText(1, 0, "world     ");
+    expectCursor(1, 5);
+
+    send("\rW\b\bX");
+    expectText(1, 0, "Xorld");
+    expectCursor(1, 1);
+}
+
+
+// The cursor stays on the last column until the next character, then wraps
+static void testWrap(void)
+{
+    reset("wrap");
+    send("0123456789");
+    expectCursor(0, COLUMNS - 1);
+    send("a");
+    expectText(1, 0, "a");
+    expectCursor(1, 1);
+}
+
+
+static void testCursorMovement(void)
+{
+    reset("cursor movement");
+    send("\e[3;4HX\e[2AY\e[7GZ\e[B\e[2DQ\e[99;99H");
+    expectText(2, 3, "X");
+    expectText(0, 4, "Y Z");
+    expectText(1, 5, "Q");
+    expectCursor(ROWS - 1, COLUMNS - 1);
+
+    send("\e[2;2H\e[sabc\e[uR");
+    expectText(1, 1, "Rbc");
+}
+
+
+static void testErase(void)
+{
+    reset("erase");
+    send("0123456789\r\n0123456789\r\n0123456789");
+    send("\e[2;5H\e[K");
+    expectText(1, 0, "0123      ");
+    send("\e[1;3H\e[1K");
+    expectText(0, 0, "   3456789");
+    send("\e[2;1H\e[0J");
+    expectText(1, 0, "          ");
+    expectText(2, 0, "          ");
+    expectText(0, 3, "3456789");
+    send("\e[2J");
+    expectText(0, 0, "          ");
+}
+
+
+static void testColours(void)
+{
+    reset("colours");
+    send("\e[1;31mR\e[42mG\e[0mN\e[38;5;200;48;5;17mI\e[7;90mB");
+    expectPen(0, 0, 1, VTERM_COLOUR_DEFAULT, VTERM_ATTR_BOLD);
+    expectPen(0, 1, 1, 2, VTERM_ATTR_BOLD);
+    expectPen(0, 2, VTERM_COLOUR_DEFAULT, VTERM_COLOUR_DEFAULT, 0);
+    expectPen(0, 3, 200, 17, 0);
+    expectPen(0, 4, 8, 17, VTERM_ATTR_REVERSE);
+}
+
+
+// procprog keeps the stat line out of the scroll region
+static void testScrollRegion(void)
+{
+    reset("scroll region");
+    send("\e[6;1Hstat\e[1;5r\e[1;1H");
+    expectCursor(0, 0);
+    send("1\n2\n3\n4\n5\n6\n7");
+    expectText(0, 0, "3");
+    expectText(4, 0, "7");
+    expectText(5, 0, "stat");
+    expectCursor(4, 1);
+
+    send("\e[r\e[6;1H\n");
+    expectText(4, 0, "stat");
+}
+
+
+static void testAlternateScreen(void)
+{
+    reset("alternate screen");
+    send("main\e[?1049h");
+    expectText(0, 0, "    ");
+    expectCursor(0, 4);
+    send("\e[Halt");
+    expectText(0, 0, "alt");
+    send("\e[?1049l");
+    expectText(0, 0, "main");
+    expectCursor(0, 4);
+}
+
+
+static void testUtf8(void)
+{
+    const struct vtermCell* cell;
+
+    reset("utf-8");
+    send("\xc3\xa9\xe2\x94\x80\xf0\x9f\x98\x80x");
+    cell = vtermCell(0, 0);
+    if (!cell || (cell->codePoint != 0xE9) || (vtermCell(0, 1)->codePoint != 0x2500) ||
+        (vtermCell(0, 2)->codePoint != 0x1F600))
+    {
+        printf("FAIL %s: multi-byte characters weren't decoded\n", currentTest);
+        failures++;
+    }
+    expectText(0, 3, "x");
+}
+
+
+// Anything else is swallowed whole rather than drawn
+static void testIgnored(void)
+{
+    reset("ignored sequences");
+    send("a\e]0;title\aB\e(0c\e[?25ld");
+    expectText(0, 0, "aBcd");
+    expectCursor(0, 4);
+}
+
+
+int main(void)
+{
+    testText();
+    testWrap();
+    testCursorMovement();
+    testErase();
+    testColours();
+    testScrollRegion();
+    testAlternateScreen();
+    testUtf8();
+    testIgnored();
+    vtermDestroy();
+
+    if (failures)
+        printf("vterm_test: %u failures\n", failures);
+    else
+        printf("vterm_test: passed\n");
+    return (failures) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,9 +1,9 @@
 #include <signal.h>   // for SIGEV_THREAD, sigevent
 #include <stdbool.h>  // for bool
-#include <time.h>     // for timer_create, timer_settime
+#include <time.h>     // for timer_create, timer_settime, timer_delete, timer_t
 
 
-void tick_create(void (*callback)(sigval_t), unsigned sec, unsigned nsec, bool once)
+timer_t tick_create(void (*callback)(sigval_t), unsigned sec, unsigned nsec, bool once)
 {
     struct sigevent timerEvent = {
         .sigev_notify = SIGEV_THREAD,
@@ -21,4 +21,12 @@ void tick_create(void (*callback)(sigval_t), unsigned sec, unsigned nsec, bool o
 
     timer_create(CLOCK_MONOTONIC, &timerEvent, &timer);
     timer_settime(timer, 0, &timerPeriod, NULL);
+    return timer;
+}
+
+
+// Disarms the timer, a callback that has already been started can still be running
+void tick_delete(timer_t timer)
+{
+    timer_delete(timer);
 }
@@ -2,9 +2,11 @@
 
 #include <signal.h>   // for __sigval_t
 #include <stdbool.h>  // for bool
+#include <time.h>     // for timer_t
 
-void tick_create(void (*callback)(__sigval_t sigval), unsigned sec, unsigned nsec,
-                 bool once);
+timer_t tick_create(void (*callback)(__sigval_t sigval), unsigned sec, unsigned nsec,
+                    bool once);
+void tick_delete(timer_t timer);
 
 
 // clang-format off
@@ -1,13 +1,18 @@
 #include "util.h"
 #include "graphics.h"     // for ANSI_FG_RED, ANSI_RESET_ALL
-#include "main.h"         // for options_t, window_t
+#include "main.h"         // for options_t, window_t, statsFormat_t
+#include "replay.h"       // for REPLAY_SPEED_MAX
+#include "tail.h"         // for TAIL_DEFAULT_LINES, TAIL_MAX_LINES
 #include "timer.h"        // for timespecsub
 #include <getopt.h>       // for no_argument, getopt_long, option, requ...
+#include <limits.h>       // for USHRT_MAX
 #include <stdarg.h>       // for va_end, va_start
 #include <stdbool.h>      // for false, true, bool
 #include <stdio.h>        // for puts, NULL, printf, fopen, fputs, vprintf
-#include <stdlib.h>       // for exit, EXIT_FAILURE, EXIT_SUCCESS
+#include <stdlib.h>       // for exit, strtod, strtoul, EXIT_FAILURE, EXIT_SUCCESS
 #include <stdnoreturn.h>  // for noreturn
+#include <string.h>       // for strcmp, strrchr
+#include <sys/ioctl.h>    // for winsize
 #include <time.h>         // for timespec, clock_gettime, CLOCK_MONOTONIC
 
 
@@ -26,8 +31,8 @@ unsigned printable_strlen(const char* str)
             if (*str == 'm')
                 skip = false;
         }
-        else if ((*str >= ' ') && (*str <= '~'))
-            length++;
+        else if (((*str >= ' ') && (*str <= '~')) || ((unsigned char)*str >= 0xC0))
+            length++;  // Only the first byte of a UTF-8 character is counted
 
         str++;
     }
@@ -48,24 +53,121 @@ double proc_runtime(window_t* window)
 
 
 
+// Without --stats-format, the extension decides, anything unrecognised is CSV
+static statsFormat_t guessStatsFormat(const char* filename)
+{
+    const char* extension = strrchr(filename, '.');
+
+    if (extension &&
+        ((strcmp(extension, ".json") == 0) || (strcmp(extension, ".jsonl") == 0)))
+        return STATS_FORMAT_JSON;
+    if (extension && (strcmp(extension, ".bin") == 0))
+        return STATS_FORMAT_BINARY;
+    return STATS_FORMAT_CSV;
+}
+
+
+static double parseSpeed(const char* arg)
+{
+    char* end;
+    double speed;
+
+    if (strcmp(arg, "max") == 0)
+        return REPLAY_SPEED_MAX;
+
+    speed = strtod(arg, &end);
+    if ((end == arg) || (*end != '\0') || !(speed > 0))
+        showError(EXIT_FAILURE, true, "Speed should be a number above 0, or max: %s\n\n",
+                  arg);
+    return speed;
+}
+
+
+static unsigned parseTailLines(const char* arg)
+{
+    char* end;
+    unsigned long lines = strtoul(arg, &end, 10);
+
+    if ((end == arg) || (*end != '\0') || (lines > TAIL_MAX_LINES))
+        showError(EXIT_FAILURE, true, "Lines should be a number from 0 to %u: %s\n\n",
+                  TAIL_MAX_LINES, arg);
+    return lines;
+}
+
+
+// COLSxROWS, for -H
+static struct winsize parseSize(const char* arg)
+{
+    struct winsize size = {0};
+    unsigned long columns, rows;
+    char* end;
+
+    columns = strtoul(arg, &end, 10);
+    if ((end != arg) && (*end == 'x'))
+    {
+        arg = end + 1;
+        rows = strtoul(arg, &end, 10);
+        if ((end != arg) && (*end == '\0') && (columns > 0) && (columns <= USHRT_MAX) &&
+            (rows > 1) && (rows <= USHRT_MAX))
+        {
+            size.ws_col = columns;
+            size.ws_row = rows;
+            return size;
+        }
+    }
+    showError(EXIT_FAILURE, true, "Size should be COLSxROWS, e.g. 80x24\n\n");
+}
+
+
 const char** getArgs(int argc, char** argv, FILE** outputFile, options_t* options)
 {
     static struct option longOpts[] = {{"append", no_argument, NULL, 'a'},
+                                       {"all-history", no_argument, NULL, 'A'},
+                                       {"cgroup", optional_argument, NULL, 'c'},
                                        {"debug", no_argument, NULL, 'd'},
                                        {"explicit", no_argument, NULL, 'e'},
+                                       {"event-loop", no_argument, NULL, 'E'},
+                                       {"headless", required_argument, NULL, 'H'},
                                        {"help", no_argument, NULL, 'h'},
+                                       {"indexed", no_argument, NULL, 'i'},
                                        {"output-file", required_argument, NULL, 'o'},
+                                       {"profile", no_argument, NULL, 'p'},
+                                       {"pty", no_argument, NULL, 'P'},
+                                       {"replay", required_argument, NULL, 'r'},
+                                       {"speed", required_argument, NULL, 'x'},
+                                       {"stats-file", required_argument, NULL, 's'},
+                                       {"stats-format", required_argument, NULL, 'S'},
+                                       {"summary", no_argument, NULL, 'u'},
+                                       {"summary-json", required_argument, NULL, 'j'},
+                                       {"tail", required_argument, NULL, 't'},
                                        {"verbose", no_argument, NULL, 'v'},
                                        {"version", no_argument, NULL, 'V'},
                                        {NULL, no_argument, NULL, 0}};
     int optc;
     bool append = false;
+    bool statsFormatSet = false;
     char* outFilename = NULL;
     options->verbose = false;
     options->debug = false;
     options->useScrollingRegion = true;
-
-    while ((optc = getopt_long(argc, argv, "+aedho:vV", longOpts, (int*)0)) != EOF)
+    options->eventLoop = false;
+    options->cgroup = false;
+    options->cgroupParent = NULL;
+    options->statsFile = NULL;
+    options->statsFormat = STATS_FORMAT_CSV;
+    options->summary = false;
+    options->summaryJson = NULL;
+    options->indexedLog = false;
+    options->replayFile = NULL;
+    options->replaySpeed = 1;
+    options->profile = false;
+    options->headlessSize = (struct winsize){0};
+    options->tailLines = TAIL_DEFAULT_LINES;
+    options->pty = false;
+    options->allHistory = false;
+
+    while ((optc = getopt_long(argc, argv, "+aAc::edEhH:ij:o:pPr:s:S:t:uvVx:", longOpts,
+                               (int*)0)) != EOF)
     {
         switch (optc)
         {
@@ -74,31 +176,89 @@ const char** getArgs(int argc, char** argv, FILE** outputFile, options_t* option
         case 'v':
             options->verbose = true;
             break;
+        case 'u':
+            options->summary = true;
+            break;
         case 'V':
             showVersion(EXIT_SUCCESS);  // Doesn't return
         case 'a':
             append = true;
             break;
+        case 'A':
+            options->allHistory = true;
+            break;
         case 'o':
             outFilename = optarg;
             break;
+        case 'i':
+            options->indexedLog = true;
+            break;
         case 'd':
             options->debug = true;
             break;
         case 'e':
             options->useScrollingRegion = false;
             break;
+        case 'E':
+            options->eventLoop = true;
+            break;
+        case 's':
+            options->statsFile = optarg;
+            if (!statsFormatSet)
+                options->statsFormat = guessStatsFormat(optarg);
+            break;
+        case 'S':
+            if (strcmp(optarg, "csv") == 0)
+                options->statsFormat = STATS_FORMAT_CSV;
+            else if (strcmp(optarg, "json") == 0)
+                options->statsFormat = STATS_FORMAT_JSON;
+            else if (strcmp(optarg, "binary") == 0)
+                options->statsFormat = STATS_FORMAT_BINARY;
+            else
+                showError(EXIT_FAILURE, true, "Unknown stats format: %s\n\n", optarg);
+            statsFormatSet = true;
+            break;
+        case 'j':
+            options->summaryJson = optarg;
+            break;
+        case 'p':
+            options->profile = true;
+            break;
+        case 'P':
+            options->pty = true;
+            break;
+        case 'r':
+            options->replayFile = optarg;
+            break;
+        case 't':
+            options->tailLines = parseTailLines(optarg);
+            break;
+        case 'H':
+            options->headlessSize = parseSize(optarg);
+            break;
+        case 'x':
+            options->replaySpeed = parseSpeed(optarg);
+            break;
+        case 'c':
+            options->cgroup = true;
+            options->cgroupParent = optarg;
+            break;
         default:
             showUsage(EXIT_FAILURE);
         }
     }
 
-    if (optind == argc)
+    if (options->replayFile && (optind != argc))
+        showError(EXIT_FAILURE, true, "-r doesn't run a command, it replays FILE\n\n");
+    else if (!options->replayFile && (optind == argc))
     {
         showError(EXIT_FAILURE, true, "Can't find a program to run, optind = %d\n\n",
                   optind);
     }
 
+    if (options->indexedLog && (!outFilename || append))
+        showError(EXIT_FAILURE, true, "-i needs -o FILE, and can't append to it\n\n");
+
     if (outFilename)
     {
         *outputFile = fopen(outFilename, (append) ? "a" : "w");
@@ -116,15 +276,49 @@ noreturn void showUsage(int status)
     puts("Monitor COMMAND output and system usage in a single terminal\n");
 
     printf("Usage: %s [OPTION]... COMMAND [ARG]...\n", PROGRAM_NAME);
+    printf("  or:  %s [OPTION]... -r FILE [-x N|max]\n", PROGRAM_NAME);
     puts("\t-a, --append       When using -o FILE, append instead of overwriting");
-    puts("\t-d, --debug        Create a very verbose debug file of stdout and stdin");
+    puts("\t-A, --all-history  Show the 5 minute history of disk, network and process");
+    puts("\t                   tree usage, not just CPU and memory, when there's room");
+    puts("\t-c, --cgroup[=DIR] Run COMMAND in its own cgroup (v2) under DIR, or next");
+    puts("\t                   to this one, for exact usage including exited processes");
+    puts("\t-d, --debug        Record a timed trace of stdout and stdin, replay_log.py");
+    puts("\t                   decodes it");
     puts("\t-e, --explicit     Some terminal emulators don't work nicely when using");
     puts("\t                   scrolling-regions, performing scrolling explicitly with");
     puts("\t                   CSI commands should have better compatability");
+    puts("\t-E, --event-loop   Run in a single thread, multiplexing output, input, stats");
+    puts("\t                   and signals with epoll, for when running many at once");
     puts("\t-h, --help         Display this help and exit");
+    puts("\t-H, --headless=COLSxROWS");
+    puts("\t                   Draw into an in-process terminal of that size instead of");
+    puts("\t                   stdout, and print its final screen as text at the end,");
+    puts("\t                   followed by \"cursor ROW,COLUMN\"");
+    puts("\t-i, --indexed      When using -o FILE, write each line with a timestamp and");
+    puts("\t                   add an index by line number and time, output_log.py");
+    puts("\t                   reads it");
+    puts("\t-j, --summary-json=FILE");
+    puts("\t                   Write the end of run resource summary to FILE as JSON");
     puts("\t-o, --output=FILE  Write output to FILE as well as stdout");
+    puts("\t-p, --profile      Show procprog's own CPU use, read rate, pipe backlog and");
+    puts("\t                   output latency (p50/p99), in the stats and with -u");
+    puts("\t-P, --pty          Run COMMAND on a pseudo-terminal instead of pipes, so it");
+    puts("\t                   line buffers and keeps its colours and progress bars");
+    puts("\t-r, --replay=FILE  Play back a -d trace through the display instead of");
+    puts("\t                   running COMMAND, with the original timing");
+    puts("\t-s, --stats-file=FILE");
+    puts("\t                   Write every stats sample to FILE, as CSV, JSON lines or");
+    puts("\t                   binary depending on the extension (.csv, .json, .bin)");
+    puts("\t-S, --stats-format=FORMAT");
+    puts("\t                   Override the --stats-file format: csv, json or binary");
+    printf("\t-t, --tail=LINES   Show the last LINES of output if COMMAND fails, unless\n"
+           "\t                   using -v (default %u, 0 for none)\n",
+           TAIL_DEFAULT_LINES);
+    puts("\t-u, --summary      When COMMAND finishes, show its CPU time, peak memory,");
+    puts("\t                   faults and I/O, and the mean and peak of each stat");
     puts("\t-v, --verbose      Display all output from the child process");
     puts("\t-V, --version      Output version information and exit");
+    puts("\t-x, --speed=N|max  Replay N times faster, or as fast as possible");
 
     puts("\nExamples:");
     puts("\tprocproc make      Build a project, showing progress and system usage");
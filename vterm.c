@@ -0,0 +1,710 @@
+#include "vterm.h"
+#include <stdbool.h>  // for bool, false, true
+#include <stdint.h>   // for uint32_t, int16_t, uint8_t
+#include <stdio.h>    // for fputc, FILE
+#include <stdlib.h>   // for calloc, free
+#include <string.h>   // for memmove
+
+typedef enum
+{
+    PARSE_GROUND,
+    PARSE_ESCAPE,
+    PARSE_CHARSET,  // ESC ( and friends, one more byte to swallow
+    PARSE_CSI,
+    PARSE_OSC,
+} parseState_t;
+
+struct cursor
+{
+    unsigned row;
+    unsigned column;
+    struct vtermCell pen;  // The attributes the next character is written with
+};
+
+static struct vtermCell* screens[2];      // Normal, then alternate
+static struct vtermCell** screenRows[2];  // Each screen's rows, in the order they show
+static struct vtermCell** currentRows;    // Whichever screen is showing
+static unsigned numRows;
+static unsigned numColumns;
+static struct cursor cursor;
+static struct cursor savedCursor;     // \e[s and ESC 7
+static struct cursor alternateSaved;  // \e[?1049h
+static bool wrapPending;  // The last column was just written, the next character wraps
+static unsigned scrollTop;
+static unsigned scrollBottom;  // Inclusive
+
+static parseState_t parseState;
+static unsigned params[VTERM_MAX_PARAMS];
+static unsigned numParams;
+static char privateMarker;
+static uint32_t utf8CodePoint;
+static unsigned utf8Remaining;
+
+static const struct vtermCell defaultPen = {
+    .foreground = VTERM_COLOUR_DEFAULT,
+    .background = VTERM_COLOUR_DEFAULT,
+};
+
+
+
+static struct vtermCell* cellAt(unsigned row, unsigned column)
+{
+    return &currentRows[row][column];
+}
+
+
+static unsigned clamp(unsigned value, unsigned min, unsigned max)
+{
+    return (value < min) ? min : ((value > max) ? max : value);
+}
+
+
+// Erased cells keep the current background, as they do on a real terminal
+static void eraseCells(unsigned row, unsigned from, unsigned to)
+{
+    struct vtermCell blank = {
+        .foreground = VTERM_COLOUR_DEFAULT,
+        .background = cursor.pen.background,
+    };
+
+    for (unsigned column = from; column < to; column++)
+        *cellAt(row, column) = blank;
+}
+
+
+static void eraseRows(unsigned from, unsigned to)
+{
+    for (unsigned row = from; row < to; row++)
+        eraseCells(row, 0, numColumns);
+}
+
+
+// Reverses the order of rows [from, to), three of these rotate a region so
+// scrolling only moves row pointers around
+static void reverseRows(unsigned from, unsigned to)
+{
+    struct vtermCell* swap;
+
+    while ((from + 1) < to)
+    {
+        swap = currentRows[from];
+        currentRows[from++] = currentRows[--to];
+        currentRows[to] = swap;
+    }
+}
+
+
+static void scrollUp(unsigned top, unsigned bottom, unsigned lines)
+{
+    unsigned regionRows = bottom + 1 - top;
+
+    if (lines > regionRows)
+        lines = regionRows;
+    reverseRows(top, top + lines);
+    reverseRows(top + lines, bottom + 1);
+    reverseRows(top, bottom + 1);
+    eraseRows(bottom + 1 - lines, bottom + 1);
+}
+
+
+static void scrollDown(unsigned top, unsigned bottom, unsigned lines)
+{
+    unsigned regionRows = bottom + 1 - top;
+
+    if (lines > regionRows)
+        lines = regionRows;
+    reverseRows(top, bottom + 1 - lines);
+    reverseRows(bottom + 1 - lines, bottom + 1);
+    reverseRows(top, bottom + 1);
+    eraseRows(top, top + lines);
+}
+
+
+// Scrolls at the bottom of the scroll region, does nothing at the bottom of the screen
+// if that's outside it
+static void lineFeed(void)
+{
+    wrapPending = false;
+    if (cursor.row == scrollBottom)
+        scrollUp(scrollTop, scrollBottom, 1);
+    else if (cursor.row < numRows - 1)
+        cursor.row++;
+}
+
+
+static void reverseLineFeed(void)
+{
+    wrapPending = false;
+    if (cursor.row == scrollTop)
+        scrollDown(scrollTop, scrollBottom, 1);
+    else if (cursor.row > 0)
+        cursor.row--;
+}
+
+
+static void putCodePoint(uint32_t codePoint)
+{
+    struct vtermCell* cell;
+
+    if (wrapPending)
+    {
+        cursor.column = 0;
+        lineFeed();
+    }
+
+    cell = cellAt(cursor.row, cursor.column);
+    *cell = cursor.pen;
+    cell->codePoint = codePoint;
+
+    if (cursor.column == numColumns - 1)
+        wrapPending = true;
+    else
+        cursor.column++;
+}
+
+
+// A tty with the default OPOST and ONLCR turns \n into \r\n on the way out
+static void controlChar(unsigned char character)
+{
+    switch (character)
+    {
+    case '\r':
+        cursor.column = 0;
+        wrapPending = false;
+        break;
+    case '\n':
+    case '\v':
+    case '\f':
+        cursor.column = 0;
+        lineFeed();
+        break;
+    case '\b':
+        if (cursor.column > 0)
+            cursor.column--;
+        wrapPending = false;
+        break;
+    case '\t':
+        cursor.column = clamp((cursor.column + 8) & ~7U, 0, numColumns - 1);
+        wrapPending = false;
+        break;
+    default:
+        break;  // Including the bell
+    }
+}
+
+
+static unsigned param(unsigned index, unsigned defaultValue)
+{
+    if ((index >= numParams) || (params[index] == 0))
+        return defaultValue;
+    return params[index];
+}
+
+
+// 38;5;n and 48;5;n are kept, 38;2;r;g;b can't be, it's skipped over
+static unsigned extendedColour(const unsigned* values, unsigned numValues, unsigned index,
+                               int16_t* colour)
+{
+    if ((index + 2 < numValues) && (values[index + 1] == 5))
+    {
+        *colour = (int16_t)clamp(values[index + 2], 0, 255);
+        return index + 2;
+    }
+    if ((index + 4 < numValues) && (values[index + 1] == 2))
+        return index + 4;
+    return numValues;
+}
+
+
+// Also used by the stat line, to know what each of its cells looks like
+void vtermSelectGraphicRendition(struct vtermCell* pen, const unsigned* values,
+                                 unsigned numValues)
+{
+    unsigned value;
+
+    if (numValues == 0)
+        *pen = defaultPen;  // \e[m is \e[0m
+
+    for (unsigned i = 0; i < numValues; i++)
+    {
+        value = values[i];
+        if (value == 0)
+            *pen = defaultPen;
+        else if ((value >= 1) && (value <= 8) && (value != 3) && (value != 6))
+            pen->attributes |= (uint8_t[]){0, VTERM_ATTR_BOLD, VTERM_ATTR_DIM, 0,
+                                           VTERM_ATTR_UNDERLINE, VTERM_ATTR_BLINK, 0,
+                                           VTERM_ATTR_REVERSE, VTERM_ATTR_HIDDEN}[value];
+        else if ((value == 21) || (value == 22))
+            pen->attributes &= ~(VTERM_ATTR_BOLD | VTERM_ATTR_DIM);
+        else if (value == 24)
+            pen->attributes &= ~VTERM_ATTR_UNDERLINE;
+        else if (value == 25)
+            pen->attributes &= ~VTERM_ATTR_BLINK;
+        else if (value == 27)
+            pen->attributes &= ~VTERM_ATTR_REVERSE;
+        else if (value == 28)
+            pen->attributes &= ~VTERM_ATTR_HIDDEN;
+        else if ((value >= 30) && (value <= 37))
+            pen->foreground = value - 30;
+        else if ((value >= 90) && (value <= 97))
+            pen->foreground = value - 90 + 8;
+        else if (value == 39)
+            pen->foreground = VTERM_COLOUR_DEFAULT;
+        else if ((value >= 40) && (value <= 47))
+            pen->background = value - 40;
+        else if ((value >= 100) && (value <= 107))
+            pen->background = value - 100 + 8;
+        else if (value == 49)
+            pen->background = VTERM_COLOUR_DEFAULT;
+        else if (value == 38)
+            i = extendedColour(values, numValues, i, &pen->foreground);
+        else if (value == 48)
+            i = extendedColour(values, numValues, i, &pen->background);
+    }
+}
+
+
+static void setAlternateScreen(bool alternate, bool saveCursor)
+{
+    if (alternate == (currentRows == screenRows[1]))
+        return;
+
+    if (alternate)
+    {
+        if (saveCursor)
+            alternateSaved = cursor;
+        currentRows = screenRows[1];
+        eraseRows(0, numRows);
+    }
+    else
+    {
+        currentRows = screenRows[0];
+        if (saveCursor)
+            cursor = alternateSaved;
+    }
+    wrapPending = false;
+}
+
+
+static void privateMode(bool set)
+{
+    for (unsigned i = 0; i < numParams; i++)
+    {
+        if (params[i] == 1049)
+            setAlternateScreen(set, true);
+        else if ((params[i] == 47) || (params[i] == 1047))
+            setAlternateScreen(set, false);
+    }
+}
+
+
+static void eraseInDisplay(unsigned mode)
+{
+    switch (mode)
+    {
+    case 0:
+        eraseCells(cursor.row, cursor.column, numColumns);
+        eraseRows(cursor.row + 1, numRows);
+        break;
+    case 1:
+        eraseRows(0, cursor.row);
+        eraseCells(cursor.row, 0, cursor.column + 1);
+        break;
+    case 2:
+        eraseRows(0, numRows);
+        break;
+    default:
+        break;  // 3 only clears the scrollback, and there isn't any
+    }
+}
+
+
+static void eraseInLine(unsigned mode)
+{
+    if (mode == 0)
+        eraseCells(cursor.row, cursor.column, numColumns);
+    else if (mode == 1)
+        eraseCells(cursor.row, 0, cursor.column + 1);
+    else if (mode == 2)
+        eraseCells(cursor.row, 0, numColumns);
+}
+
+
+static void shiftCells(bool insert, unsigned count)
+{
+    unsigned remaining = numColumns - cursor.column;
+    struct vtermCell* start = cellAt(cursor.row, cursor.column);
+
+    if (count > remaining)
+        count = remaining;
+    if (insert)
+    {
+        memmove(start + count, start, (remaining - count) * sizeof(*start));
+        eraseCells(cursor.row, cursor.column, cursor.column + count);
+    }
+    else
+    {
+        memmove(start, start + count, (remaining - count) * sizeof(*start));
+        eraseCells(cursor.row, numColumns - count, numColumns);
+    }
+}
+
+
+static void csiDispatch(unsigned char command)
+{
+    unsigned top, bottom;
+
+    if (privateMarker)
+    {
+        if ((privateMarker == '?') && ((command == 'h') || (command == 'l')))
+            privateMode(command == 'h');
+        return;
+    }
+
+    switch (command)
+    {
+    case 'A':
+        top = (cursor.row >= scrollTop) ? scrollTop : 0;
+        cursor.row = (cursor.row > top + param(0, 1)) ? cursor.row - param(0, 1) : top;
+        break;
+    case 'B':
+        bottom = (cursor.row <= scrollBottom) ? scrollBottom : numRows - 1;
+        cursor.row = clamp(cursor.row + param(0, 1), 0, bottom);
+        break;
+    case 'C':
+        cursor.column = clamp(cursor.column + param(0, 1), 0, numColumns - 1);
+        break;
+    case 'D':
+        cursor.column = (cursor.column > param(0, 1)) ? cursor.column - param(0, 1) : 0;
+        break;
+    case 'G':
+        cursor.column = clamp(param(0, 1) - 1, 0, numColumns - 1);
+        break;
+    case 'd':
+        cursor.row = clamp(param(0, 1) - 1, 0, numRows - 1);
+        break;
+    case 'H':
+    case 'f':
+        cursor.row = clamp(param(0, 1) - 1, 0, numRows - 1);
+        cursor.column = clamp(param(1, 1) - 1, 0, numColumns - 1);
+        break;
+    case 'J':
+        eraseInDisplay((numParams > 0) ? params[0] : 0);
+        break;
+    case 'K':
+        eraseInLine((numParams > 0) ? params[0] : 0);
+        break;
+    case 'X':
+        eraseCells(cursor.row, cursor.column,
+                   clamp(cursor.column + param(0, 1), 0, numColumns));
+        break;
+    case '@':
+        shiftCells(true, param(0, 1));
+        break;
+    case 'P':
+        shiftCells(false, param(0, 1));
+        break;
+    case 'L':
+        if ((cursor.row >= scrollTop) && (cursor.row <= scrollBottom))
+            scrollDown(cursor.row, scrollBottom, param(0, 1));
+        break;
+    case 'M':
+        if ((cursor.row >= scrollTop) && (cursor.row <= scrollBottom))
+            scrollUp(cursor.row, scrollBottom, param(0, 1));
+        break;
+    case 'S':
+        scrollUp(scrollTop, scrollBottom, param(0, 1));
+        break;
+    case 'T':
+        scrollDown(scrollTop, scrollBottom, param(0, 1));
+        break;
+    case 'r':
+        top = clamp(param(0, 1), 1, numRows) - 1;
+        bottom = clamp(param(1, numRows), 1, numRows) - 1;
+        if (top < bottom)
+        {
+            scrollTop = top;
+            scrollBottom = bottom;
+            cursor.row = 0;
+            cursor.column = 0;
+        }
+        break;
+    case 's':
+        savedCursor = cursor;
+        break;
+    case 'u':
+        cursor = savedCursor;
+        break;
+    case 'm':
+        vtermSelectGraphicRendition(&cursor.pen, params, numParams);
+        return;  // Doesn't move the cursor
+    default:
+        return;  // Including device status reports, there's no one to reply to
+    }
+    wrapPending = false;
+}
+
+
+static void escapeDispatch(unsigned char command)
+{
+    parseState = PARSE_GROUND;
+
+    switch (command)
+    {
+    case '[':
+        parseState = PARSE_CSI;
+        numParams = 0;
+        privateMarker = 0;
+        break;
+    case ']':
+        parseState = PARSE_OSC;
+        break;
+    case '(':
+    case ')':
+    case '*':
+    case '+':
+        parseState = PARSE_CHARSET;
+        break;
+    case '7':
+        savedCursor = cursor;
+        break;
+    case '8':
+        cursor = savedCursor;
+        wrapPending = false;
+        break;
+    case 'D':
+        lineFeed();
+        break;
+    case 'E':
+        cursor.column = 0;
+        lineFeed();
+        break;
+    case 'M':
+        reverseLineFeed();
+        break;
+    default:
+        break;
+    }
+}
+
+
+static void csiByte(unsigned char character)
+{
+    if ((character >= '0') && (character <= '9'))
+    {
+        if (numParams == 0)
+            params[numParams++] = 0;
+        if ((numParams <= VTERM_MAX_PARAMS) && (params[numParams - 1] < 100000))
+            params[numParams - 1] = (params[numParams - 1] * 10) + (character - '0');
+    }
+    else if ((character == ';') || (character == ':'))
+    {
+        if (numParams == 0)
+            params[numParams++] = 0;  // An empty first parameter
+        if (numParams < VTERM_MAX_PARAMS)
+            params[numParams] = 0;
+        numParams++;
+    }
+    else if ((character >= '<') && (character <= '?'))
+    {
+        privateMarker = character;
+    }
+    else if ((character >= 0x40) && (character <= 0x7E))
+    {
+        if (numParams > VTERM_MAX_PARAMS)
+            numParams = VTERM_MAX_PARAMS;
+        csiDispatch(character);
+        parseState = PARSE_GROUND;
+    }
+    // Intermediate bytes change what a few commands mean, none that matter here
+}
+
+
+static void groundByte(unsigned char character)
+{
+    if (utf8Remaining > 0)
+    {
+        if ((character & 0xC0) == 0x80)
+        {
+            utf8CodePoint = (utf8CodePoint << 6) | (character & 0x3F);
+            if (--utf8Remaining == 0)
+                putCodePoint(utf8CodePoint);
+            return;
+        }
+        utf8Remaining = 0;
+        putCodePoint(0xFFFD);  // Cut short, and this byte starts something else
+    }
+
+    if (character < 0x80)
+        putCodePoint(character);
+    else if ((character & 0xE0) == 0xC0)
+        utf8CodePoint = character & 0x1F, utf8Remaining = 1;
+    else if ((character & 0xF0) == 0xE0)
+        utf8CodePoint = character & 0x0F, utf8Remaining = 2;
+    else if ((character & 0xF8) == 0xF0)
+        utf8CodePoint = character & 0x07, utf8Remaining = 3;
+    else
+        putCodePoint(0xFFFD);
+}
+
+
+bool vtermInit(unsigned rows, unsigned columns)
+{
+    if ((rows == 0) || (columns == 0))
+        return false;
+
+    for (unsigned i = 0; i < 2; i++)
+    {
+        screens[i] = (struct vtermCell*)calloc(rows * columns, sizeof(struct vtermCell));
+        screenRows[i] = (struct vtermCell**)calloc(rows, sizeof(struct vtermCell*));
+        if (!screens[i] || !screenRows[i])
+        {
+            vtermDestroy();
+            return false;
+        }
+        for (unsigned row = 0; row < rows; row++)
+            screenRows[i][row] = &screens[i][row * columns];
+    }
+
+    numRows = rows;
+    numColumns = columns;
+    scrollTop = 0;
+    scrollBottom = rows - 1;
+    cursor = (struct cursor){.pen = defaultPen};
+    savedCursor = cursor;
+    alternateSaved = cursor;
+    currentRows = screenRows[1];
+    eraseRows(0, rows);
+    currentRows = screenRows[0];
+    eraseRows(0, rows);
+    return true;
+}
+
+
+void vtermWrite(const void* data, size_t length)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    unsigned char character;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        character = bytes[i];
+
+        if (character == '\e')
+        {
+            if (utf8Remaining > 0)
+            {
+                utf8Remaining = 0;
+                putCodePoint(0xFFFD);
+            }
+            parseState = PARSE_ESCAPE;  // Also how an OSC ends, with ESC backslash
+            continue;
+        }
+
+        switch (parseState)
+        {
+        case PARSE_GROUND:
+            if ((character < 0x20) || (character == 0x7F))
+                controlChar(character);
+            else
+                groundByte(character);
+            break;
+        case PARSE_ESCAPE:
+            escapeDispatch(character);
+            break;
+        case PARSE_CHARSET:
+            parseState = PARSE_GROUND;
+            break;
+        case PARSE_CSI:
+            if (character < 0x20)
+                controlChar(character);
+            else
+                csiByte(character);
+            break;
+        case PARSE_OSC:
+            if (character == '\a')
+                parseState = PARSE_GROUND;
+            break;
+        }
+    }
+}
+
+
+const struct vtermCell* vtermCell(unsigned row, unsigned column)
+{
+    if ((row >= numRows) || (column >= numColumns))
+        return NULL;
+    return cellAt(row, column);
+}
+
+
+void vtermCursor(unsigned* row, unsigned* column)
+{
+    *row = cursor.row;
+    *column = cursor.column;
+}
+
+
+static void putUtf8(uint32_t codePoint, FILE* file)
+{
+    if (codePoint < 0x80)
+    {
+        fputc(codePoint, file);
+    }
+    else if (codePoint < 0x800)
+    {
+        fputc(0xC0 | (codePoint >> 6), file);
+        fputc(0x80 | (codePoint & 0x3F), file);
+    }
+    else if (codePoint < 0x10000)
+    {
+        fputc(0xE0 | (codePoint >> 12), file);
+        fputc(0x80 | ((codePoint >> 6) & 0x3F), file);
+        fputc(0x80 | (codePoint & 0x3F), file);
+    }
+    else
+    {
+        fputc(0xF0 | (codePoint >> 18), file);
+        fputc(0x80 | ((codePoint >> 12) & 0x3F), file);
+        fputc(0x80 | ((codePoint >> 6) & 0x3F), file);
+        fputc(0x80 | (codePoint & 0x3F), file);
+    }
+}
+
+
+// The text of whichever screen is showing, one line per row without trailing blanks
+void vtermDump(FILE* file)
+{
+    unsigned length;
+    uint32_t codePoint;
+
+    for (unsigned row = 0; row < numRows; row++)
+    {
+        for (length = numColumns; length > 0; length--)
+        {
+            codePoint = cellAt(row, length - 1)->codePoint;
+            if ((codePoint != 0) && (codePoint != ' '))
+                break;
+        }
+
+        for (unsigned column = 0; column < length; column++)
+        {
+            codePoint = cellAt(row, column)->codePoint;
+            putUtf8((codePoint) ? codePoint : ' ', file);
+        }
+        fputc('\n', file);
+    }
+}
+
+
+void vtermDestroy(void)
+{
+    for (unsigned i = 0; i < 2; i++)
+    {
+        free(screens[i]);
+        free(screenRows[i]);
+        screens[i] = NULL;
+        screenRows[i] = NULL;
+    }
+    currentRows = NULL;
+}
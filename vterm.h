@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
+#include <stdint.h>   // for uint8_t, int16_t, uint32_t
+#include <stdio.h>    // for FILE
+
+#define VTERM_MAX_PARAMS 16
+#define VTERM_COLOUR_DEFAULT -1
+
+#define VTERM_ATTR_BOLD 0x01
+#define VTERM_ATTR_DIM 0x02
+#define VTERM_ATTR_UNDERLINE 0x04
+#define VTERM_ATTR_BLINK 0x08
+#define VTERM_ATTR_REVERSE 0x10
+#define VTERM_ATTR_HIDDEN 0x20
+
+// An in-process terminal for -H, so what procprog draws can be checked without a
+// terminal emulator. It covers what procprog itself sends (cursor movement, erasing,
+// the scroll region, SGR, the alternate buffer), and the CSI commands it passes
+// through from the command. Everything else is parsed and ignored.
+
+struct vtermCell
+{
+    uint32_t codePoint;  // 0 for a cell that's never been written
+    int16_t foreground;  // 0-255, or VTERM_COLOUR_DEFAULT
+    int16_t background;
+    uint8_t attributes;  // VTERM_ATTR_*
+};
+
+
+bool vtermInit(unsigned rows, unsigned columns);
+void vtermWrite(const void* data, size_t length);
+const struct vtermCell* vtermCell(unsigned row, unsigned column);
+void vtermCursor(unsigned* row, unsigned* column);
+void vtermDump(FILE* file);
+void vtermSelectGraphicRendition(struct vtermCell* pen, const unsigned* values,
+                                 unsigned numValues);
+void vtermDestroy(void);